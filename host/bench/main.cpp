@@ -0,0 +1,730 @@
+// End-to-end command benchmark: runs App, CommandParser and RFIDController on the host against
+// simulated PN532 readers and replays a command script through the serial link.
+//
+//   rfid_bench [--seed N] [--frame-us N] [--byte-us N] [--json] [--echo] [--baseline FILE] [--tolerance PCT] SCRIPT
+//
+// Script lines are commands as sent over serial, plus directives:
+//   !card <classic1k|classic4k|mini|ntag213|ntag215|ntag216> [enrolled]   new tag in the field
+//   !loop <n> ... !end                                                     repeat the enclosed lines
+//   !seed <n>                                                              reseed payload generation
+//   !loss <percent>                                                        tag exchanges lost to the radio from here on
+// Placeholders: {KEY} sector key of the run, {WRONG_KEY} a key that opens nothing,
+// {DATA:<n>} or {DATA:<min>-<max>} random payload of n or min..max bytes, {ZERO:<n>} n zero bytes,
+// {TEXT:<n>} n bytes of 32-byte text fields, each a random word padded with spaces,
+// {DIGEST} SHA-256 of the last WRITE payload zero-padded to 512 bytes, what DIGEST reports for it.
+#include "App.h"
+#include "PayloadCodec.h"
+#include "SimPN532.h"
+#include <mbedtls/sha256.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+
+// Heap accounting: every allocation carries its size in front of it
+static std::atomic<size_t> heapInUse(0);
+static std::atomic<size_t> heapPeak(0);
+static const size_t HEAP_HEADER = 16;
+
+void *operator new(size_t size)
+{
+    uint8_t *block = static_cast<uint8_t *>(malloc(size + HEAP_HEADER));
+    if (!block)
+    {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<size_t *>(block) = size;
+    size_t inUse = heapInUse += size;
+    size_t peak = heapPeak.load();
+    while (inUse > peak && !heapPeak.compare_exchange_weak(peak, inUse))
+    {
+    }
+    return block + HEAP_HEADER;
+}
+
+void operator delete(void *pointer) noexcept
+{
+    if (pointer)
+    {
+        uint8_t *block = static_cast<uint8_t *>(pointer) - HEAP_HEADER;
+        heapInUse -= *reinterpret_cast<size_t *>(block);
+        free(block);
+    }
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *pointer) noexcept { operator delete(pointer); }
+void operator delete(void *pointer, size_t) noexcept { operator delete(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { operator delete(pointer); }
+
+enum class StepKind
+{
+    COMMAND,
+    CARD,
+    LOSS
+};
+
+struct Step
+{
+    StepKind kind;
+    std::string line;     // Command line, card type for a card step, percentage for a loss step
+    bool enrolled;
+    std::string name;     // Command name the results are grouped by
+};
+
+struct Sample
+{
+    std::string name;
+    bool ok;
+    uint64_t latencyUs;
+    long frames;
+    size_t txBytes; // Reader to host
+    size_t rxBytes; // Host to reader
+};
+
+struct Metrics
+{
+    size_t ops = 0;
+    size_t failed = 0;
+    double opsPerSecond = 0;
+    uint64_t p50Us = 0;
+    uint64_t p99Us = 0;
+    double framesPerOp = 0;
+    double txBytesPerOp = 0;
+    double rxBytesPerOp = 0;
+};
+
+// Bytes of the last hex word of a command line, the data of a WRITE
+static std::vector<uint8_t> lastHexWord(const std::string &line)
+{
+    std::vector<uint8_t> bytes;
+    size_t start = line.rfind(' ');
+    if (start == std::string::npos)
+    {
+        return bytes;
+    }
+    for (size_t i = start + 1; i + 1 < line.size(); i += 2)
+    {
+        bytes.push_back((uint8_t)strtoul(line.substr(i, 2).c_str(), nullptr, 16));
+    }
+    return bytes;
+}
+
+class ScriptLoader
+{
+public:
+    std::vector<Step> steps;
+    std::string error;
+
+    ScriptLoader(uint32_t seed) : random(seed)
+    {
+        // One 6-byte key per sector, 40 sectors for the largest card
+        std::mt19937 keyRandom(seed ^ 0x5EC7012u);
+        for (uint8_t &b : key)
+        {
+            b = keyRandom();
+        }
+        for (uint8_t &b : wrongKey)
+        {
+            b = keyRandom();
+        }
+    }
+
+    const uint8_t *sectorKey() const { return key; }
+
+    bool load(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            size_t first = line.find_first_not_of(" \t\r");
+            size_t last = line.find_last_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#')
+            {
+                continue;
+            }
+            lines.push_back(line.substr(first, last - first + 1));
+        }
+
+        size_t pos = 0;
+        return expand(lines, pos, false);
+    }
+
+private:
+    std::mt19937 random;
+    uint8_t key[240];
+    uint8_t wrongKey[240];
+    std::string cardType = "classic1k";
+    std::vector<uint8_t> written; // Payload of the last WRITE, for {DIGEST}
+
+    bool expand(const std::vector<std::string> &lines, size_t &pos, bool inLoop)
+    {
+        while (pos < lines.size())
+        {
+            std::istringstream words(lines[pos]);
+            std::string word;
+            words >> word;
+            pos++;
+
+            if (word == "!end")
+            {
+                if (!inLoop)
+                {
+                    error = "!end without !loop";
+                    return false;
+                }
+                return true;
+            }
+            else if (word == "!loop")
+            {
+                int count = 0;
+                words >> count;
+                size_t bodyStart = pos;
+                for (int i = 0; i < count || (count == 0 && i == 0); i++)
+                {
+                    pos = bodyStart;
+                    size_t before = steps.size();
+                    if (!expand(lines, pos, true))
+                    {
+                        return false;
+                    }
+                    // A zero count still had to be walked to find its !end
+                    if (count == 0)
+                    {
+                        steps.resize(before);
+                    }
+                }
+            }
+            else if (word == "!seed")
+            {
+                uint32_t seed = 0;
+                words >> seed;
+                random.seed(seed);
+            }
+            else if (word == "!card")
+            {
+                std::string state;
+                words >> cardType >> state;
+                steps.push_back({StepKind::CARD, cardType, state == "enrolled", "CARD"});
+            }
+            else if (word == "!loss")
+            {
+                std::string percent;
+                words >> percent;
+                steps.push_back({StepKind::LOSS, percent, false, "LOSS"});
+            }
+            else if (word[0] == '!')
+            {
+                error = "unknown directive " + word;
+                return false;
+            }
+            else
+            {
+                std::string command;
+                if (!substitute(lines[pos - 1], command))
+                {
+                    return false;
+                }
+                if (word == "WRITE")
+                {
+                    written = lastHexWord(command);
+                }
+                steps.push_back({StepKind::COMMAND, command, false, word});
+            }
+        }
+
+        if (inLoop)
+        {
+            error = "!loop without !end";
+            return false;
+        }
+        return true;
+    }
+
+    bool substitute(const std::string &line, std::string &out)
+    {
+        size_t pos = 0;
+        while (pos < line.size())
+        {
+            size_t open = line.find('{', pos);
+            if (open == std::string::npos)
+            {
+                out += line.substr(pos);
+                break;
+            }
+            size_t close = line.find('}', open);
+            if (close == std::string::npos)
+            {
+                error = "unterminated placeholder in: " + line;
+                return false;
+            }
+            out += line.substr(pos, open - pos);
+
+            std::string name = line.substr(open + 1, close - open - 1);
+            // 4K cards take a 40-sector key, everything else the 16-sector one
+            size_t keyBytes = cardType == "classic4k" ? 240 : 96;
+            if (name == "KEY")
+            {
+                out += hex(key, keyBytes);
+            }
+            else if (name == "WRONG_KEY")
+            {
+                out += hex(wrongKey, keyBytes);
+            }
+            else if (name.compare(0, 5, "DATA:") == 0)
+            {
+                int minimum = 0;
+                int maximum = 0;
+                if (sscanf(name.c_str() + 5, "%d-%d", &minimum, &maximum) < 2)
+                {
+                    maximum = minimum;
+                }
+                int length = minimum + (int)(random() % (uint32_t)(maximum - minimum + 1));
+                std::vector<uint8_t> payload(length);
+                for (uint8_t &b : payload)
+                {
+                    // Non-zero, an all-zero payload means "erase" to WRITE
+                    b = 1 + random() % 255;
+                }
+                out += hex(payload.data(), payload.size());
+            }
+            else if (name.compare(0, 5, "ZERO:") == 0)
+            {
+                out += std::string(2 * atoi(name.c_str() + 5), '0');
+            }
+            else if (name == "DIGEST")
+            {
+                std::vector<uint8_t> payload = written;
+                payload.resize(std::max<size_t>(payload.size(), 512));
+                uint8_t digest[32];
+                mbedtls_sha256(payload.data(), payload.size(), digest, 0);
+                out += hex(digest, sizeof(digest));
+            }
+            else if (name.compare(0, 5, "TEXT:") == 0)
+            {
+                std::vector<uint8_t> payload(atoi(name.c_str() + 5), ' ');
+                for (size_t field = 0; field < payload.size(); field += 32)
+                {
+                    size_t wordLength = 4 + random() % 12;
+                    for (size_t i = 0; i < wordLength && field + i < payload.size(); i++)
+                    {
+                        payload[field + i] = 'A' + random() % 26;
+                    }
+                }
+                out += hex(payload.data(), payload.size());
+            }
+            else
+            {
+                error = "unknown placeholder {" + name + "}";
+                return false;
+            }
+            pos = close + 1;
+        }
+        return true;
+    }
+
+    static std::string hex(const uint8_t *data, size_t length)
+    {
+        static const char digits[] = "0123456789ABCDEF";
+        std::string text;
+        text.reserve(length * 2);
+        for (size_t i = 0; i < length; i++)
+        {
+            text += digits[data[i] >> 4];
+            text += digits[data[i] & 0x0F];
+        }
+        return text;
+    }
+};
+
+// Collects the reply lines coming out of the firmware's serial port
+class ReplyCollector
+{
+public:
+    bool echo = false;
+
+    void attach()
+    {
+        Serial.onLine = [this](const std::string &line) {
+            std::lock_guard<std::mutex> guard(lock);
+            lines++;
+            bytes += line.size() + 2;
+            last = line;
+            if (echo)
+            {
+                fprintf(stderr, "%s\n", line.c_str());
+            }
+            arrived.notify_all();
+        };
+    }
+
+    // Waits for the line after `seen`, false if the firmware went quiet
+    bool waitLine(size_t seen, std::string &line)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        bool got = arrived.wait_for(guard, std::chrono::seconds(10), [this, seen]() { return lines > seen; });
+        line = last;
+        return got;
+    }
+
+    size_t lineCount()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return lines;
+    }
+
+    size_t byteCount()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return bytes;
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable arrived;
+    size_t lines = 0;
+    size_t bytes = 0;
+    std::string last;
+};
+
+static SimCard *makeCard(const std::string &type, bool enrolled, const uint8_t *key, uint8_t serial)
+{
+    static const std::map<std::string, uint8_t> classicSak = {{"classic1k", 0x08}, {"classic4k", 0x18}, {"mini", 0x09}};
+    static const std::map<std::string, uint8_t> ntagStorage = {{"ntag213", 0x0F}, {"ntag215", 0x11}, {"ntag216", 0x13}};
+
+    SimCard *card;
+    if (classicSak.count(type))
+    {
+        card = new SimCard(classicSak.at(type));
+    }
+    else if (ntagStorage.count(type))
+    {
+        card = new SimCard(0x00);
+        card->makeNtag(ntagStorage.at(type));
+    }
+    else
+    {
+        return nullptr;
+    }
+
+    // Every card gets its own UID so the authentication cache sees them as different tags
+    card->uid[card->uidLength - 1] = serial;
+    if (enrolled)
+    {
+        card->enroll(key);
+    }
+    return card;
+}
+
+static Metrics summarize(const std::vector<const Sample *> &samples)
+{
+    Metrics metrics;
+    metrics.ops = samples.size();
+    if (samples.empty())
+    {
+        return metrics;
+    }
+
+    std::vector<uint64_t> latencies;
+    uint64_t totalUs = 0;
+    long frames = 0;
+    size_t tx = 0;
+    size_t rx = 0;
+    for (const Sample *sample : samples)
+    {
+        metrics.failed += sample->ok ? 0 : 1;
+        latencies.push_back(sample->latencyUs);
+        totalUs += sample->latencyUs;
+        frames += sample->frames;
+        tx += sample->txBytes;
+        rx += sample->rxBytes;
+    }
+
+    // Nearest-rank percentiles
+    std::sort(latencies.begin(), latencies.end());
+    metrics.p50Us = latencies[(latencies.size() - 1) * 50 / 100];
+    metrics.p99Us = latencies[(latencies.size() - 1) * 99 / 100];
+    metrics.opsPerSecond = totalUs > 0 ? samples.size() * 1e6 / totalUs : 0;
+    metrics.framesPerOp = (double)frames / samples.size();
+    metrics.txBytesPerOp = (double)tx / samples.size();
+    metrics.rxBytesPerOp = (double)rx / samples.size();
+    return metrics;
+}
+
+static std::string metricsJson(const Metrics &metrics)
+{
+    char text[400];
+    snprintf(text, sizeof(text),
+             "{\"ops\":%zu,\"failed\":%zu,\"ops_per_s\":%.2f,\"p50_us\":%llu,\"p99_us\":%llu,"
+             "\"frames_per_op\":%.2f,\"uart_tx_bytes_per_op\":%.1f,\"uart_rx_bytes_per_op\":%.1f",
+             metrics.ops, metrics.failed, metrics.opsPerSecond, (unsigned long long)metrics.p50Us,
+             (unsigned long long)metrics.p99Us, metrics.framesPerOp, metrics.txBytesPerOp, metrics.rxBytesPerOp);
+    return text;
+}
+
+static void printRow(const std::string &name, const Metrics &metrics)
+{
+    printf("%-14s %6zu %5zu %9.1f %9llu %9llu %9.1f %9.1f %9.1f\n", name.c_str(), metrics.ops, metrics.failed,
+           metrics.opsPerSecond, (unsigned long long)metrics.p50Us, (unsigned long long)metrics.p99Us,
+           metrics.framesPerOp, metrics.txBytesPerOp, metrics.rxBytesPerOp);
+}
+
+// Reads "<key>":<number> from the "total" object of a previous --json run
+static bool baselineValue(const std::string &json, const std::string &key, double &value)
+{
+    size_t total = json.find("\"total\":");
+    if (total == std::string::npos)
+    {
+        return false;
+    }
+    size_t found = json.find("\"" + key + "\":", total);
+    if (found == std::string::npos)
+    {
+        return false;
+    }
+    value = atof(json.c_str() + found + key.size() + 3);
+    return true;
+}
+
+static int compareBaseline(const std::string &path, const Metrics &total, size_t heapPeakBytes, double tolerance)
+{
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    std::string json = content.str();
+    if (json.empty())
+    {
+        fprintf(stderr, "cannot read baseline %s\n", path.c_str());
+        return 2;
+    }
+
+    struct Compared
+    {
+        const char *key;
+        double current;
+        bool higherIsBetter;
+    };
+    const Compared compared[] = {
+        {"ops_per_s", total.opsPerSecond, true},
+        {"p50_us", (double)total.p50Us, false},
+        {"p99_us", (double)total.p99Us, false},
+        {"frames_per_op", total.framesPerOp, false},
+        {"uart_tx_bytes_per_op", total.txBytesPerOp, false},
+        {"heap_peak_bytes", (double)heapPeakBytes, false},
+    };
+
+    int regressions = 0;
+    fprintf(stderr, "%-22s %12s %12s %8s\n", "metric", "baseline", "current", "change");
+    for (const Compared &metric : compared)
+    {
+        double base = 0;
+        if (!baselineValue(json, metric.key, base))
+        {
+            continue;
+        }
+        double change = base != 0 ? (metric.current - base) * 100.0 / base : 0;
+        bool worse = metric.higherIsBetter ? change < -tolerance : change > tolerance;
+        regressions += worse ? 1 : 0;
+        fprintf(stderr, "%-22s %12.2f %12.2f %+7.1f%%%s\n", metric.key, base, metric.current, change, worse ? " REGRESSION" : "");
+    }
+    return regressions > 0 ? 1 : 0;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: rfid_bench [--seed N] [--frame-us N] [--byte-us N] [--json] [--echo] [--baseline FILE] [--tolerance PCT] SCRIPT\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seed = 1;
+    uint32_t frameUs = 2000;
+    uint32_t byteUs = 10;
+    bool json = false;
+    bool echo = false;
+    double tolerance = 5.0;
+    std::string baseline;
+    std::string scriptPath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--seed" && hasValue)
+            seed = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--frame-us" && hasValue)
+            frameUs = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--byte-us" && hasValue)
+            byteUs = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--baseline" && hasValue)
+            baseline = argv[++i];
+        else if (arg == "--tolerance" && hasValue)
+            tolerance = atof(argv[++i]);
+        else if (arg == "--json")
+            json = true;
+        else if (arg == "--echo")
+            echo = true;
+        else if (arg[0] != '-' && scriptPath.empty())
+            scriptPath = arg;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (scriptPath.empty())
+    {
+        usage();
+        return 2;
+    }
+
+    ScriptLoader script(seed);
+    if (!script.load(scriptPath))
+    {
+        fprintf(stderr, "%s: %s\n", scriptPath.c_str(), script.error.c_str());
+        return 2;
+    }
+
+    // The benchmark drives reader @0, the others stay without a simulator and fail to initialize
+    static const uint8_t ssPins[] = RFID_SS_PINS;
+    SimPN532 sim;
+    simAttach(ssPins[0], &sim);
+    simSetFrameCost(frameUs, byteUs);
+
+    ReplyCollector replies;
+    replies.echo = echo;
+    replies.attach();
+    static App app;
+    app.setup();
+
+    // Cards and result storage are set up front, so the heap peak only reflects the firmware
+    std::vector<std::unique_ptr<SimCard>> cards;
+    for (const Step &step : script.steps)
+    {
+        if (step.kind == StepKind::CARD)
+        {
+            SimCard *card = makeCard(step.line, step.enrolled, script.sectorKey(), (uint8_t)cards.size());
+            if (!card)
+            {
+                fprintf(stderr, "%s: unknown card type %s\n", scriptPath.c_str(), step.line.c_str());
+                return 2;
+            }
+            cards.emplace_back(card);
+        }
+    }
+    std::vector<Sample> samples;
+    samples.reserve(script.steps.size());
+
+    // How far LZ4 shrinks the WRITE payloads, to set against the frames and time it saves
+    size_t writeBytes = 0;
+    size_t packedBytes = 0;
+    for (const Step &step : script.steps)
+    {
+        if (step.kind != StepKind::COMMAND || step.name != "WRITE")
+        {
+            continue;
+        }
+        std::vector<uint8_t> data = lastHexWord(step.line);
+        std::vector<uint8_t> packed(data.size());
+        uint16_t packedLength = data.size() > 1 ? PayloadCodec::compress(data.data(), data.size(), packed.data(), data.size() - 1) : 0;
+        writeBytes += data.size();
+        packedBytes += packedLength ? packedLength : data.size();
+    }
+
+    size_t nextCard = 0;
+    size_t heapBefore = heapInUse.load();
+    heapPeak = heapBefore;
+    auto hostStart = std::chrono::steady_clock::now();
+
+    for (const Step &step : script.steps)
+    {
+        if (step.kind == StepKind::CARD)
+        {
+            sim.field.assign(1, cards[nextCard++].get());
+            continue;
+        }
+        if (step.kind == StepKind::LOSS)
+        {
+            sim.lossPercent = atoi(step.line.c_str());
+            continue;
+        }
+
+        size_t linesBefore = replies.lineCount();
+        size_t bytesBefore = replies.byteCount();
+        long framesBefore = sim.frames;
+        unsigned long start = micros();
+
+        Serial.pushLine(step.line);
+        app.loop();
+
+        std::string reply;
+        if (!replies.waitLine(linesBefore, reply))
+        {
+            fprintf(stderr, "no reply to: %.60s\n", step.line.c_str());
+            fflush(stdout);
+            _Exit(2);
+        }
+
+        samples.push_back({step.name, reply.compare(0, 3, "OK ") == 0, micros() - start, sim.frames - framesBefore,
+                           replies.byteCount() - bytesBefore, step.line.size() + 1});
+    }
+
+    double hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - hostStart).count();
+    size_t heapPeakBytes = heapPeak.load() - heapBefore;
+
+    std::vector<const Sample *> all;
+    std::map<std::string, std::vector<const Sample *>> byCommand;
+    for (const Sample &sample : samples)
+    {
+        all.push_back(&sample);
+        byCommand[sample.name].push_back(&sample);
+    }
+    Metrics total = summarize(all);
+
+    if (json)
+    {
+        printf("{\"script\":\"%s\",\"seed\":%u,\"frame_us\":%u,\"byte_us\":%u,\"host_seconds\":%.3f,\"write_bytes\":%zu,\"write_lz4_bytes\":%zu,"
+               "\"total\":%s,\"heap_peak_bytes\":%zu},\"commands\":{",
+               scriptPath.c_str(), seed, frameUs, byteUs, hostSeconds, writeBytes, packedBytes, metricsJson(total).c_str(), heapPeakBytes);
+        bool first = true;
+        for (auto &entry : byCommand)
+        {
+            printf("%s\"%s\":%s}", first ? "" : ",", entry.first.c_str(), metricsJson(summarize(entry.second)).c_str());
+            first = false;
+        }
+        printf("}}\n");
+    }
+    else
+    {
+        printf("%s: seed %u, frame %u us + %u us/byte\n", scriptPath.c_str(), seed, frameUs, byteUs);
+        printf("%-14s %6s %5s %9s %9s %9s %9s %9s %9s\n", "command", "ops", "fail", "ops/s", "p50_us", "p99_us", "frames/op", "tx_B/op", "rx_B/op");
+        for (auto &entry : byCommand)
+        {
+            printRow(entry.first, summarize(entry.second));
+        }
+        printRow("TOTAL", total);
+        if (writeBytes > 0)
+        {
+            printf("WRITE payloads %zu bytes, LZ4 %zu bytes (%.2f)\n", writeBytes, packedBytes, (double)packedBytes / writeBytes);
+        }
+        printf("heap peak %zu bytes, host time %.2f s\n", heapPeakBytes, hostSeconds);
+    }
+
+    int status = baseline.empty() ? 0 : compareBaseline(baseline, total, heapPeakBytes, tolerance);
+
+    // Reader tasks never return, leave without running static destructors under them
+    fflush(stdout);
+    fflush(stderr);
+    _Exit(status);
+}
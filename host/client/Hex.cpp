@@ -0,0 +1,85 @@
+#include "Hex.h"
+#include <cstring>
+
+namespace rfid
+{
+
+namespace
+{
+
+struct Tables
+{
+    char pairs[256][2];    // Byte to its two digits
+    uint8_t nibbles[256];  // Digit to its value, 0x80 for anything else
+
+    Tables()
+    {
+        static const char digits[] = "0123456789ABCDEF";
+        for (int b = 0; b < 256; b++)
+        {
+            pairs[b][0] = digits[b >> 4];
+            pairs[b][1] = digits[b & 0x0F];
+        }
+
+        memset(nibbles, 0x80, sizeof(nibbles));
+        for (int d = 0; d < 16; d++)
+        {
+            nibbles[(uint8_t)digits[d]] = d;
+            nibbles[(uint8_t)"0123456789abcdef"[d]] = d;
+        }
+    }
+};
+
+const Tables tables;
+
+} // namespace
+
+void Hex::encode(const uint8_t *data, size_t length, char *out)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        memcpy(out + i * 2, tables.pairs[data[i]], 2);
+    }
+}
+
+std::string Hex::encode(const Bytes &data)
+{
+    std::string text;
+    append(text, data.data(), data.size());
+    return text;
+}
+
+void Hex::append(std::string &out, const uint8_t *data, size_t length)
+{
+    size_t start = out.size();
+    out.resize(start + length * 2);
+    encode(data, length, &out[start]);
+}
+
+bool Hex::decode(std::string_view text, uint8_t *out)
+{
+    if (text.size() % 2 != 0)
+    {
+        return false;
+    }
+
+    uint8_t invalid = 0;
+    const uint8_t *digits = reinterpret_cast<const uint8_t *>(text.data());
+    size_t length = text.size() / 2;
+    for (size_t i = 0; i < length; i++)
+    {
+        uint8_t high = tables.nibbles[digits[i * 2]];
+        uint8_t low = tables.nibbles[digits[i * 2 + 1]];
+        invalid |= high | low;
+        out[i] = (uint8_t)(high << 4) | (low & 0x0F);
+    }
+    return (invalid & 0x80) == 0;
+}
+
+bool Hex::decode(std::string_view text, Bytes &out)
+{
+    out.resize(text.size() / 2);
+    return decode(text, out.data());
+}
+
+} // namespace rfid
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rfid
+{
+
+typedef std::vector<uint8_t> Bytes;
+
+// Table driven hex conversion for the long key and payload strings of the protocol.
+// Both loops are branch free per byte; invalid digits are collected and checked once.
+class Hex
+{
+public:
+    // Writes 2 * length uppercase digits to out
+    static void encode(const uint8_t *data, size_t length, char *out);
+    static std::string encode(const Bytes &data);
+    static void append(std::string &out, const uint8_t *data, size_t length);
+
+    // Decodes text.size() / 2 bytes to out, false on an odd length or a non-hex digit
+    static bool decode(std::string_view text, uint8_t *out);
+    static bool decode(std::string_view text, Bytes &out);
+};
+
+} // namespace rfid
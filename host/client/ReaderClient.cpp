@@ -0,0 +1,744 @@
+#include "ReaderClient.h"
+#include "Tty.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace rfid
+{
+
+namespace
+{
+
+Reply failureReply(const char *code, const char *description)
+{
+    Reply reply;
+    reply.code = code;
+    reply.description = description;
+    return reply;
+}
+
+bool hexWord(const Reply &reply, const char *name, Bytes &value)
+{
+    return reply.word(0) == name && Hex::decode(reply.word(1), value) && !value.empty();
+}
+
+bool toUid(const Reply &reply, Bytes &uid)
+{
+    return hexWord(reply, "UID", uid);
+}
+
+bool toData(const Reply &reply, Bytes &data)
+{
+    return hexWord(reply, "DATA", data);
+}
+
+bool toDigest(const Reply &reply, Bytes &digest)
+{
+    return hexWord(reply, "DIGEST", digest) && digest.size() == 32;
+}
+
+bool toMatch(const Reply &reply, bool &match)
+{
+    match = reply.word(1) == "MATCH";
+    return reply.word(0) == "VERIFY" && (match || reply.word(1) == "MISMATCH");
+}
+
+bool toDone(const Reply &reply, Done &)
+{
+    return reply.word(0) == "WRITE_DONE";
+}
+
+bool toBitmap(std::string_view text, uint64_t &bits)
+{
+    // One hex digit per four sectors, most significant first
+    bits = 0;
+    if (text.empty() || text.size() > 16)
+    {
+        return false;
+    }
+    for (char c : text)
+    {
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0)
+        {
+            return false;
+        }
+        bits = (bits << 4) | (uint64_t)digit;
+    }
+    return true;
+}
+
+bool toEnrollInfo(const Reply &reply, EnrollInfo &info)
+{
+    return reply.word(0) == "ENROLL_DONE" && reply.word(1) == "ENROLLED" && toBitmap(reply.word(2), info.enrolled) &&
+           reply.word(3) == "SKIPPED" && toBitmap(reply.word(4), info.skipped);
+}
+
+bool toVersion(const Reply &reply, std::string &version)
+{
+    if (reply.word(0) != "VERSION")
+    {
+        return false;
+    }
+    version = std::string(reply.word(1));
+    return true;
+}
+
+} // namespace
+
+ReaderClient::ReaderClient()
+{
+    fd = -1;
+    wakePipe[0] = wakePipe[1] = -1;
+    pipelining = false;
+    timeoutMs = 10000;
+    handshakeMs = 3000;
+    running = false;
+    resyncing = false;
+}
+
+ReaderClient::~ReaderClient()
+{
+    close();
+}
+
+bool ReaderClient::open(const std::string &device, std::string &error, int handshakeTimeoutMs)
+{
+    close();
+
+    fd = openTty(device, error);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    handshakeMs = handshakeTimeoutMs;
+    if (!handshake(handshakeTimeoutMs, pipelining, versionText, error) || pipe2(wakePipe, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        if (error.empty())
+        {
+            error = strerror(errno);
+        }
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    running = true;
+    resyncing = false;
+    ioThread = std::thread(&ReaderClient::ioLoop, this);
+    return true;
+}
+
+void ReaderClient::close()
+{
+    if (ioThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running = false;
+        }
+        char wake = 0;
+        (void)!::write(wakePipe[1], &wake, 1);
+        ioThread.join();
+    }
+
+    failAll("CLOSED", "Connection to the reader was closed");
+
+    for (int &end : wakePipe)
+    {
+        if (end >= 0)
+        {
+            ::close(end);
+            end = -1;
+        }
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    input.clear();
+}
+
+bool ReaderClient::handshake(int timeoutMs, bool &prefixes, std::string &version, std::string &error)
+{
+    // A board that resets on open ignores input while it boots, so VERSION is repeated until
+    // something answers. "@0 VERSION" also probes for reader prefixes: older firmware rejects it.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    auto nextSend = std::chrono::steady_clock::now();
+    std::string buffer;
+
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        if (std::chrono::steady_clock::now() >= nextSend)
+        {
+            if (!writeLine("@0 VERSION"))
+            {
+                error = "write failed: " + std::string(strerror(errno));
+                return false;
+            }
+            nextSend += std::chrono::milliseconds(500);
+        }
+
+        pollfd readable = {fd, POLLIN, 0};
+        if (poll(&readable, 1, 50) <= 0)
+        {
+            continue;
+        }
+        char chunk[256];
+        ssize_t count = ::read(fd, chunk, sizeof(chunk));
+        if (count <= 0)
+        {
+            continue;
+        }
+        buffer.append(chunk, count);
+
+        size_t end;
+        while ((end = buffer.find('\n')) != std::string::npos)
+        {
+            std::string_view line(buffer.data(), end);
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.remove_suffix(1);
+            }
+
+            // Only the answer to the probe counts, replies to earlier commands are passed over
+            Reply reply;
+            if (Reply::parse(line, reply) && (toVersion(reply, version) || (!reply.ok && reply.echoes("@0 VERSION"))))
+            {
+                prefixes = reply.ok && reply.reader == 0;
+                if (!prefixes)
+                {
+                    version.clear();
+                }
+
+                // Answers to repeated probes may still be on their way
+                usleep(100000);
+                tcflush(fd, TCIFLUSH);
+                return true;
+            }
+            buffer.erase(0, end + 1);
+        }
+    }
+
+    error = "no reply from the reader";
+    return false;
+}
+
+std::string ReaderClient::commandLine(int reader, const std::string &command) const
+{
+    return pipelining ? "@" + std::to_string(reader) + " " + command : command;
+}
+
+bool ReaderClient::writeLine(const std::string &line)
+{
+    std::string output = line + "\n";
+    const char *data = output.data();
+    size_t remaining = output.size();
+    while (remaining > 0)
+    {
+        ssize_t written = ::write(fd, data, remaining);
+        if (written < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                return false;
+            }
+            pollfd writable = {fd, POLLOUT, 0};
+            poll(&writable, 1, 100);
+            continue;
+        }
+        data += written;
+        remaining -= written;
+    }
+    return true;
+}
+
+void ReaderClient::send(const RequestPtr &request)
+{
+    request->sent = true;
+    request->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    if (!writeLine(request->line))
+    {
+        // Completed as a timeout, the tty is most likely gone
+        request->deadline = std::chrono::steady_clock::now();
+    }
+}
+
+template <typename T>
+void ReaderClient::submit(int reader, const std::string &command, bool immediate, bool (*convert)(const Reply &, T &), Callback<T> done)
+{
+    RequestPtr request = std::make_shared<Request>();
+    request->line = commandLine(reader, command);
+    request->immediate = immediate && pipelining;
+    request->complete = [convert, done](const Reply &reply) {
+        Result<T> result;
+        if (reply.ok)
+        {
+            result.ok = convert(reply, result.value);
+            if (!result.ok)
+            {
+                result.error = {"PROTOCOL", "Unexpected reply", std::string(reply.body)};
+            }
+        }
+        else
+        {
+            result.error = {std::string(reply.code), std::string(reply.description), std::string(reply.context)};
+        }
+        done(std::move(result));
+    };
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (running && (pipelining || reader == 0))
+        {
+            ReaderQueue &queue = readers[pipelining ? reader : 0];
+            int depth = pipelining ? FIRMWARE_QUEUE_DEPTH : 1;
+            if (resyncing)
+            {
+                queue.waiting.push_back(request);
+            }
+            else if (request->immediate)
+            {
+                queue.immediate.push_back(request);
+                send(request);
+            }
+            else if (queue.queued.size() < (size_t)depth && queue.waiting.empty())
+            {
+                queue.queued.push_back(request);
+                send(request);
+            }
+            else
+            {
+                queue.waiting.push_back(request);
+            }
+
+            // Deadlines changed, let the I/O thread recompute its poll timeout
+            char wake = 0;
+            (void)!::write(wakePipe[1], &wake, 1);
+            return;
+        }
+    }
+
+    request->complete(running ? failureReply("INVALID_READER", "Firmware without reader prefixes only drives reader 0")
+                              : failureReply("CLOSED", "Connection to the reader is not open"));
+}
+
+template <typename T, typename Start>
+std::future<Result<T>> ReaderClient::toFuture(Start start)
+{
+    std::shared_ptr<std::promise<Result<T>>> promise = std::make_shared<std::promise<Result<T>>>();
+    std::future<Result<T>> future = promise->get_future();
+    start([promise](Result<T> result) { promise->set_value(std::move(result)); });
+    return future;
+}
+
+void ReaderClient::scanUid(int reader, Callback<Bytes> done)
+{
+    submit<Bytes>(reader, "SCAN_UID", false, toUid, std::move(done));
+}
+
+void ReaderClient::read(const Bytes &key, int reader, Callback<Bytes> done)
+{
+    std::string command = "READ ";
+    Hex::append(command, key.data(), key.size());
+    submit<Bytes>(reader, command, false, toData, std::move(done));
+}
+
+void ReaderClient::digest(const Bytes &key, int reader, Callback<Bytes> done)
+{
+    std::string command = "DIGEST ";
+    Hex::append(command, key.data(), key.size());
+    submit<Bytes>(reader, command, false, toDigest, std::move(done));
+}
+
+void ReaderClient::verify(const Bytes &key, const Bytes &digest, int reader, Callback<bool> done)
+{
+    std::string command = "VERIFY ";
+    Hex::append(command, key.data(), key.size());
+    command += ' ';
+    Hex::append(command, digest.data(), digest.size());
+    submit<bool>(reader, command, false, toMatch, std::move(done));
+}
+
+void ReaderClient::write(const Bytes &key, const Bytes &data, int reader, Callback<Done> done)
+{
+    std::string command;
+    command.reserve(7 + (key.size() + data.size()) * 2);
+    command = "WRITE ";
+    Hex::append(command, key.data(), key.size());
+    command += ' ';
+    Hex::append(command, data.data(), data.size());
+    submit<Done>(reader, command, false, toDone, std::move(done));
+}
+
+void ReaderClient::enroll(const Bytes &key, int reader, Callback<EnrollInfo> done)
+{
+    std::string command = "ENROLL ";
+    Hex::append(command, key.data(), key.size());
+    submit<EnrollInfo>(reader, command, false, toEnrollInfo, std::move(done));
+}
+
+void ReaderClient::version(Callback<std::string> done)
+{
+    submit<std::string>(0, "VERSION", true, toVersion, std::move(done));
+}
+
+std::future<Result<Bytes>> ReaderClient::scanUid(int reader)
+{
+    return toFuture<Bytes>([this, reader](Callback<Bytes> done) { scanUid(reader, std::move(done)); });
+}
+
+std::future<Result<Bytes>> ReaderClient::read(const Bytes &key, int reader)
+{
+    return toFuture<Bytes>([this, &key, reader](Callback<Bytes> done) { read(key, reader, std::move(done)); });
+}
+
+std::future<Result<Bytes>> ReaderClient::digest(const Bytes &key, int reader)
+{
+    return toFuture<Bytes>([this, &key, reader](Callback<Bytes> done) { digest(key, reader, std::move(done)); });
+}
+
+std::future<Result<bool>> ReaderClient::verify(const Bytes &key, const Bytes &digest, int reader)
+{
+    return toFuture<bool>([this, &key, &digest, reader](Callback<bool> done) { verify(key, digest, reader, std::move(done)); });
+}
+
+std::future<Result<Done>> ReaderClient::write(const Bytes &key, const Bytes &data, int reader)
+{
+    return toFuture<Done>([this, &key, &data, reader](Callback<Done> done) { write(key, data, reader, std::move(done)); });
+}
+
+std::future<Result<EnrollInfo>> ReaderClient::enroll(const Bytes &key, int reader)
+{
+    return toFuture<EnrollInfo>([this, &key, reader](Callback<EnrollInfo> done) { enroll(key, reader, std::move(done)); });
+}
+
+std::future<Result<std::string>> ReaderClient::version()
+{
+    return toFuture<std::string>([this](Callback<std::string> done) { version(std::move(done)); });
+}
+
+void ReaderClient::ioLoop()
+{
+    char chunk[4096];
+    for (;;)
+    {
+        pollfd fds[2] = {{fd, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+        poll(fds, 2, nextTimeout());
+
+        if (fds[1].revents & POLLIN)
+        {
+            while (::read(wakePipe[0], chunk, sizeof(chunk)) > 0)
+            {
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!running)
+            {
+                return;
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            ssize_t count;
+            while ((count = ::read(fd, chunk, sizeof(chunk))) > 0)
+            {
+                input.append(chunk, count);
+            }
+
+            // Lines are handled in place, the buffer is only compacted once all of them are done
+            size_t start = 0;
+            size_t end;
+            while ((end = input.find('\n', start)) != std::string::npos)
+            {
+                std::string_view line(input.data() + start, end - start);
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.remove_suffix(1);
+                }
+                handleLine(line);
+                start = end + 1;
+            }
+            input.erase(0, start);
+        }
+
+        // Timed out requests are completed outside the lock, like replies
+        std::vector<RequestPtr> expired;
+        int stalled = -1;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto now = std::chrono::steady_clock::now();
+            for (auto &entry : readers)
+            {
+                for (std::deque<RequestPtr> *sent : {&entry.second.queued, &entry.second.immediate})
+                {
+                    for (RequestPtr &request : *sent)
+                    {
+                        if (request->deadline > now)
+                        {
+                            continue;
+                        }
+                        if (request->abandoned)
+                        {
+                            stalled = entry.first;
+                        }
+                        else
+                        {
+                            request->abandoned = true;
+                            request->deadline = now + std::chrono::milliseconds(timeoutMs);
+                            expired.push_back(request);
+                        }
+                    }
+                }
+            }
+        }
+        for (RequestPtr &request : expired)
+        {
+            request->complete(failureReply("TIMEOUT", "No reply from the reader in time"));
+        }
+        if (stalled >= 0)
+        {
+            resync(stalled);
+        }
+    }
+}
+
+void ReaderClient::handleLine(std::string_view line)
+{
+    Reply reply;
+    if (!Reply::parse(line, reply))
+    {
+        return;
+    }
+
+    RequestPtr request = match(reply);
+    if (request && !request->abandoned)
+    {
+        // The reply views still point into the input buffer, decoding happens right here
+        request->complete(reply);
+    }
+}
+
+ReaderClient::RequestPtr ReaderClient::match(const Reply &reply)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    int reader = pipelining ? reply.reader : 0;
+    auto found = readers.find(reader);
+    if (found == readers.end())
+    {
+        return nullptr;
+    }
+    ReaderQueue &queue = found->second;
+
+    RequestPtr request;
+    if (reply.immediate() && !queue.immediate.empty())
+    {
+        request = queue.immediate.front();
+        queue.immediate.pop_front();
+    }
+    else if (reply.rejection())
+    {
+        // Rejected before reaching the reader, find the command by its echoed line
+        for (std::deque<RequestPtr> *sent : {&queue.immediate, &queue.queued})
+        {
+            for (auto it = sent->begin(); it != sent->end() && !request; ++it)
+            {
+                if (reply.echoes((*it)->line))
+                {
+                    request = *it;
+                    sent->erase(it);
+                    break;
+                }
+            }
+        }
+    }
+    else if (!reply.immediate() && !queue.queued.empty())
+    {
+        request = queue.queued.front();
+        queue.queued.pop_front();
+    }
+
+    // A reader slot came free, the next waiting command can go out
+    pump(queue);
+    return request;
+}
+
+void ReaderClient::pump(ReaderQueue &queue)
+{
+    if (resyncing)
+    {
+        return;
+    }
+    int depth = pipelining ? FIRMWARE_QUEUE_DEPTH : 1;
+    while (!queue.waiting.empty())
+    {
+        RequestPtr request = queue.waiting.front();
+        if (request->immediate)
+        {
+            // Held back only by a resync
+            queue.immediate.push_back(request);
+        }
+        else if (queue.queued.size() < (size_t)depth)
+        {
+            queue.queued.push_back(request);
+        }
+        else
+        {
+            break;
+        }
+        queue.waiting.pop_front();
+        send(request);
+    }
+}
+
+void ReaderClient::resync(int reader)
+{
+    // The reader's pending commands can no longer be told apart from each other's replies,
+    // and the flush below drops whatever the other readers still had to answer
+    std::vector<RequestPtr> failed;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        resyncing = true;
+        for (auto &entry : readers)
+        {
+            ReaderQueue &queue = entry.second;
+            std::vector<std::deque<RequestPtr> *> dropped = {&queue.queued, &queue.immediate};
+            if (entry.first == reader)
+            {
+                dropped.push_back(&queue.waiting);
+            }
+            for (std::deque<RequestPtr> *requests : dropped)
+            {
+                for (RequestPtr &request : *requests)
+                {
+                    if (!request->abandoned)
+                    {
+                        failed.push_back(request);
+                    }
+                }
+                requests->clear();
+            }
+        }
+    }
+    for (RequestPtr &request : failed)
+    {
+        request->complete(failureReply("TIMEOUT", "Reader stopped replying, the link was resynchronized"));
+    }
+
+    // Replies of commands the firmware is still working through are let in and dropped until
+    // the link has been quiet for a whole timeout, then the handshake finds the stream again
+    char chunk[4096];
+    auto quietSince = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - quietSince < std::chrono::milliseconds(timeoutMs))
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!running)
+            {
+                return;
+            }
+        }
+        pollfd fds[2] = {{fd, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+        poll(fds, 2, 100);
+        if (fds[1].revents & POLLIN)
+        {
+            while (::read(wakePipe[0], chunk, sizeof(chunk)) > 0)
+            {
+            }
+        }
+        if ((fds[0].revents & POLLIN) && ::read(fd, chunk, sizeof(chunk)) > 0)
+        {
+            quietSince = std::chrono::steady_clock::now();
+        }
+    }
+    input.clear();
+    tcflush(fd, TCIFLUSH);
+
+    bool prefixes;
+    std::string version;
+    std::string error;
+    bool found = handshake(handshakeMs, prefixes, version, error);
+
+    failed.clear();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        resyncing = false;
+        for (auto &entry : readers)
+        {
+            if (found)
+            {
+                pump(entry.second);
+                continue;
+            }
+            // No answer at all, the commands that waited fail and later ones try again
+            for (RequestPtr &request : entry.second.waiting)
+            {
+                failed.push_back(request);
+            }
+            entry.second.waiting.clear();
+        }
+    }
+    for (RequestPtr &request : failed)
+    {
+        request->complete(failureReply("TIMEOUT", "Reader stopped replying and did not answer the handshake"));
+    }
+}
+
+int ReaderClient::nextTimeout()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto now = std::chrono::steady_clock::now();
+    auto nearest = now + std::chrono::seconds(1);
+    for (auto &entry : readers)
+    {
+        for (std::deque<RequestPtr> *sent : {&entry.second.queued, &entry.second.immediate})
+        {
+            for (RequestPtr &request : *sent)
+            {
+                if (request->deadline < nearest)
+                {
+                    nearest = request->deadline;
+                }
+            }
+        }
+    }
+    return nearest <= now ? 0 : (int)std::chrono::duration_cast<std::chrono::milliseconds>(nearest - now).count() + 1;
+}
+
+void ReaderClient::failAll(const char *code, const char *description)
+{
+    std::vector<RequestPtr> pending;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto &entry : readers)
+        {
+            for (std::deque<RequestPtr> *requests : {&entry.second.waiting, &entry.second.queued, &entry.second.immediate})
+            {
+                for (RequestPtr &request : *requests)
+                {
+                    if (!request->abandoned)
+                    {
+                        pending.push_back(request);
+                    }
+                }
+            }
+        }
+        readers.clear();
+    }
+
+    for (RequestPtr &request : pending)
+    {
+        request->complete(failureReply(code, description));
+    }
+}
+
+} // namespace rfid
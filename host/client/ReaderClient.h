@@ -0,0 +1,151 @@
+#pragma once
+#include "Hex.h"
+#include "Reply.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace rfid
+{
+
+struct Error
+{
+    std::string code; // Firmware error code, or TIMEOUT / CLOSED / PROTOCOL from the client
+    std::string description;
+    std::string context;
+};
+
+template <typename T>
+struct Result
+{
+    bool ok = false;
+    T value{};
+    Error error;
+};
+
+// Value of operations that only report success
+struct Done
+{
+};
+
+// Sector bitmaps of ENROLL, bit n is sector n
+struct EnrollInfo
+{
+    uint64_t enrolled = 0;
+    uint64_t skipped = 0;
+};
+
+template <typename T>
+using Callback = std::function<void(Result<T>)>;
+
+// Typed client for the reader's serial protocol over a POSIX tty.
+//
+// Every call is asynchronous and completes through a callback (run on the client's I/O
+// thread) or a future. Firmware that takes "@n" reader prefixes queues commands per
+// reader, so up to FIRMWARE_QUEUE_DEPTH commands per reader are kept in flight and their
+// replies matched in order. Older firmware gets one command at a time.
+//
+// A reply lost on the link would shift every later reply of its reader onto the command
+// before it. A timed out command therefore keeps its place for one more timeout; if its reply
+// has not come by then, everything pending on that reader fails with TIMEOUT, the commands
+// other readers have in flight fail too, and the link is flushed and the handshake run again.
+class ReaderClient
+{
+public:
+    // Commands the firmware queues per reader (READER_QUEUE_DEPTH)
+    static const int FIRMWARE_QUEUE_DEPTH = 4;
+
+    ReaderClient();
+    ~ReaderClient();
+    ReaderClient(const ReaderClient &) = delete;
+    ReaderClient &operator=(const ReaderClient &) = delete;
+
+    // Opens the device and asks for VERSION, which also tells whether pipelining is supported
+    bool open(const std::string &device, std::string &error, int handshakeTimeoutMs = 3000);
+    // Fails everything still outstanding with CLOSED
+    void close();
+
+    bool pipelined() const { return pipelining; }
+    const std::string &firmwareVersion() const { return versionText; }
+    // Time allowed per command once it is sent, 10 s by default, and for its late reply after that
+    void setTimeout(int ms) { timeoutMs = ms; }
+
+    void scanUid(int reader, Callback<Bytes> done);
+    void read(const Bytes &key, int reader, Callback<Bytes> done);
+    // SHA-256 of what read would return, and its comparison with digest on the reader (true for a match)
+    void digest(const Bytes &key, int reader, Callback<Bytes> done);
+    void verify(const Bytes &key, const Bytes &digest, int reader, Callback<bool> done);
+    void write(const Bytes &key, const Bytes &data, int reader, Callback<Done> done);
+    void enroll(const Bytes &key, int reader, Callback<EnrollInfo> done);
+    void version(Callback<std::string> done);
+
+    std::future<Result<Bytes>> scanUid(int reader = 0);
+    std::future<Result<Bytes>> read(const Bytes &key, int reader = 0);
+    std::future<Result<Bytes>> digest(const Bytes &key, int reader = 0);
+    std::future<Result<bool>> verify(const Bytes &key, const Bytes &digest, int reader = 0);
+    std::future<Result<Done>> write(const Bytes &key, const Bytes &data, int reader = 0);
+    std::future<Result<EnrollInfo>> enroll(const Bytes &key, int reader = 0);
+    std::future<Result<std::string>> version();
+
+private:
+    struct Request
+    {
+        std::string line;
+        bool immediate; // Answered by the firmware's main loop, ahead of the reader queue
+        bool sent = false;
+        bool abandoned = false; // Timed out, its late reply is still consumed
+        // Time by which the reply is due, once abandoned the time by which the late reply is
+        std::chrono::steady_clock::time_point deadline;
+        std::function<void(const Reply &)> complete;
+    };
+    typedef std::shared_ptr<Request> RequestPtr;
+
+    struct ReaderQueue
+    {
+        std::deque<RequestPtr> waiting;   // Not sent yet, the reader queue is full
+        std::deque<RequestPtr> queued;    // Sent, answered in order by the reader
+        std::deque<RequestPtr> immediate; // Sent, answered in order by the main loop
+    };
+
+    int fd;
+    int wakePipe[2];
+    bool pipelining;
+    std::string versionText;
+    int timeoutMs;
+    int handshakeMs;
+
+    std::mutex lock;
+    std::map<int, ReaderQueue> readers;
+    std::thread ioThread;
+    bool running;
+    bool resyncing; // Commands wait while the link is resynchronized
+    std::string input;
+
+    template <typename T>
+    void submit(int reader, const std::string &command, bool immediate, bool (*convert)(const Reply &, T &), Callback<T> done);
+    template <typename T, typename Start>
+    static std::future<Result<T>> toFuture(Start start);
+
+    std::string commandLine(int reader, const std::string &command) const;
+    bool handshake(int timeoutMs, bool &prefixes, std::string &version, std::string &error);
+    bool writeLine(const std::string &line);
+    void send(const RequestPtr &request);
+    void ioLoop();
+    void handleLine(std::string_view line);
+    RequestPtr match(const Reply &reply);
+    // Sends waiting commands while the reader has room for them
+    void pump(ReaderQueue &queue);
+    // Recovers from a reply that never came on reader, run on the I/O thread
+    void resync(int reader);
+    int nextTimeout();
+    void failAll(const char *code, const char *description);
+};
+
+} // namespace rfid
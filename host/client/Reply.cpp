@@ -0,0 +1,161 @@
+#include "Reply.h"
+
+namespace rfid
+{
+
+namespace
+{
+
+const char *const REJECTION_CODES[] = {"UNKNOWN_CMD", "INVALID_ARGS", "INVALID_HEX", "INVALID_LENGTH",
+                                       "MISSING_ARGS", "PARSE_ERROR", "INVALID_READER", "BUSY"};
+
+const char *const IMMEDIATE_COMMANDS[] = {"VERSION", "HELP", "STATS", "TRACE", "CAPTURE"};
+
+bool equalsIgnoreCase(std::string_view text, const char *upper)
+{
+    size_t i = 0;
+    for (; i < text.size() && upper[i]; i++)
+    {
+        char c = text[i] >= 'a' && text[i] <= 'z' ? text[i] - 'a' + 'A' : text[i];
+        if (c != upper[i])
+        {
+            return false;
+        }
+    }
+    return i == text.size() && !upper[i];
+}
+
+} // namespace
+
+bool Reply::parse(std::string_view line, Reply &reply)
+{
+    reply = Reply();
+
+    if (!line.empty() && line[0] == '@')
+    {
+        size_t space = line.find(' ');
+        if (space == std::string_view::npos || space == 1 || space > 3)
+        {
+            return false;
+        }
+        int reader = 0;
+        for (size_t i = 1; i < space; i++)
+        {
+            if (line[i] < '0' || line[i] > '9')
+            {
+                return false;
+            }
+            reader = reader * 10 + (line[i] - '0');
+        }
+        reply.reader = reader;
+        line.remove_prefix(space + 1);
+    }
+
+    if (line.substr(0, 3) == "OK ")
+    {
+        reply.ok = true;
+        reply.body = line.substr(3);
+        return true;
+    }
+    if (line.substr(0, 4) != "ERR ")
+    {
+        return false;
+    }
+
+    line.remove_prefix(4);
+    size_t dash = line.find(" - ");
+    reply.code = line.substr(0, dash);
+    if (dash == std::string_view::npos)
+    {
+        return true;
+    }
+
+    // Descriptions may have parentheses of their own ("192 (1K) or 480 (4K)"), the context is
+    // the echoed command if there is one and the last parenthesis otherwise
+    std::string_view rest = line.substr(dash + 3);
+    size_t open = rest.find(" (Command: '");
+    if (open == std::string_view::npos)
+    {
+        open = rest.rfind(" (");
+    }
+    if (open != std::string_view::npos && rest.back() == ')')
+    {
+        reply.description = rest.substr(0, open);
+        reply.context = rest.substr(open + 2, rest.size() - open - 3);
+    }
+    else
+    {
+        reply.description = rest;
+    }
+    return true;
+}
+
+std::string_view Reply::word(int index) const
+{
+    std::string_view rest = body;
+    for (int i = 0; i < index; i++)
+    {
+        size_t space = rest.find(' ');
+        if (space == std::string_view::npos)
+        {
+            return std::string_view();
+        }
+        rest.remove_prefix(space + 1);
+    }
+    return rest.substr(0, rest.find(' '));
+}
+
+
+bool Reply::rejection() const
+{
+    if (ok || context.substr(0, 10) != "Command: '")
+    {
+        return false;
+    }
+    for (const char *rejected : REJECTION_CODES)
+    {
+        if (code == rejected)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Reply::immediate() const
+{
+    std::string_view name = word(0);
+    return ok && (name == "VERSION" || name == "HELP" || name == "STATS" || name == "TRACE" ||
+                  name == "TRACE_DUMP" || name == "CAPTURE");
+}
+
+bool Reply::echoes(std::string_view line) const
+{
+    if (context.substr(0, 10) != "Command: '")
+    {
+        return false;
+    }
+    std::string_view echoed = context.substr(10);
+    if (echoed.size() >= 4 && echoed.substr(echoed.size() - 4) == "...'")
+    {
+        // Lines too long for the firmware are echoed by their start only
+        std::string_view head = echoed.substr(0, echoed.size() - 4);
+        return line.size() > head.size() && line.substr(0, head.size()) == head;
+    }
+    return echoed.substr(0, line.size()) == line && echoed.substr(line.size(), 1) == "'";
+}
+
+bool Reply::immediateCommand(std::string_view command)
+{
+    std::string_view name = command.substr(0, command.find(' '));
+    for (const char *immediateName : IMMEDIATE_COMMANDS)
+    {
+        if (equalsIgnoreCase(name, immediateName))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace rfid
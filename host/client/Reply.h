@@ -0,0 +1,40 @@
+#pragma once
+#include <string_view>
+
+namespace rfid
+{
+
+// One reply line split in place. The views point into the line, they are only valid
+// as long as the buffer it was read into.
+//   [@<reader> ]OK <body>
+//   [@<reader> ]ERR <code> - <description>[ (<context>)]
+struct Reply
+{
+    int reader = -1; // -1 without an @n prefix
+    bool ok = false;
+    std::string_view body; // Everything after "OK "
+    std::string_view code;
+    std::string_view description;
+    std::string_view context;
+
+    // False if the line is not an OK/ERR reply (CR/LF already stripped)
+    static bool parse(std::string_view line, Reply &reply);
+
+    // Word of an OK body, counted from 0: "DATA" and "0102..." for "DATA 0102..."
+    std::string_view word(int index) const;
+
+    // An error the firmware's main loop sent before the command reached a reader queue.
+    // These are matched to their command by the echoed line, see echoes().
+    bool rejection() const;
+    // An OK reply the main loop sends itself, ahead of the reader queues
+    bool immediate() const;
+    // True if the error context echoes this command line: "Command: '<line>'", or its start
+    // for a line the firmware dropped as too long: "Command: '<start>...'"
+    bool echoes(std::string_view line) const;
+
+    // True for commands answered by the main loop (VERSION, HELP, STATS, TRACE, CAPTURE),
+    // given the command without its @n prefix
+    static bool immediateCommand(std::string_view command);
+};
+
+} // namespace rfid
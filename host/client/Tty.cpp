@@ -0,0 +1,47 @@
+#include "Tty.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace rfid
+{
+
+int openTty(const std::string &device, std::string &error)
+{
+    int fd = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0)
+    {
+        error = device + ": " + strerror(errno);
+        return -1;
+    }
+
+    termios options;
+    if (tcgetattr(fd, &options) != 0)
+    {
+        error = device + ": not a terminal";
+        ::close(fd);
+        return -1;
+    }
+
+    cfmakeraw(&options);
+    cfsetispeed(&options, B115200);
+    cfsetospeed(&options, B115200);
+    options.c_cflag |= CLOCAL | CREAD;
+    options.c_cflag &= ~(CSTOPB | CRTSCTS);
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSANOW, &options) != 0)
+    {
+        error = device + ": " + strerror(errno);
+        ::close(fd);
+        return -1;
+    }
+
+    // Drop whatever the reader sent before we were listening
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+} // namespace rfid
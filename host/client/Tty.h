@@ -0,0 +1,11 @@
+#pragma once
+#include <string>
+
+namespace rfid
+{
+
+// Opens a serial device (or pty) in raw mode at 115200 8N1 without flow control, as the
+// reader expects. Returns the file descriptor, or -1 with error filled in.
+int openTty(const std::string &device, std::string &error);
+
+} // namespace rfid
@@ -0,0 +1,114 @@
+// Command line front end of the client library.
+//
+//   rfid_cli DEVICE [@N] version|scan|read KEY|digest KEY|verify KEY DIGEST|write KEY DATA|enroll KEY
+//
+// verify exits with 1 on a mismatch, like a failed command.
+#include "ReaderClient.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace rfid;
+
+static int fail(const Error &error)
+{
+    fprintf(stderr, "%s: %s%s%s%s\n", error.code.c_str(), error.description.c_str(),
+            error.context.empty() ? "" : " (", error.context.c_str(), error.context.empty() ? "" : ")");
+    return 1;
+}
+
+static bool parseHex(const char *text, Bytes &bytes)
+{
+    if (!Hex::decode(text, bytes))
+    {
+        fprintf(stderr, "not a hex string: %.40s\n", text);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: rfid_cli DEVICE [@N] version|scan|read KEY|digest KEY|verify KEY DIGEST|write KEY DATA|enroll KEY\n");
+        return 2;
+    }
+
+    int arg = 2;
+    int reader = 0;
+    if (argv[arg][0] == '@')
+    {
+        reader = atoi(argv[arg] + 1);
+        arg++;
+    }
+    if (arg >= argc)
+    {
+        return 2;
+    }
+    std::string command = argv[arg++];
+
+    ReaderClient client;
+    std::string error;
+    if (!client.open(argv[1], error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    Bytes key;
+    Bytes data;
+    if (command == "version")
+    {
+        printf("%s%s\n", client.firmwareVersion().c_str(), client.pipelined() ? " (pipelined)" : "");
+        return 0;
+    }
+    else if (command == "scan")
+    {
+        Result<Bytes> uid = client.scanUid(reader).get();
+        if (!uid.ok)
+            return fail(uid.error);
+        printf("%s\n", Hex::encode(uid.value).c_str());
+    }
+    else if (command == "read" && arg < argc && parseHex(argv[arg], key))
+    {
+        Result<Bytes> payload = client.read(key, reader).get();
+        if (!payload.ok)
+            return fail(payload.error);
+        printf("%s\n", Hex::encode(payload.value).c_str());
+    }
+    else if (command == "digest" && arg < argc && parseHex(argv[arg], key))
+    {
+        Result<Bytes> digest = client.digest(key, reader).get();
+        if (!digest.ok)
+            return fail(digest.error);
+        printf("%s\n", Hex::encode(digest.value).c_str());
+    }
+    else if (command == "verify" && arg + 1 < argc && parseHex(argv[arg], key) && parseHex(argv[arg + 1], data))
+    {
+        Result<bool> match = client.verify(key, data, reader).get();
+        if (!match.ok)
+            return fail(match.error);
+        printf("%s\n", match.value ? "match" : "mismatch");
+        return match.value ? 0 : 1;
+    }
+    else if (command == "write" && arg + 1 < argc && parseHex(argv[arg], key) && parseHex(argv[arg + 1], data))
+    {
+        Result<Done> written = client.write(key, data, reader).get();
+        if (!written.ok)
+            return fail(written.error);
+        printf("written\n");
+    }
+    else if (command == "enroll" && arg < argc && parseHex(argv[arg], key))
+    {
+        Result<EnrollInfo> enrolled = client.enroll(key, reader).get();
+        if (!enrolled.ok)
+            return fail(enrolled.error);
+        printf("enrolled %llx skipped %llx\n", (unsigned long long)enrolled.value.enrolled, (unsigned long long)enrolled.value.skipped);
+    }
+    else
+    {
+        fprintf(stderr, "unknown command or missing arguments: %s\n", command.c_str());
+        return 2;
+    }
+    return 0;
+}
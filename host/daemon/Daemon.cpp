@@ -0,0 +1,882 @@
+#include "Daemon.h"
+#include "Tty.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace rfid
+{
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+// Commands the firmware queues per reader (READER_QUEUE_DEPTH)
+const size_t FIRMWARE_QUEUE_DEPTH = 4;
+const int PROBE_INTERVAL_MS = 500;
+const int PROBE_TIMEOUT_MS = 5000;
+const int SETTLE_MS = 100;
+const int REOPEN_DELAY_MS = 2000;
+// Line length and unread output a client may build up before it is dropped
+const size_t MAX_CLIENT_INPUT = 64 * 1024;
+const size_t MAX_CLIENT_OUTPUT = 1024 * 1024;
+
+bool equalsIgnoreCase(std::string_view text, const char *upper)
+{
+    size_t i = 0;
+    for (; i < text.size() && upper[i]; i++)
+    {
+        if (toupper((unsigned char)text[i]) != upper[i])
+        {
+            return false;
+        }
+    }
+    return i == text.size() && !upper[i];
+}
+
+std::string_view trim(std::string_view text)
+{
+    while (!text.empty() && isspace((unsigned char)text.front()))
+    {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && isspace((unsigned char)text.back()))
+    {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+const char *const STATE_NAMES[] = {"CLOSED", "PROBING", "SETTLING", "READY"};
+
+} // namespace
+
+Daemon::Daemon()
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    listenFd = -1;
+    wakePipe[0] = wakePipe[1] = -1;
+    if (pipe2(wakePipe, O_CLOEXEC | O_NONBLOCK) == 0)
+    {
+        watch(wakePipe[0], EPOLLIN, EPOLL_CTL_ADD);
+    }
+    timeoutMs = 10000;
+    running = false;
+    nextClientId = 1;
+}
+
+Daemon::~Daemon()
+{
+    for (auto &entry : clients)
+    {
+        ::close(entry.second.fd);
+    }
+    for (auto &device : devices)
+    {
+        if (device->fd >= 0)
+        {
+            ::close(device->fd);
+        }
+        if (device->capture)
+        {
+            fclose(device->capture);
+        }
+    }
+    if (listenFd >= 0)
+    {
+        ::close(listenFd);
+        unlink(socketPath.c_str());
+    }
+    for (int end : wakePipe)
+    {
+        if (end >= 0)
+        {
+            ::close(end);
+        }
+    }
+    ::close(epollFd);
+}
+
+bool Daemon::addDevice(const std::string &name, const std::string &path, std::string &error)
+{
+    if (name.empty() || name.find_first_of(" \t@") != std::string::npos || equalsIgnoreCase(name, "LIST") ||
+        equalsIgnoreCase(name, "STATS"))
+    {
+        error = "invalid device name '" + name + "'";
+        return false;
+    }
+    if (findDevice(name))
+    {
+        error = "duplicate device name '" + name + "'";
+        return false;
+    }
+
+    std::unique_ptr<Device> device(new Device());
+    device->name = name;
+    device->path = path;
+    deviceByName[name] = device.get();
+    devices.push_back(std::move(device));
+    return true;
+}
+
+bool Daemon::listen(const std::string &path, std::string &error)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        error = "socket path too long";
+        return false;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    // A socket left behind by a previous run would make bind fail
+    struct stat existing;
+    if (stat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+    {
+        unlink(path.c_str());
+    }
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || bind(listenFd, (sockaddr *)&address, sizeof(address)) != 0 || ::listen(listenFd, 64) != 0)
+    {
+        error = path + ": " + strerror(errno);
+        if (listenFd >= 0)
+        {
+            ::close(listenFd);
+            listenFd = -1;
+        }
+        return false;
+    }
+    socketPath = path;
+    watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+    return true;
+}
+
+void Daemon::stop()
+{
+    // Only a flag and a pipe write, safe from a signal handler
+    running = false;
+    char wake = 0;
+    (void)!::write(wakePipe[1], &wake, 1);
+}
+
+void Daemon::run()
+{
+    running = true;
+    for (auto &device : devices)
+    {
+        openDevice(*device);
+    }
+
+    epoll_event events[256];
+    while (running)
+    {
+        int count = epoll_wait(epollFd, events, 256, nextTimerMs());
+        for (int i = 0; i < count && running; i++)
+        {
+            int fd = events[i].data.fd;
+            uint32_t ready = events[i].events;
+
+            if (fd == wakePipe[0])
+            {
+                char drain[64];
+                while (::read(wakePipe[0], drain, sizeof(drain)) > 0)
+                {
+                }
+            }
+            else if (fd == listenFd)
+            {
+                accept();
+            }
+            else if (deviceByFd.count(fd))
+            {
+                Device &device = *deviceByFd[fd];
+                if (ready & EPOLLOUT)
+                {
+                    flushDevice(device);
+                }
+                if (ready & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                {
+                    deviceReadable(device, (ready & (EPOLLHUP | EPOLLERR)) != 0);
+                }
+            }
+            else if (clientByFd.count(fd))
+            {
+                Client &client = clients[clientByFd[fd]];
+                if (ready & EPOLLOUT)
+                {
+                    flushClient(client);
+                }
+                if (ready & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                {
+                    clientReadable(client);
+                }
+            }
+        }
+        fireTimers();
+    }
+}
+
+void Daemon::watch(int fd, uint32_t events, int operation)
+{
+    epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(epollFd, operation, fd, &event);
+}
+
+void Daemon::schedule(Clock::time_point at, std::function<void()> fire)
+{
+    timers.push(Timer{at, std::move(fire)});
+}
+
+int Daemon::nextTimerMs()
+{
+    if (timers.empty())
+    {
+        return -1;
+    }
+    auto now = Clock::now();
+    if (timers.top().at <= now)
+    {
+        return 0;
+    }
+    return (int)std::chrono::duration_cast<std::chrono::milliseconds>(timers.top().at - now).count() + 1;
+}
+
+void Daemon::fireTimers()
+{
+    auto now = Clock::now();
+    while (!timers.empty() && timers.top().at <= now)
+    {
+        // Popped before running, the timer may schedule others
+        std::function<void()> fire = std::move(const_cast<Timer &>(timers.top()).fire);
+        timers.pop();
+        fire();
+    }
+}
+
+Daemon::Device *Daemon::findDevice(std::string_view name)
+{
+    auto found = deviceByName.find(name);
+    return found == deviceByName.end() ? nullptr : found->second;
+}
+
+// Devices
+
+void Daemon::openDevice(Device &device)
+{
+    std::string error;
+    device.fd = openTty(device.path, error);
+    device.generation++;
+    if (device.fd < 0)
+    {
+        // Logged once, a board that stays unplugged would fill the log otherwise
+        if (error != device.lastError)
+        {
+            fprintf(stderr, "rfidd: %s: %s, retrying\n", device.name.c_str(), error.c_str());
+            device.lastError = error;
+        }
+        uint32_t generation = device.generation;
+        schedule(Clock::now() + std::chrono::milliseconds(REOPEN_DELAY_MS), [this, &device, generation]() {
+            if (device.generation == generation)
+            {
+                openDevice(device);
+            }
+        });
+        return;
+    }
+
+    deviceByFd[device.fd] = &device;
+    watch(device.fd, EPOLLIN, EPOLL_CTL_ADD);
+    device.state = DeviceState::PROBING;
+    device.probeDeadline = Clock::now() + std::chrono::milliseconds(PROBE_TIMEOUT_MS);
+    probe(device, device.generation);
+}
+
+void Daemon::probe(Device &device, uint32_t generation)
+{
+    if (device.generation != generation || device.state != DeviceState::PROBING)
+    {
+        return;
+    }
+    if (Clock::now() >= device.probeDeadline)
+    {
+        closeDevice(device, "No reply to VERSION");
+        return;
+    }
+
+    // Same handshake as the client library: repeated while the board boots, and
+    // "@0 VERSION" tells firmware with reader prefixes from older firmware
+    writeDevice(device, "@0 VERSION");
+    schedule(Clock::now() + std::chrono::milliseconds(PROBE_INTERVAL_MS), [this, &device, generation]() { probe(device, generation); });
+}
+
+void Daemon::closeDevice(Device &device, const char *reason)
+{
+    if (reason != device.lastError)
+    {
+        fprintf(stderr, "rfidd: %s: %s, reopening\n", device.name.c_str(), reason);
+        device.lastError = reason;
+    }
+
+    if (device.fd >= 0)
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, device.fd, nullptr);
+        deviceByFd.erase(device.fd);
+        ::close(device.fd);
+        device.fd = -1;
+    }
+    device.state = DeviceState::CLOSED;
+    device.input.clear();
+    device.output.clear();
+    device.writing = false;
+
+    for (auto &entry : device.readers)
+    {
+        ReaderQueue &queue = entry.second;
+        for (std::deque<RequestPtr> *requests : {&queue.immediate, &queue.queued, &queue.waiting})
+        {
+            for (RequestPtr &request : *requests)
+            {
+                request->consumed = true;
+                if (!request->done)
+                {
+                    fail(device, request, "CLOSED", reason);
+                }
+            }
+            requests->clear();
+        }
+    }
+
+    uint32_t generation = ++device.generation;
+    schedule(Clock::now() + std::chrono::milliseconds(REOPEN_DELAY_MS), [this, &device, generation]() {
+        if (device.generation == generation)
+        {
+            openDevice(device);
+        }
+    });
+}
+
+void Daemon::writeDevice(Device &device, const std::string &line)
+{
+    device.output += line;
+    device.output += '\n';
+    flushDevice(device);
+}
+
+void Daemon::flushDevice(Device &device)
+{
+    while (!device.output.empty())
+    {
+        ssize_t written = ::write(device.fd, device.output.data(), device.output.size());
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN)
+            {
+                // Closed from the loop rather than from deep inside a send
+                uint32_t generation = device.generation;
+                schedule(Clock::now(), [this, &device, generation]() {
+                    if (device.generation == generation)
+                    {
+                        closeDevice(device, "Write to the device failed");
+                    }
+                });
+                device.output.clear();
+            }
+            break;
+        }
+        device.output.erase(0, written);
+    }
+
+    bool pending = !device.output.empty();
+    if (pending != device.writing)
+    {
+        device.writing = pending;
+        watch(device.fd, pending ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+    }
+}
+
+void Daemon::deviceReadable(Device &device, bool hangup)
+{
+    char chunk[4096];
+    ssize_t count;
+    while ((count = ::read(device.fd, chunk, sizeof(chunk))) > 0)
+    {
+        device.input.append(chunk, count);
+    }
+    // The tty is raw with VMIN 0, so a read of 0 only means no data; hangups come from epoll
+    if (hangup || (count < 0 && errno != EAGAIN && errno != EINTR))
+    {
+        closeDevice(device, hangup ? "Device hung up" : strerror(errno));
+        return;
+    }
+
+    // Lines are handled in place, the buffer is only compacted once all of them are done
+    size_t start = 0;
+    size_t end;
+    while (device.fd >= 0 && (end = device.input.find('\n', start)) != std::string::npos)
+    {
+        std::string_view line(device.input.data() + start, end - start);
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        start = end + 1;
+        deviceLine(device, line);
+    }
+    if (device.fd >= 0)
+    {
+        device.input.erase(0, start);
+    }
+}
+
+void Daemon::writeCapture(Device &device, std::string_view line)
+{
+    if (!device.capture)
+    {
+        std::string path = captureDir + "/" + device.name + ".capture";
+        device.capture = fopen(path.c_str(), "a");
+        if (!device.capture)
+        {
+            // Retried with the next line, logged once like other device errors
+            std::string error = path + ": " + strerror(errno);
+            if (error != device.lastError)
+            {
+                fprintf(stderr, "rfidd: %s: %s\n", device.name.c_str(), error.c_str());
+                device.lastError = error;
+            }
+            return;
+        }
+    }
+    fwrite(line.data(), 1, line.size(), device.capture);
+    fputc('\n', device.capture);
+    // Whole commands reach the file, a capture cut short by a crash still replays
+    if (line.find(" END ") != std::string_view::npos)
+    {
+        fflush(device.capture);
+    }
+}
+
+void Daemon::deviceLine(Device &device, std::string_view line)
+{
+    if (!captureDir.empty() && line.substr(0, 9) == "CAPTURE @")
+    {
+        writeCapture(device, line);
+        return;
+    }
+
+    Reply parsed;
+    if (!Reply::parse(line, parsed))
+    {
+        return;
+    }
+
+    if (device.state == DeviceState::PROBING)
+    {
+        device.pipelining = parsed.ok && parsed.reader == 0 && parsed.word(0) == "VERSION";
+        device.version = device.pipelining ? std::string(parsed.word(1)) : std::string();
+        device.state = DeviceState::SETTLING;
+
+        // Answers to repeated probes may still be on their way, they are dropped with the input
+        uint32_t generation = ++device.generation;
+        schedule(Clock::now() + std::chrono::milliseconds(SETTLE_MS), [this, &device, generation]() {
+            if (device.generation != generation)
+            {
+                return;
+            }
+            tcflush(device.fd, TCIFLUSH);
+            device.input.clear();
+            device.state = DeviceState::READY;
+            device.generation++;
+            device.lastError.clear();
+            fprintf(stderr, "rfidd: %s: ready, firmware %s\n", device.name.c_str(),
+                    device.pipelining ? device.version.c_str() : "without reader prefixes");
+            for (auto &entry : device.readers)
+            {
+                pump(device, entry.second);
+            }
+        });
+        return;
+    }
+    if (device.state != DeviceState::READY)
+    {
+        return;
+    }
+
+    int reader = device.pipelining && parsed.reader >= 0 ? parsed.reader : 0;
+    auto found = device.readers.find(reader);
+    if (found == device.readers.end())
+    {
+        return;
+    }
+
+    RequestPtr request = match(device, found->second, parsed);
+    if (request && !request->done)
+    {
+        // Without the firmware's own prefix, complete() adds the reader for every device
+        std::string_view text = line;
+        if (parsed.reader >= 0)
+        {
+            text.remove_prefix(text.find(' ') + 1);
+        }
+        complete(device, request, text, parsed.ok);
+    }
+    pump(device, found->second);
+}
+
+Daemon::RequestPtr Daemon::match(Device &device, ReaderQueue &queue, const Reply &reply)
+{
+    RequestPtr request;
+    if (device.pipelining && reply.immediate() && !queue.immediate.empty())
+    {
+        request = queue.immediate.front();
+        queue.immediate.pop_front();
+    }
+    else if (reply.rejection())
+    {
+        // Rejected before reaching the reader, find the command by its echoed line
+        for (std::deque<RequestPtr> *sent : {&queue.immediate, &queue.queued})
+        {
+            for (auto it = sent->begin(); it != sent->end() && !request; ++it)
+            {
+                if (reply.echoes((*it)->line))
+                {
+                    request = *it;
+                    sent->erase(it);
+                    break;
+                }
+            }
+        }
+    }
+    else if (!(device.pipelining && reply.immediate()) && !queue.queued.empty())
+    {
+        request = queue.queued.front();
+        queue.queued.pop_front();
+    }
+
+    if (request)
+    {
+        request->consumed = true;
+    }
+    return request;
+}
+
+void Daemon::send(Device &device, const RequestPtr &request)
+{
+    request->line = device.pipelining ? "@" + std::to_string(request->reader) + " " + request->command : request->command;
+    writeDevice(device, request->line);
+
+    // A timed out request keeps its place until its late reply comes. If that never comes
+    // either, the board is wedged and gets reopened.
+    uint32_t generation = device.generation;
+    schedule(Clock::now() + std::chrono::milliseconds(timeoutMs), [this, &device, request, generation]() {
+        if (request->done)
+        {
+            return;
+        }
+        fail(device, request, "TIMEOUT", "No reply from the reader in time");
+        device.readers[request->reader].stats.recordTimeout();
+        schedule(Clock::now() + std::chrono::milliseconds(timeoutMs), [this, &device, request, generation]() {
+            if (!request->consumed && device.generation == generation)
+            {
+                closeDevice(device, "Reader stopped replying");
+            }
+        });
+    });
+}
+
+void Daemon::pump(Device &device, ReaderQueue &queue)
+{
+    if (device.state != DeviceState::READY)
+    {
+        return;
+    }
+
+    // Firmware without reader prefixes handles one command at a time
+    size_t depth = device.pipelining ? FIRMWARE_QUEUE_DEPTH : 1;
+    while (!queue.waiting.empty())
+    {
+        RequestPtr request = queue.waiting.front();
+        if (!device.pipelining && request->reader != 0)
+        {
+            queue.waiting.pop_front();
+            request->consumed = true;
+            fail(device, request, "INVALID_READER", "Firmware without reader prefixes only drives reader 0");
+        }
+        else if (device.pipelining && request->immediate)
+        {
+            queue.waiting.pop_front();
+            queue.immediate.push_back(request);
+            send(device, request);
+        }
+        else if (queue.queued.size() < depth)
+        {
+            queue.waiting.pop_front();
+            queue.queued.push_back(request);
+            send(device, request);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+void Daemon::complete(Device &device, const RequestPtr &request, std::string_view text, bool ok)
+{
+    request->done = true;
+    uint64_t latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - request->queuedAt).count();
+    device.readers[request->reader].stats.record(ok, latencyUs);
+
+    std::string line = device.name + " @" + std::to_string(request->reader) + " ";
+    line.append(text.data(), text.size());
+    reply(request->client, line);
+}
+
+void Daemon::fail(Device &device, const RequestPtr &request, const char *code, const char *description)
+{
+    // Shaped like firmware errors, so clients parse both the same way
+    request->done = true;
+    reply(request->client, device.name + " @" + std::to_string(request->reader) + " ERR " + code + " - " + description +
+                               " (Command: '" + request->command + "')");
+}
+
+// Clients
+
+void Daemon::accept()
+{
+    int fd;
+    while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        uint64_t id = nextClientId++;
+        Client &client = clients[id];
+        client.fd = fd;
+        client.id = id;
+        clientByFd[fd] = id;
+        watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+    }
+}
+
+void Daemon::clientReadable(Client &client)
+{
+    char chunk[4096];
+    ssize_t count;
+    while ((count = ::read(client.fd, chunk, sizeof(chunk))) > 0)
+    {
+        client.input.append(chunk, count);
+    }
+    bool closed = count == 0 || (errno != EAGAIN && errno != EINTR);
+
+    size_t start = 0;
+    size_t end;
+    while ((end = client.input.find('\n', start)) != std::string::npos)
+    {
+        std::string_view line(client.input.data() + start, end - start);
+        start = end + 1;
+        clientLine(client, line);
+    }
+    client.input.erase(0, start);
+
+    // Replies already queued for the client are lost with it, its requests still run
+    if (closed || client.input.size() > MAX_CLIENT_INPUT)
+    {
+        dropClient(client);
+    }
+}
+
+void Daemon::clientLine(Client &client, std::string_view line)
+{
+    line = trim(line);
+    if (line.empty())
+    {
+        return;
+    }
+
+    size_t space = line.find(' ');
+    std::string_view name = line.substr(0, space);
+    std::string_view rest = space == std::string_view::npos ? std::string_view() : trim(line.substr(space + 1));
+
+    if (equalsIgnoreCase(name, "LIST"))
+    {
+        list(client);
+        return;
+    }
+    if (equalsIgnoreCase(name, "STATS"))
+    {
+        stats(client, equalsIgnoreCase(rest, "RESET"));
+        return;
+    }
+
+    Device *device = findDevice(name);
+    if (!device)
+    {
+        reply(client.id, std::string(name) + " ERR UNKNOWN_DEVICE - No device with that name (Command: '" + std::string(line) + "')");
+        return;
+    }
+
+    // Optional reader prefix, the rest goes to the firmware as it is
+    int reader = 0;
+    if (!rest.empty() && rest[0] == '@')
+    {
+        size_t digits = 1;
+        reader = 0;
+        while (digits < rest.size() && digits < 4 && isdigit((unsigned char)rest[digits]))
+        {
+            reader = reader * 10 + (rest[digits] - '0');
+            digits++;
+        }
+        if (digits == 1 || (digits < rest.size() && rest[digits] != ' '))
+        {
+            reply(client.id, device->name + " ERR INVALID_READER - Reader prefix must be @ followed by a number (Command: '" +
+                                 std::string(line) + "')");
+            return;
+        }
+        rest = trim(rest.substr(digits));
+    }
+
+    RequestPtr request = std::make_shared<Request>();
+    request->client = client.id;
+    request->reader = reader;
+    request->command.reserve(rest.size());
+    for (char c : rest)
+    {
+        request->command += (char)toupper((unsigned char)c);
+    }
+    request->immediate = Reply::immediateCommand(request->command);
+    request->queuedAt = Clock::now();
+
+    if (request->command.empty())
+    {
+        fail(*device, request, "MISSING_ARGS", "No command for the device");
+        return;
+    }
+
+    // An armed reader sends tag events on its own, they would be matched to other commands
+    std::string_view verb = request->command;
+    if (!verb.empty() && verb[0] == '#')
+    {
+        verb = trim(verb.substr(std::min(verb.find(' '), verb.size())));
+    }
+    verb = verb.substr(0, verb.find(' '));
+    if (verb == "ARM" || verb == "DISARM")
+    {
+        fail(*device, request, "UNSUPPORTED", "ARM and DISARM are not available through the daemon");
+        return;
+    }
+    if (device->state == DeviceState::CLOSED)
+    {
+        fail(*device, request, "CLOSED", "Device is not connected");
+        return;
+    }
+
+    ReaderQueue &queue = device->readers[reader];
+    if (queue.waiting.size() >= MAX_WAITING)
+    {
+        fail(*device, request, "BUSY", "Too many commands waiting for this reader");
+        return;
+    }
+    queue.waiting.push_back(request);
+    pump(*device, queue);
+}
+
+void Daemon::reply(uint64_t clientId, const std::string &line)
+{
+    auto found = clients.find(clientId);
+    if (found == clients.end())
+    {
+        return;
+    }
+    Client &client = found->second;
+    client.output += line;
+    client.output += '\n';
+    flushClient(client);
+}
+
+void Daemon::flushClient(Client &client)
+{
+    while (!client.output.empty())
+    {
+        ssize_t written = ::send(client.fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN)
+            {
+                client.output.clear();
+            }
+            break;
+        }
+        client.output.erase(0, written);
+    }
+
+    if (client.output.size() > MAX_CLIENT_OUTPUT)
+    {
+        // Not reading its replies, dropped from the loop like a failed device
+        client.output.clear();
+        shutdown(client.fd, SHUT_RDWR);
+    }
+
+    bool pending = !client.output.empty();
+    if (pending != client.writing)
+    {
+        client.writing = pending;
+        watch(client.fd, pending ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+    }
+}
+
+void Daemon::dropClient(Client &client)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, client.fd, nullptr);
+    ::close(client.fd);
+    clientByFd.erase(client.fd);
+    clients.erase(client.id);
+}
+
+void Daemon::list(Client &client)
+{
+    for (auto &device : devices)
+    {
+        reply(client.id, "OK DEVICE " + device->name + " " + device->path + " " + STATE_NAMES[(int)device->state] + " VERSION " +
+                             (device->version.empty() ? "-" : device->version) + " PIPELINED " +
+                             (device->pipelining ? "YES" : "NO"));
+    }
+    reply(client.id, "OK LIST COUNT " + std::to_string(devices.size()));
+}
+
+void Daemon::stats(Client &client, bool reset)
+{
+    size_t count = 0;
+    for (auto &device : devices)
+    {
+        for (auto &entry : device->readers)
+        {
+            ReaderQueue &queue = entry.second;
+            reply(client.id, "OK STATS " + device->name + " @" + std::to_string(entry.first) + " " + queue.stats.report() +
+                                 " QUEUED " + std::to_string(queue.waiting.size() + queue.queued.size()));
+            if (reset)
+            {
+                queue.stats.reset();
+            }
+            count++;
+        }
+    }
+    reply(client.id, "OK STATS COUNT " + std::to_string(count));
+}
+
+} // namespace rfid
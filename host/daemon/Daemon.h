@@ -0,0 +1,159 @@
+#pragma once
+#include "ReaderStats.h"
+#include "Reply.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rfid
+{
+
+// Drives many reader boards from one thread: every tty and client socket is non-blocking
+// and served from a single epoll loop, timeouts come from one timer heap.
+//
+// Applications connect to a Unix socket and send firmware command lines addressed to a
+// device, "<device> [@n ]<command>". The reply comes back as "<device> @n <reply>" once the
+// reader answers. Requests from all clients share each reader's firmware queue, so nobody
+// contends for the tty. The daemon answers LIST and STATS [RESET] itself.
+class Daemon
+{
+public:
+    // Commands kept waiting per reader before new ones get BUSY
+    static const size_t MAX_WAITING = 64;
+
+    Daemon();
+    ~Daemon();
+    Daemon(const Daemon &) = delete;
+    Daemon &operator=(const Daemon &) = delete;
+
+    // The device is opened (and reopened after errors) once run() starts
+    bool addDevice(const std::string &name, const std::string &path, std::string &error);
+    bool listen(const std::string &socketPath, std::string &error);
+    void setTimeout(int ms) { timeoutMs = ms; }
+    // CAPTURE lines from each device are appended to <dir>/<device>.capture, for rfid_replay
+    void setCaptureDir(const std::string &dir) { captureDir = dir; }
+
+    // Serves until stop() is called, from a signal handler as well
+    void run();
+    void stop();
+
+private:
+    enum class DeviceState
+    {
+        CLOSED,   // Waiting to reopen
+        PROBING,  // VERSION sent, waiting for the first reply
+        SETTLING, // Answered, dropping replies to repeated probes
+        READY
+    };
+
+    struct Request
+    {
+        uint64_t client; // May have disconnected since, the reply is dropped then
+        int reader;
+        std::string command; // Without the @n prefix, upper case like the firmware echoes it
+        std::string line;    // As written to the tty, set when sent
+        bool immediate;      // Answered by the firmware's main loop, ahead of the reader queue
+        bool done = false; // Answered or timed out; a timed out request still waits for its reply
+        bool consumed = false; // Its reply arrived, or it was dropped with the device
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+    typedef std::shared_ptr<Request> RequestPtr;
+
+    struct ReaderQueue
+    {
+        std::deque<RequestPtr> waiting;   // Not sent yet, the firmware queue is full
+        std::deque<RequestPtr> queued;    // Sent, answered in order by the reader
+        std::deque<RequestPtr> immediate; // Sent, answered in order by the main loop
+        ReaderStats stats;
+    };
+
+    struct Device
+    {
+        std::string name;
+        std::string path;
+        int fd = -1;
+        DeviceState state = DeviceState::CLOSED;
+        uint32_t generation = 0; // Bumped on every state change, stale timers check it
+        bool pipelining = false;
+        std::string version;
+        std::string input;
+        std::string output;
+        bool writing = false; // Waiting for EPOLLOUT to write the rest of output
+        std::chrono::steady_clock::time_point probeDeadline;
+        std::string lastError; // Last problem logged, repeats are not
+        FILE *capture = nullptr; // Opened with the first CAPTURE line
+        std::map<int, ReaderQueue> readers;
+    };
+
+    struct Client
+    {
+        int fd;
+        uint64_t id;
+        std::string input;
+        std::string output;
+        bool writing = false;
+    };
+
+    struct Timer
+    {
+        std::chrono::steady_clock::time_point at;
+        std::function<void()> fire;
+        bool operator>(const Timer &other) const { return at > other.at; }
+    };
+
+    int epollFd;
+    int listenFd;
+    int wakePipe[2];
+    std::string socketPath;
+    int timeoutMs;
+    std::string captureDir;
+    volatile bool running;
+    uint64_t nextClientId;
+
+    std::vector<std::unique_ptr<Device>> devices;
+    std::map<std::string, Device *, std::less<>> deviceByName;
+    std::unordered_map<int, Device *> deviceByFd;
+    std::unordered_map<uint64_t, Client> clients;
+    std::unordered_map<int, uint64_t> clientByFd;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+
+    void schedule(std::chrono::steady_clock::time_point at, std::function<void()> fire);
+    int nextTimerMs();
+    void fireTimers();
+    void watch(int fd, uint32_t events, int operation);
+
+    void openDevice(Device &device);
+    void closeDevice(Device &device, const char *reason);
+    void probe(Device &device, uint32_t generation);
+    void deviceReadable(Device &device, bool hangup);
+    void deviceLine(Device &device, std::string_view line);
+    void writeCapture(Device &device, std::string_view line);
+    void writeDevice(Device &device, const std::string &line);
+    void flushDevice(Device &device);
+    void send(Device &device, const RequestPtr &request);
+    void pump(Device &device, ReaderQueue &queue);
+    RequestPtr match(Device &device, ReaderQueue &queue, const Reply &reply);
+
+    void accept();
+    void clientReadable(Client &client);
+    void clientLine(Client &client, std::string_view line);
+    void reply(uint64_t clientId, const std::string &line);
+    void flushClient(Client &client);
+    void dropClient(Client &client);
+    void complete(Device &device, const RequestPtr &request, std::string_view reply, bool ok);
+    void fail(Device &device, const RequestPtr &request, const char *code, const char *description);
+
+    void list(Client &client);
+    void stats(Client &client, bool reset);
+    Device *findDevice(std::string_view name);
+};
+
+} // namespace rfid
@@ -0,0 +1,94 @@
+#include "ReaderStats.h"
+#include <cstdio>
+#include <cstring>
+
+namespace rfid
+{
+
+void ReaderStats::reset()
+{
+    ops = 0;
+    errors = 0;
+    timeouts = 0;
+    totalUs = 0;
+    maxUs = 0;
+    memset(buckets, 0, sizeof(buckets));
+    since = std::chrono::steady_clock::now();
+}
+
+int ReaderStats::bucketOf(uint64_t us)
+{
+    if (us < SUB_BUCKETS)
+    {
+        return (int)us;
+    }
+    // Octave from the top bit, sub-bucket from the two bits below it
+    int octave = 63 - __builtin_clzll(us);
+    int sub = (int)((us >> (octave - 2)) & (SUB_BUCKETS - 1));
+    int bucket = (octave - 1) * SUB_BUCKETS + sub;
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+double ReaderStats::bucketUpperUs(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+    {
+        return bucket + 1;
+    }
+    int octave = bucket / SUB_BUCKETS + 1;
+    int sub = bucket % SUB_BUCKETS;
+    return (double)(1ULL << octave) * (1.0 + (sub + 1) / (double)SUB_BUCKETS);
+}
+
+void ReaderStats::record(bool ok, uint64_t latencyUs)
+{
+    ops++;
+    if (!ok)
+    {
+        errors++;
+    }
+    totalUs += latencyUs;
+    if (latencyUs > maxUs)
+    {
+        maxUs = latencyUs;
+    }
+    buckets[bucketOf(latencyUs)]++;
+}
+
+double ReaderStats::percentileMs(double fraction) const
+{
+    if (ops == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(fraction * ops + 0.5);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            // The bucket bound can overshoot the largest sample, never report past it
+            double upper = bucketUpperUs(i);
+            return (upper < maxUs ? upper : maxUs) / 1000.0;
+        }
+    }
+    return maxUs / 1000.0;
+}
+
+std::string ReaderStats::report() const
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+    char text[200];
+    snprintf(text, sizeof(text), "OPS %llu ERRORS %llu TIMEOUTS %llu RATE %.1f AVG_MS %.1f P50_MS %.1f P99_MS %.1f MAX_MS %.1f",
+             (unsigned long long)ops, (unsigned long long)errors, (unsigned long long)timeouts,
+             seconds > 0 ? ops / seconds : 0.0, ops ? totalUs / 1000.0 / ops : 0.0,
+             percentileMs(0.50), percentileMs(0.99), maxUs / 1000.0);
+    return text;
+}
+
+} // namespace rfid
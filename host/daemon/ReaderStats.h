@@ -0,0 +1,41 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace rfid
+{
+
+// Per-reader counters and end-to-end latency (queued in the daemon to reply received).
+// Latencies go into log-linear buckets, four per power of two, so percentiles are
+// within about 19% at any scale without keeping samples.
+class ReaderStats
+{
+public:
+    ReaderStats() { reset(); }
+
+    void record(bool ok, uint64_t latencyUs);
+    void recordTimeout() { timeouts++; }
+    void reset();
+
+    // "OPS n ERRORS n TIMEOUTS n RATE n.n AVG_MS n.n P50_MS n.n P99_MS n.n MAX_MS n.n"
+    std::string report() const;
+
+private:
+    static const int SUB_BUCKETS = 4;
+    static const int BUCKETS = 32 * SUB_BUCKETS;
+
+    uint64_t ops;
+    uint64_t errors;
+    uint64_t timeouts;
+    uint64_t totalUs;
+    uint64_t maxUs;
+    uint32_t buckets[BUCKETS];
+    std::chrono::steady_clock::time_point since;
+
+    static int bucketOf(uint64_t us);
+    static double bucketUpperUs(int bucket);
+    double percentileMs(double fraction) const;
+};
+
+} // namespace rfid
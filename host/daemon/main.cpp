@@ -0,0 +1,92 @@
+// Reader daemon: drives many reader boards from one epoll loop and shares them with
+// applications over a Unix socket.
+//
+//   rfidd [--socket PATH] [--timeout-ms N] [--capture-dir DIR] [NAME=]DEVICE...
+//
+// A device without a name is known by the last part of its path (ttyUSB0 for /dev/ttyUSB0).
+// With --capture-dir, the CAPTURE lines of a device are kept in DIR/<name>.capture.
+#include "Daemon.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static rfid::Daemon *running = nullptr;
+
+static void requestStop(int)
+{
+    if (running)
+    {
+        running->stop();
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: rfidd [--socket PATH] [--timeout-ms N] [--capture-dir DIR] [NAME=]DEVICE...\n");
+}
+
+int main(int argc, char **argv)
+{
+    std::string socketPath = "/tmp/rfidd.sock";
+    int timeoutMs = 10000;
+    rfid::Daemon daemon;
+    std::string error;
+    int deviceCount = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc)
+        {
+            socketPath = argv[++i];
+        }
+        else if (arg == "--timeout-ms" && i + 1 < argc)
+        {
+            timeoutMs = atoi(argv[++i]);
+        }
+        else if (arg == "--capture-dir" && i + 1 < argc)
+        {
+            daemon.setCaptureDir(argv[++i]);
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            usage();
+            return 2;
+        }
+        else
+        {
+            size_t equals = arg.find('=');
+            std::string path = equals == std::string::npos ? arg : arg.substr(equals + 1);
+            std::string name = equals == std::string::npos ? path.substr(path.rfind('/') + 1) : arg.substr(0, equals);
+            if (!daemon.addDevice(name, path, error))
+            {
+                fprintf(stderr, "rfidd: %s\n", error.c_str());
+                return 2;
+            }
+            deviceCount++;
+        }
+    }
+    if (deviceCount == 0 || timeoutMs <= 0)
+    {
+        usage();
+        return 2;
+    }
+
+    daemon.setTimeout(timeoutMs);
+    if (!daemon.listen(socketPath, error))
+    {
+        fprintf(stderr, "rfidd: %s\n", error.c_str());
+        return 1;
+    }
+
+    running = &daemon;
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "rfidd: serving %d device(s) on %s\n", deviceCount, socketPath.c_str());
+    daemon.run();
+    running = nullptr;
+    return 0;
+}
@@ -0,0 +1,188 @@
+// Simulated reader board behind a pseudo-terminal: the host build of the firmware with one
+// simulated PN532 and tag per reader, for driving clients without hardware.
+//
+//   rfid_ptysim [--readers N] [--card TYPE] [--frame-us N] [--byte-us N] [--link PATH]
+//
+// Prints the pty path (and symlinks it to --link) and serves it until killed. Delays and
+// frame time are real, so clients see device-like timing.
+#include "App.h"
+#include "SimPN532.h"
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <map>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: rfid_ptysim [--readers N] [--card classic1k|classic4k|mini|ntag213|ntag215|ntag216] [--frame-us N] [--byte-us N] [--link PATH]\n");
+}
+
+static SimCard *makeCard(const std::string &type, uint8_t serial)
+{
+    static const std::map<std::string, uint8_t> classicSak = {{"classic1k", 0x08}, {"classic4k", 0x18}, {"mini", 0x09}};
+    static const std::map<std::string, uint8_t> ntagStorage = {{"ntag213", 0x0F}, {"ntag215", 0x11}, {"ntag216", 0x13}};
+
+    SimCard *card;
+    if (classicSak.count(type))
+    {
+        card = new SimCard(classicSak.at(type));
+    }
+    else if (ntagStorage.count(type))
+    {
+        card = new SimCard(0x00);
+        card->makeNtag(ntagStorage.at(type));
+    }
+    else
+    {
+        return nullptr;
+    }
+    card->uid[card->uidLength - 1] = serial;
+    return card;
+}
+
+int main(int argc, char **argv)
+{
+    int readerCount = RFID_READER_COUNT;
+    std::string cardType = "classic1k";
+    uint32_t frameUs = 2000;
+    uint32_t byteUs = 10;
+    std::string link;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--readers" && hasValue)
+            readerCount = atoi(argv[++i]);
+        else if (arg == "--card" && hasValue)
+            cardType = argv[++i];
+        else if (arg == "--frame-us" && hasValue)
+            frameUs = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--byte-us" && hasValue)
+            byteUs = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--link" && hasValue)
+            link = argv[++i];
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (readerCount < 1 || readerCount > RFID_READER_COUNT)
+    {
+        fprintf(stderr, "--readers must be 1-%d\n", RFID_READER_COUNT);
+        return 2;
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        perror("posix_openpt");
+        return 1;
+    }
+    std::string slavePath = ptsname(master);
+
+    // Keep the slave open in raw mode, so nothing is echoed and the master never sees a hangup
+    int slave = open(slavePath.c_str(), O_RDWR | O_NOCTTY);
+    termios options;
+    tcgetattr(slave, &options);
+    cfmakeraw(&options);
+    tcsetattr(slave, TCSANOW, &options);
+
+    if (!link.empty())
+    {
+        unlink(link.c_str());
+        if (symlink(slavePath.c_str(), link.c_str()) != 0)
+        {
+            perror("symlink");
+            return 1;
+        }
+    }
+
+    // Readers past --readers get no simulator and report NFC errors, like an unplugged antenna
+    static const uint8_t ssPins[] = RFID_SS_PINS;
+    std::vector<SimPN532 *> sims;
+    for (int i = 0; i < readerCount; i++)
+    {
+        SimCard *card = makeCard(cardType, (uint8_t)i);
+        if (!card)
+        {
+            usage();
+            return 2;
+        }
+        SimPN532 *sim = new SimPN532;
+        sim->field.push_back(card);
+        simAttach(ssPins[i], sim);
+        sims.push_back(sim);
+    }
+    simSetFrameCost(frameUs, byteUs);
+    hostSetRealTime(true);
+
+    std::mutex outputLock;
+    Serial.onLine = [master, &outputLock](const std::string &line) {
+        std::lock_guard<std::mutex> guard(outputLock);
+        std::string output = line + "\r\n";
+        const char *data = output.data();
+        size_t remaining = output.size();
+        while (remaining > 0)
+        {
+            ssize_t written = write(master, data, remaining);
+            if (written <= 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            data += written;
+            remaining -= written;
+        }
+    };
+
+    // The firmware's loop task, it sleeps until input arrives like on the device
+    static App app;
+    std::thread([]() {
+        app.setup();
+        for (;;)
+        {
+            app.loop();
+        }
+    }).detach();
+
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    printf("%s\n", slavePath.c_str());
+    fflush(stdout);
+
+    while (!stopRequested)
+    {
+        pollfd readable = {master, POLLIN, 0};
+        if (poll(&readable, 1, 200) <= 0)
+        {
+            continue;
+        }
+
+        char chunk[4096];
+        ssize_t count = read(master, chunk, sizeof(chunk));
+        if (count > 0)
+        {
+            Serial.pushInput(std::string(chunk, count));
+        }
+    }
+
+    if (!link.empty())
+    {
+        unlink(link.c_str());
+    }
+    fflush(stdout);
+    _Exit(0);
+}
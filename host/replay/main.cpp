@@ -0,0 +1,290 @@
+// Offline replay of CAPTURE sessions: runs App, CommandParser and RFIDController on the host
+// with every PN532 answering from the recorded exchanges instead of a tag model.
+//
+//   rfid_replay [--verbose] [--json] CAPTURE...
+//
+// Commands are sent in the order their captures ended, each with the same line as recorded,
+// and the replayed reply is compared with the recorded one through its CRC. An armed
+// operation (ARM_TAG) is not sent: the armed reader's next poll runs into its exchanges. Exchange time
+// is the captured one, so the replayed time of a command differs from the capture only by
+// exchanges made, skipped or repeated; UART and host time are not part of either.
+// Exits 1 if a reply differs or the firmware sent a frame the capture never saw.
+#include "App.h"
+#include "ReplayPN532.h"
+#include <map>
+#include <sstream>
+
+struct Outcome
+{
+    std::string name;
+    bool sameReply;
+    uint32_t capturedUs;
+    uint32_t replayedUs;
+    long exchanges; // Captured
+    long matched;
+    long reused;
+    long diverged;
+};
+
+struct Totals
+{
+    size_t ops = 0;
+    size_t mismatched = 0;
+    uint64_t capturedUs = 0;
+    uint64_t replayedUs = 0;
+    long exchanges = 0;
+    long matched = 0;
+    long reused = 0;
+    long diverged = 0;
+
+    void add(const Outcome &outcome)
+    {
+        ops++;
+        mismatched += outcome.sameReply ? 0 : 1;
+        capturedUs += outcome.capturedUs;
+        replayedUs += outcome.replayedUs;
+        exchanges += outcome.exchanges;
+        matched += outcome.matched;
+        reused += outcome.reused;
+        diverged += outcome.diverged;
+    }
+
+    double deltaPercent() const { return capturedUs > 0 ? ((double)replayedUs - capturedUs) * 100.0 / capturedUs : 0; }
+};
+
+// Waits for the END line the firmware captures for the replayed command
+class EndCollector
+{
+public:
+    bool verbose = false;
+
+    // The reader's replay is finished as the END line goes out, before an armed reader polls again
+    void attach(ReplayPN532 *replays)
+    {
+        Serial.onLine = [this, replays](const std::string &line) {
+            if (verbose)
+            {
+                fprintf(stderr, "  < %s\n", line.c_str());
+            }
+            if (line.compare(0, 9, "CAPTURE @") != 0 || line.find(" END ") == std::string::npos)
+            {
+                return;
+            }
+            int reader = atoi(line.c_str() + 9);
+            if (reader >= 0 && reader < RFID_READER_COUNT)
+            {
+                replays[reader].finish();
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            ends.push_back(line);
+            arrived.notify_all();
+        };
+    }
+
+    // Next END line, false if the firmware went quiet
+    bool waitEnd(std::string &line)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if (!arrived.wait_for(guard, std::chrono::seconds(10), [this]() { return !ends.empty(); }))
+        {
+            return false;
+        }
+        line = ends.front();
+        ends.erase(ends.begin());
+        return true;
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable arrived;
+    std::vector<std::string> ends;
+};
+
+// Command name without the reader and tag prefixes
+static std::string commandName(const std::string &line)
+{
+    std::istringstream words(line);
+    std::string word;
+    while (words >> word && (word[0] == '@' || word[0] == '#'))
+    {
+    }
+    return word;
+}
+
+static void printRow(const std::string &name, const Totals &totals)
+{
+    printf("%-14s %6zu %8zu %12.0f %12.0f %+8.1f%% %9ld %9ld %9ld %9ld\n", name.c_str(), totals.ops, totals.mismatched,
+           totals.ops ? (double)totals.capturedUs / totals.ops : 0, totals.ops ? (double)totals.replayedUs / totals.ops : 0,
+           totals.deltaPercent(), totals.exchanges, totals.matched, totals.reused, totals.diverged);
+}
+
+static std::string totalsJson(const Totals &totals)
+{
+    char text[300];
+    snprintf(text, sizeof(text),
+             "{\"ops\":%zu,\"mismatched\":%zu,\"captured_us\":%llu,\"replayed_us\":%llu,\"delta_pct\":%.2f,"
+             "\"exchanges\":%ld,\"matched\":%ld,\"reused\":%ld,\"diverged\":%ld}",
+             totals.ops, totals.mismatched, (unsigned long long)totals.capturedUs, (unsigned long long)totals.replayedUs,
+             totals.deltaPercent(), totals.exchanges, totals.matched, totals.reused, totals.diverged);
+    return text;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: rfid_replay [--verbose] [--json] CAPTURE...\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool verbose = false;
+    bool json = false;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--verbose")
+            verbose = true;
+        else if (arg == "--json")
+            json = true;
+        else if (arg[0] != '-')
+            paths.push_back(arg);
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (paths.empty())
+    {
+        usage();
+        return 2;
+    }
+
+    std::vector<CapturedCommand> commands;
+    for (const std::string &path : paths)
+    {
+        std::string error;
+        if (!loadCapture(path, commands, error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 2;
+        }
+    }
+
+    static const uint8_t ssPins[] = RFID_SS_PINS;
+    static ReplayPN532 replays[RFID_READER_COUNT];
+    for (uint8_t r = 0; r < RFID_READER_COUNT; r++)
+    {
+        simAttach(ssPins[r], &replays[r]);
+    }
+
+    EndCollector ends;
+    ends.verbose = verbose;
+    ends.attach(replays);
+    static App app;
+    app.setup();
+    Capture::setEnabled(true);
+
+    std::vector<Outcome> outcomes;
+    std::vector<const CapturedCommand *> history[RFID_READER_COUNT];
+    size_t skipped = 0;
+
+    for (const CapturedCommand &command : commands)
+    {
+        if (command.truncated || command.reader >= RFID_READER_COUNT)
+        {
+            // Exchanges are missing from the capture, or the reader does not exist here
+            skipped++;
+            continue;
+        }
+
+        ReplayPN532 &replay = replays[command.reader];
+        long matchedBefore = replay.matched;
+        long reusedBefore = replay.reused;
+        long divergedBefore = replay.diverged;
+        replay.start(&command, history[command.reader]);
+
+        if (verbose)
+        {
+            fprintf(stderr, "> %s\n", command.line.c_str());
+        }
+        if (!command.armed)
+        {
+            Serial.pushLine(command.line);
+            app.loop();
+        }
+
+        std::string end;
+        if (!ends.waitEnd(end))
+        {
+            fprintf(stderr, "no reply to: %.60s\n", command.line.c_str());
+            fflush(stdout);
+            _Exit(2);
+        }
+
+        // CAPTURE @<reader> END <us> <crc> [TRUNCATED]
+        std::istringstream words(end);
+        std::string capture, reader, kind, crc;
+        uint32_t replayedUs = 0;
+        words >> capture >> reader >> kind >> replayedUs >> crc;
+
+        Outcome outcome;
+        outcome.name = commandName(command.line);
+        outcome.sameReply = (uint32_t)strtoul(crc.c_str(), nullptr, 16) == command.replyCrc;
+        outcome.capturedUs = command.durationUs;
+        outcome.replayedUs = replayedUs;
+        outcome.exchanges = (long)command.exchanges.size();
+        outcome.matched = replay.matched - matchedBefore;
+        outcome.reused = replay.reused - reusedBefore;
+        outcome.diverged = replay.diverged - divergedBefore;
+        outcomes.push_back(outcome);
+        history[command.reader].push_back(&command);
+
+        if (!outcome.sameReply || outcome.diverged > 0)
+        {
+            fprintf(stderr, "%s: %.60s\n", outcome.sameReply ? "diverged" : "reply differs", command.line.c_str());
+        }
+    }
+
+    Totals total;
+    std::map<std::string, Totals> byCommand;
+    for (const Outcome &outcome : outcomes)
+    {
+        total.add(outcome);
+        byCommand[outcome.name].add(outcome);
+    }
+
+    if (json)
+    {
+        printf("{\"skipped\":%zu,\"total\":%s,\"commands\":{", skipped, totalsJson(total).c_str());
+        bool first = true;
+        for (auto &entry : byCommand)
+        {
+            printf("%s\"%s\":%s", first ? "" : ",", entry.first.c_str(), totalsJson(entry.second).c_str());
+            first = false;
+        }
+        printf("}}\n");
+    }
+    else
+    {
+        printf("%-14s %6s %8s %12s %12s %9s %9s %9s %9s %9s\n", "command", "ops", "mismatch", "captured_us", "replayed_us",
+               "delta", "exchanges", "matched", "reused", "diverged");
+        for (auto &entry : byCommand)
+        {
+            printRow(entry.first, entry.second);
+        }
+        printRow("TOTAL", total);
+        if (skipped > 0)
+        {
+            printf("%zu truncated command(s) skipped\n", skipped);
+        }
+    }
+
+    int status = total.mismatched > 0 || total.diverged > 0 ? 1 : 0;
+
+    // Reader tasks never return, leave without running static destructors under them
+    fflush(stdout);
+    fflush(stderr);
+    _Exit(status);
+}
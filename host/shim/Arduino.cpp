@@ -0,0 +1,255 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <atomic>
+#include <map>
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+static const auto startTime = std::chrono::steady_clock::now();
+static std::atomic<uint64_t> virtualUs(0);
+static bool realTime = false;
+
+static uint64_t nowUs()
+{
+    uint64_t realUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+    return realUs + virtualUs.load();
+}
+
+unsigned long millis()
+{
+    return (unsigned long)(nowUs() / 1000);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)nowUs();
+}
+
+void hostAdvanceClock(uint32_t us)
+{
+    if (realTime)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+        return;
+    }
+    virtualUs += us;
+}
+
+void hostSetRealTime(bool on)
+{
+    realTime = on;
+}
+
+void delay(unsigned long ms)
+{
+    hostAdvanceClock(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    hostAdvanceClock(us);
+}
+
+static std::map<uint8_t, SpiDevice *> spiDevices;
+static SpiDevice *spiSelected = nullptr;
+
+void spiAttach(uint8_t ssPin, SpiDevice *device)
+{
+    spiDevices[ssPin] = device;
+}
+
+uint8_t SPIClass::transfer(uint8_t value)
+{
+    return spiSelected ? spiSelected->transfer(value) : 0;
+}
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    // Chip-select of an attached SPI device, active low
+    auto found = spiDevices.find(pin);
+    if (found == spiDevices.end())
+    {
+        return;
+    }
+    if (value == LOW && spiSelected != found->second)
+    {
+        spiSelected = found->second;
+        spiSelected->select();
+    }
+    else if (value != LOW && spiSelected == found->second)
+    {
+        spiSelected->deselect();
+        spiSelected = nullptr;
+    }
+}
+
+int digitalRead(uint8_t) { return LOW; }
+void yield() {}
+
+int HardwareSerial::available()
+{
+    std::lock_guard<std::mutex> guard(inputLock);
+    return (int)input.size();
+}
+
+size_t HardwareSerial::read(uint8_t *buffer, size_t size)
+{
+    std::lock_guard<std::mutex> guard(inputLock);
+    size_t count = std::min(size, input.size());
+    memcpy(buffer, input.data(), count);
+    input.erase(0, count);
+    return count;
+}
+
+void HardwareSerial::pushInput(const std::string &bytes)
+{
+    {
+        std::lock_guard<std::mutex> guard(inputLock);
+        input += bytes;
+    }
+    // Like the UART driver's receive callback
+    if (receiveCallback)
+    {
+        receiveCallback();
+    }
+}
+
+size_t HardwareSerial::println(const String &line)
+{
+    if (onLine)
+    {
+        onLine(line.s);
+    }
+    else
+    {
+        fputs(line.c_str(), stdout);
+        fputc('\n', stdout);
+    }
+    return line.length() + 2;
+}
+
+size_t HardwareSerial::print(const String &text)
+{
+    fputs(text.c_str(), stdout);
+    return text.length();
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t depth, UBaseType_t itemSize)
+{
+    HostQueue *queue = new HostQueue;
+    queue->itemSize = itemSize;
+    queue->depth = depth;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t)
+{
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->items.size() >= queue->depth)
+    {
+        return pdFALSE;
+    }
+    const uint8_t *bytes = static_cast<const uint8_t *>(item);
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    queue->ready.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> guard(queue->lock);
+    auto hasItem = [queue]() { return !queue->items.empty(); };
+    if (ticks == portMAX_DELAY)
+    {
+        queue->ready.wait(guard, hasItem);
+    }
+    else
+    {
+        queue->ready.wait_for(guard, std::chrono::milliseconds(ticks), hasItem);
+    }
+
+    if (queue->items.empty())
+    {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    return pdTRUE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return new std::recursive_mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t)
+{
+    semaphore->lock();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    semaphore->unlock();
+    return pdTRUE;
+}
+
+BaseType_t xTaskCreate(void (*task)(void *), const char *, uint32_t, void *parameter, UBaseType_t, TaskHandle_t *)
+{
+    // Tasks run until the process exits, like on the device
+    std::thread(task, parameter).detach();
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+struct HostNotification
+{
+    std::mutex lock;
+    std::condition_variable given;
+    uint32_t count = 0;
+};
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    // Never freed, a handle may outlive its thread like a deleted task's on the device
+    static thread_local HostNotification *notification = new HostNotification;
+    return notification;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    HostNotification *notification = static_cast<HostNotification *>(task);
+    std::lock_guard<std::mutex> guard(notification->lock);
+    notification->count++;
+    notification->given.notify_one();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    // Waits in real time, the virtual clock only moves with simulated work
+    HostNotification *notification = static_cast<HostNotification *>(xTaskGetCurrentTaskHandle());
+    std::unique_lock<std::mutex> guard(notification->lock);
+    auto given = [notification]() { return notification->count > 0; };
+    if (ticks == portMAX_DELAY)
+    {
+        notification->given.wait(guard, given);
+    }
+    else
+    {
+        notification->given.wait_for(guard, std::chrono::milliseconds(ticks), given);
+    }
+    uint32_t count = notification->count;
+    if (count > 0)
+    {
+        notification->count = clearOnExit ? 0 : count - 1;
+    }
+    return count;
+}
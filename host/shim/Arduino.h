@@ -0,0 +1,275 @@
+#pragma once
+// Host stand-in for the parts of the ESP32 Arduino core and FreeRTOS the firmware uses.
+// Time is virtual unless switched to real time: delay() advances the clock instead of
+// sleeping, so a benchmark run reports device-like latencies without waiting for them.
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef uint8_t byte;
+
+#define HEX 16
+#define DEC 10
+#define OUTPUT 1
+#define INPUT 0
+#define HIGH 1
+#define LOW 0
+#define LSBFIRST 0
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class String
+{
+public:
+    std::string s;
+
+    String() {}
+    String(const char *c) : s(c ? c : "") {}
+    String(const std::string &x) : s(x) {}
+    String(char c) : s(1, c) {}
+    String(int v, unsigned char base = 10) { formatSigned(v, base); }
+    String(unsigned int v, unsigned char base = 10) { formatUnsigned(v, base); }
+    String(long v, unsigned char base = 10) { formatSigned(v, base); }
+    String(unsigned long v, unsigned char base = 10) { formatUnsigned(v, base); }
+    String(unsigned char v, unsigned char base = 10) { formatUnsigned(v, base); }
+    String(float v, unsigned int decimals = 2) { formatFloat(v, decimals); }
+    String(double v, unsigned int decimals = 2) { formatFloat(v, decimals); }
+
+    unsigned int length() const { return s.size(); }
+    const char *c_str() const { return s.c_str(); }
+    char charAt(unsigned int i) const { return i < s.size() ? s[i] : 0; }
+    void setCharAt(unsigned int i, char c)
+    {
+        if (i < s.size())
+            s[i] = c;
+    }
+    char operator[](unsigned int i) const { return charAt(i); }
+
+    String substring(unsigned int from) const { return from >= s.size() ? String() : String(s.substr(from)); }
+    String substring(unsigned int from, unsigned int to) const
+    {
+        if (from > to)
+            std::swap(from, to);
+        if (from >= s.size())
+            return String();
+        if (to > s.size())
+            to = s.size();
+        return String(s.substr(from, to - from));
+    }
+    int indexOf(char c, unsigned int from = 0) const { return position(s.find(c, from)); }
+    int indexOf(const String &x, unsigned int from = 0) const { return position(s.find(x.s, from)); }
+    int lastIndexOf(char c) const { return position(s.rfind(c)); }
+    int lastIndexOf(char c, unsigned int from) const { return position(s.rfind(c, from)); }
+
+    void trim()
+    {
+        size_t first = 0;
+        while (first < s.size() && isspace((unsigned char)s[first]))
+            first++;
+        size_t last = s.size();
+        while (last > first && isspace((unsigned char)s[last - 1]))
+            last--;
+        s = s.substr(first, last - first);
+    }
+    void toUpperCase()
+    {
+        for (char &c : s)
+            c = toupper((unsigned char)c);
+    }
+    void toLowerCase()
+    {
+        for (char &c : s)
+            c = tolower((unsigned char)c);
+    }
+    bool reserve(unsigned int size)
+    {
+        s.reserve(size);
+        return true;
+    }
+    long toInt() const { return atol(s.c_str()); }
+    bool startsWith(const String &prefix) const { return s.compare(0, prefix.s.size(), prefix.s) == 0; }
+    bool endsWith(const String &suffix) const { return s.size() >= suffix.s.size() && s.compare(s.size() - suffix.s.size(), suffix.s.size(), suffix.s) == 0; }
+    bool equals(const String &other) const { return s == other.s; }
+    bool equalsIgnoreCase(const String &other) const
+    {
+        if (s.size() != other.s.size())
+            return false;
+        for (size_t i = 0; i < s.size(); i++)
+            if (tolower((unsigned char)s[i]) != tolower((unsigned char)other.s[i]))
+                return false;
+        return true;
+    }
+    bool concat(const String &other)
+    {
+        s += other.s;
+        return true;
+    }
+    bool concat(const char *c, unsigned int n)
+    {
+        s.append(c, n);
+        return true;
+    }
+    bool concat(char c)
+    {
+        s += c;
+        return true;
+    }
+
+    String &operator+=(const String &other)
+    {
+        s += other.s;
+        return *this;
+    }
+    String &operator+=(const char *other)
+    {
+        s += other;
+        return *this;
+    }
+    String &operator+=(char c)
+    {
+        s += c;
+        return *this;
+    }
+    bool operator==(const String &other) const { return s == other.s; }
+    bool operator==(const char *other) const { return s == other; }
+    bool operator!=(const String &other) const { return s != other.s; }
+    bool operator!=(const char *other) const { return s != other; }
+    bool operator<(const String &other) const { return s < other.s; }
+    friend String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+    friend String operator+(const String &a, const char *b) { return String(a.s + b); }
+    friend String operator+(const char *a, const String &b) { return String(a + b.s); }
+    friend String operator+(const String &a, char b) { return String(a.s + b); }
+
+private:
+    static int position(size_t found) { return found == std::string::npos ? -1 : (int)found; }
+
+    void formatUnsigned(unsigned long value, unsigned base)
+    {
+        char buffer[70];
+        int i = sizeof(buffer) - 1;
+        buffer[i] = '\0';
+        do
+        {
+            int digit = value % base;
+            buffer[--i] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+            value /= base;
+        } while (value);
+        s = buffer + i;
+    }
+    void formatSigned(long value, unsigned base)
+    {
+        if (value < 0 && base == 10)
+        {
+            formatUnsigned(-(unsigned long)value, base);
+            s = "-" + s;
+        }
+        else
+        {
+            formatUnsigned((unsigned long)value, base);
+        }
+    }
+    void formatFloat(double value, unsigned int decimals)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+        s = buffer;
+    }
+};
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void yield();
+
+// Advances the virtual clock, used by the simulated radio to charge frame time
+void hostAdvanceClock(uint32_t us);
+// Sleep for delays and frame time instead of advancing the clock, for interactive simulators
+void hostSetRealTime(bool realTime);
+
+// Serial port backed by a byte queue on the input side and a callback on the output side
+class HardwareSerial
+{
+public:
+    void begin(unsigned long) {}
+    size_t setRxBufferSize(size_t size) { return size; }
+    size_t setTxBufferSize(size_t size) { return size; }
+    void setTimeout(unsigned long) {}
+    operator bool() const { return true; }
+
+    int available();
+    size_t read(uint8_t *buffer, size_t size);
+    void onReceive(std::function<void()> callback) { receiveCallback = callback; }
+    size_t println(const String &line);
+    size_t print(const String &text);
+    void flush() {}
+
+    // Host side: queues input bytes or one line, receives every output line
+    void pushInput(const std::string &bytes);
+    void pushLine(const std::string &line) { pushInput(line + "\n"); }
+    std::function<void(const std::string &)> onLine;
+
+private:
+    std::mutex inputLock;
+    std::string input;
+    std::function<void()> receiveCallback;
+};
+
+extern HardwareSerial Serial;
+
+// FreeRTOS subset on std::thread
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t UBaseType_t;
+typedef void *TaskHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) (ms)
+
+struct HostQueue
+{
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<std::vector<uint8_t>> items;
+    size_t itemSize;
+    size_t depth;
+};
+typedef HostQueue *QueueHandle_t;
+typedef std::recursive_mutex *SemaphoreHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t depth, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stackSize, void *parameter, UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelay(TickType_t ticks);
+// Task notifications as a counting semaphore per thread
+TaskHandle_t xTaskGetCurrentTaskHandle();
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+
+struct portMUX_TYPE
+{
+    std::recursive_mutex lock;
+};
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (mux)->lock.lock()
+#define portEXIT_CRITICAL(mux) (mux)->lock.unlock()
@@ -0,0 +1,35 @@
+#pragma once
+#include <Arduino.h>
+
+struct SPISettings
+{
+    SPISettings() {}
+    SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+// Device on the host SPI bus, selected while its chip-select pin is driven low
+class SpiDevice
+{
+public:
+    virtual ~SpiDevice() {}
+    virtual void select() = 0;
+    virtual uint8_t transfer(uint8_t value) = 0;
+    virtual void deselect() = 0;
+};
+
+// The host build normally replaces PN532SpiTransport with the simulator transport and the bus
+// stays idle. Tests of the SPI transport itself attach a device to a chip-select pin.
+class SPIClass
+{
+public:
+    void begin() {}
+    void beginTransaction(SPISettings) {}
+    void endTransaction() {}
+    // Clocks one byte to the selected device, 0 if none is selected
+    uint8_t transfer(uint8_t value);
+};
+
+extern SPIClass SPI;
+
+// Not thread safe, attach devices before the readers start
+void spiAttach(uint8_t ssPin, SpiDevice *device);
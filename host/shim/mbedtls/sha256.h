@@ -0,0 +1,6 @@
+#pragma once
+#include <cstddef>
+
+// Host stand-in for the one-shot SHA-256 of mbedtls, which the ESP32 core backs with the
+// SHA accelerator. Software only, is224 must be 0.
+int mbedtls_sha256(const unsigned char *input, size_t ilen, unsigned char *output, int is224);
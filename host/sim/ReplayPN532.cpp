@@ -0,0 +1,237 @@
+#include "ReplayPN532.h"
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+static bool parseHex(const std::string &text, std::vector<uint8_t> &bytes)
+{
+    bytes.clear();
+    if (text == "-")
+    {
+        return true;
+    }
+    if (text.size() % 2 != 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < text.size(); i += 2)
+    {
+        char *end;
+        std::string pair = text.substr(i, 2);
+        long value = strtol(pair.c_str(), &end, 16);
+        if (*end != '\0')
+        {
+            return false;
+        }
+        bytes.push_back((uint8_t)value);
+    }
+    return true;
+}
+
+static bool parseResult(const std::string &name, TraceResult &result)
+{
+    for (TraceResult candidate : {TraceResult::OK, TraceResult::NO_ACK, TraceResult::TIMEOUT, TraceResult::BAD_FRAME})
+    {
+        if (name == FrameTrace::resultName(candidate))
+        {
+            result = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool loadCapture(const std::string &path, std::vector<CapturedCommand> &commands, std::string &error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        error = path + ": cannot open";
+        return false;
+    }
+
+    // Lines of different readers interleave, each reader has at most one open command
+    std::map<int, CapturedCommand> open;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (line.compare(0, 9, "CAPTURE @") != 0)
+        {
+            continue;
+        }
+
+        std::istringstream words(line.substr(9));
+        int reader = -1;
+        std::string kind;
+        words >> reader >> kind;
+        error = path + ":" + std::to_string(lineNumber) + ": malformed " + kind + " line";
+
+        if (reader < 0 || reader > 255)
+        {
+            return false;
+        }
+        if (kind == "CMD")
+        {
+            CapturedCommand &command = open[reader];
+            command = CapturedCommand();
+            command.reader = (uint8_t)reader;
+            std::getline(words >> std::ws, command.line);
+            if (command.line.empty())
+            {
+                return false;
+            }
+            std::istringstream name(command.line);
+            std::string word;
+            while (name >> word && (word[0] == '@' || word[0] == '#'))
+            {
+            }
+            command.armed = word == "ARM_TAG";
+            continue;
+        }
+
+        auto found = open.find(reader);
+        if (found == open.end())
+        {
+            // Capture switched on in the middle of this command
+            continue;
+        }
+        CapturedCommand &command = found->second;
+
+        if (kind == "X")
+        {
+            CapturedExchange exchange;
+            std::string result, tx, rx;
+            if (!(words >> exchange.durationUs >> result >> tx >> rx) || !parseResult(result, exchange.result) ||
+                !parseHex(tx, exchange.command) || !parseHex(rx, exchange.response) || exchange.command.empty() ||
+                exchange.command.size() > 255)
+            {
+                return false;
+            }
+            // Captures made before keys were masked are matched on the masked form as well
+            FrameTrace::maskKeys(exchange.command.data(), (uint8_t)exchange.command.size());
+            command.exchanges.push_back(std::move(exchange));
+        }
+        else if (kind == "END")
+        {
+            std::string crc, flag;
+            if (!(words >> command.durationUs >> crc))
+            {
+                return false;
+            }
+            command.replyCrc = (uint32_t)strtoul(crc.c_str(), nullptr, 16);
+            command.truncated = (words >> flag) && flag == "TRUNCATED";
+            commands.push_back(std::move(command));
+            open.erase(found);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    error.clear();
+    return true;
+}
+
+void ReplayPN532::start(const CapturedCommand *command, const std::vector<const CapturedCommand *> &history)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    current = command->armed ? nullptr : command;
+    pending = command->armed && !command->exchanges.empty() ? command : nullptr;
+    cursor = 0;
+    earlier = history;
+}
+
+void ReplayPN532::finish()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    current = nullptr;
+    pending = nullptr;
+}
+
+void ReplayPN532::answer(const CapturedExchange &exchange)
+{
+    memcpy(responseData, exchange.response.data(), exchange.response.size());
+    responseSize = (int)exchange.response.size();
+    exchangeResult = exchange.result;
+    exchangeUs = (int32_t)exchange.durationUs;
+}
+
+void ReplayPN532::handle(const uint8_t *frame, int length)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    frames++;
+
+    // Captures hold the frames with their keys masked, so the keys of the replayed command
+    // do not matter
+    uint8_t command[256];
+    memcpy(command, frame, length);
+    FrameTrace::maskKeys(command, (uint8_t)length);
+    auto sameCommand = [&command, length](const CapturedExchange &exchange) {
+        return exchange.command.size() == (size_t)length && memcmp(exchange.command.data(), command, length) == 0;
+    };
+
+    if (!current && pending && sameCommand(pending->exchanges[0]))
+    {
+        current = pending;
+        pending = nullptr;
+    }
+    if (!current)
+    {
+        // A poll between commands: the PN532 answers, no target is in the field
+        responseData[0] = command[0] + 1;
+        responseData[1] = 0x00;
+        responseSize = command[0] == 0x4A ? 2 : 1;
+        exchangeResult = TraceResult::OK;
+        exchangeUs = 0;
+        return;
+    }
+
+    for (size_t i = cursor; i < current->exchanges.size(); i++)
+    {
+        if (sameCommand(current->exchanges[i]))
+        {
+            matched++;
+            cursor = i + 1;
+            answer(current->exchanges[i]);
+            return;
+        }
+    }
+
+    // Latest first: the card state closest to this point of the session
+    for (size_t i = cursor; i-- > 0;)
+    {
+        if (sameCommand(current->exchanges[i]))
+        {
+            reused++;
+            answer(current->exchanges[i]);
+            return;
+        }
+    }
+
+    for (size_t c = earlier.size(); c-- > 0;)
+    {
+        const std::vector<CapturedExchange> &exchanges = earlier[c]->exchanges;
+        for (size_t i = exchanges.size(); i-- > 0;)
+        {
+            if (sameCommand(exchanges[i]))
+            {
+                reused++;
+                answer(exchanges[i]);
+                return;
+            }
+        }
+    }
+
+    diverged++;
+    responseSize = 0;
+    exchangeResult = TraceResult::NO_ACK;
+    exchangeUs = 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "SimPN532.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One PN532 exchange of a capture
+struct CapturedExchange
+{
+    std::vector<uint8_t> command;
+    std::vector<uint8_t> response;
+    TraceResult result;
+    uint32_t durationUs;
+};
+
+// One command of a capture with the exchanges it made on its reader
+struct CapturedCommand
+{
+    uint8_t reader;
+    std::string line;
+    std::vector<CapturedExchange> exchanges;
+    uint32_t durationUs;
+    uint32_t replyCrc;
+    bool truncated;
+    bool armed; // ARM_TAG: operation of an armed reader, from the poll that found the tag
+};
+
+// Reads the CAPTURE lines of a file, anything else in it is skipped. Commands are returned
+// in the order they finished; false with error set if a CAPTURE line is malformed.
+bool loadCapture(const std::string &path, std::vector<CapturedCommand> &commands, std::string &error);
+
+// PN532 that answers from a capture instead of a model, so RFIDController can be run
+// offline against real-card sessions. A command frame is matched, with its keys masked like
+// the capture's, to the next captured exchange with the same bytes; captured exchanges passed over are the ones the code under
+// test no longer makes. A frame not captured after the cursor is answered from an earlier
+// identical exchange on the same reader (a repeated block read, a re-sent configuration),
+// and one never captured at all fails with NO_ACK and counts as a divergence.
+class ReplayPN532 : public SimPN532
+{
+public:
+    long matched = 0;  // In capture order
+    long reused = 0;   // Answered from an earlier exchange
+    long diverged = 0; // Never captured
+
+    // Exchanges of the command to replay, and the commands before it on the same reader.
+    // An armed operation is not sent as a line: it starts at the first poll frame that matches
+    // its first exchange.
+    void start(const CapturedCommand *command, const std::vector<const CapturedCommand *> &history);
+    // The command's END line went out. Frames until the next command are polls of an armed
+    // reader and find an empty field.
+    void finish();
+    void handle(const uint8_t *frame, int length) override;
+
+private:
+    // Armed readers poll on their own task while the replay starts the next command
+    std::mutex lock;
+    const CapturedCommand *current = nullptr;
+    const CapturedCommand *pending = nullptr;
+    size_t cursor = 0;
+    std::vector<const CapturedCommand *> earlier;
+
+    void answer(const CapturedExchange &exchange);
+};
@@ -0,0 +1,382 @@
+#include "SimPN532.h"
+#include <map>
+
+SimCard::SimCard(uint8_t sak)
+{
+    static const uint8_t defaultUid[] = {0x04, 0xA1, 0xB2, 0xC3};
+    memcpy(uid, defaultUid, sizeof(defaultUid));
+    uidLength = 4;
+    this->sak = sak;
+    atqa = sak == 0x18 ? 0x0002 : 0x0004;
+    blockCount = sak == 0x18 ? 256 : (sak == 0x09 ? 20 : 64);
+    authSector = -1;
+
+    ntag = false;
+    storage = 0;
+    userPages = 0;
+    memset(pages, 0, sizeof(pages));
+    memset(password, 0xFF, sizeof(password));
+    protectFrom = 255;
+    passwordOk = false;
+
+    halted = false;
+    hlt = false;
+
+    // Factory keys FFFFFFFFFFFF and transport access bits FF0780
+    memset(blocks, 0, sizeof(blocks));
+    for (int s = 0; s < sectors(); s++)
+    {
+        uint8_t *trailer = blocks[trailerOf(s)];
+        memset(trailer, 0xFF, 16);
+        trailer[7] = 0x07;
+        trailer[8] = 0x80;
+        trailer[9] = 0x69;
+    }
+}
+
+void SimCard::makeNtag(uint8_t storageSize)
+{
+    static const uint8_t ntagUid[] = {0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+    ntag = true;
+    sak = 0x00;
+    atqa = 0x0044;
+    storage = storageSize;
+    userPages = storageSize == 0x0F ? 36 : storageSize == 0x11 ? 126 : storageSize == 0x13 ? 222 : 12;
+    memcpy(uid, ntagUid, sizeof(ntagUid));
+    uidLength = sizeof(ntagUid);
+}
+
+void SimCard::enroll(const uint8_t *key)
+{
+    if (ntag)
+    {
+        memcpy(password, key, 4);
+        protectFrom = 4;
+        return;
+    }
+
+    for (int s = 0; s < sectors(); s++)
+    {
+        uint8_t *trailer = blocks[trailerOf(s)];
+        trailer[6] = 0x1F;
+        trailer[7] = 0x01;
+        trailer[8] = 0xEE;
+        trailer[9] = 0x00;
+        memcpy(trailer + 10, key + s * 6, 6);
+    }
+}
+
+int SimCard::sectors() const
+{
+    return blockCount == 256 ? 40 : blockCount / 4;
+}
+
+int SimCard::sectorOf(int block)
+{
+    return block < 128 ? block / 4 : 32 + (block - 128) / 16;
+}
+
+int SimCard::trailerOf(int sector)
+{
+    return sector < 32 ? sector * 4 + 3 : 128 + (sector - 32) * 16 + 15;
+}
+
+SimPN532::SimPN532()
+{
+    frames = 0;
+    lossPercent = 0;
+    targets[0] = targets[1] = targets[2] = nullptr;
+    responseSize = 0;
+    exchangeResult = TraceResult::OK;
+    exchangeUs = -1;
+}
+
+void SimPN532::put(const uint8_t *data, int length)
+{
+    memcpy(responseData + responseSize, data, length);
+    responseSize += length;
+}
+
+void SimPN532::handle(const uint8_t *command, int length)
+{
+    frames++;
+    responseSize = 0;
+    put(command[0] + 1);
+
+    switch (command[0])
+    {
+    case 0x02: // GetFirmwareVersion: PN532 v1.6
+        put(0x32);
+        put(0x01);
+        put(0x06);
+        put(0x07);
+        break;
+
+    case 0x14: // SAMConfiguration, comes after a power up so every tag is reset
+        for (SimCard *card : field)
+        {
+            card->hlt = false;
+        }
+        break;
+
+    case 0x32: // RFConfiguration, switching the field off resets the tags
+        if (command[1] == 0x01 && command[2] == 0x00)
+        {
+            for (SimCard *card : field)
+            {
+                card->hlt = false;
+            }
+        }
+        break;
+
+    case 0x4A:
+        listPassiveTargets(command, length);
+        break;
+
+    case 0x52: // InRelease halts the released targets
+        put(0x00);
+        for (int tg = 1; tg < 3; tg++)
+        {
+            if (targets[tg] && (command[1] == 0 || command[1] == tg))
+            {
+                targets[tg]->hlt = true;
+                targets[tg] = nullptr;
+            }
+        }
+        break;
+
+    case 0x40:
+        dataExchange(command, length);
+        break;
+
+    default:
+        // Syntax error frame
+        responseSize = 0;
+        put(0x7F);
+        break;
+    }
+}
+
+void SimPN532::listPassiveTargets(const uint8_t *command, int length)
+{
+    // Initiator data selects one UID, cascade tags are not part of it
+    uint8_t wanted[10];
+    int wantedLength = 0;
+    for (int i = 3; i < length; i++)
+    {
+        if (command[i] == 0x88 && length - i > 4)
+        {
+            continue;
+        }
+        wanted[wantedLength++] = command[i];
+    }
+
+    int countPos = responseSize;
+    put(0);
+    int count = 0;
+    targets[1] = targets[2] = nullptr;
+
+    for (SimCard *card : field)
+    {
+        if (count >= command[1])
+        {
+            break;
+        }
+        if (card->hlt || (wantedLength > 0 && (wantedLength != card->uidLength || memcmp(wanted, card->uid, wantedLength) != 0)))
+        {
+            continue;
+        }
+
+        card->halted = false;
+        card->authSector = -1;
+        card->passwordOk = false;
+        targets[++count] = card;
+
+        put(count);
+        put(card->atqa >> 8);
+        put(card->atqa & 0xFF);
+        put(card->sak);
+        put(card->uidLength);
+        put(card->uid, card->uidLength);
+    }
+
+    responseData[countPos] = count;
+}
+
+void SimPN532::dataExchange(const uint8_t *command, int length)
+{
+    SimCard *card = (command[1] >= 1 && command[1] <= 2) ? targets[command[1]] : nullptr;
+    if (!card || card->halted)
+    {
+        put(0x01); // Timeout, nothing answers
+        return;
+    }
+    if (lossPercent > 0 && (int)(lossRandom() % 100) < lossPercent)
+    {
+        // Lost on the way, the tag drops its authentication and waits to be selected again
+        card->halted = true;
+        card->authSector = -1;
+        card->passwordOk = false;
+        put(0x01);
+        return;
+    }
+
+    if (card->ntag)
+    {
+        ntagExchange(card, command + 2, length - 2);
+    }
+    else
+    {
+        classicExchange(card, command + 2, length - 2);
+    }
+}
+
+void SimPN532::classicExchange(SimCard *card, const uint8_t *request, int length)
+{
+    uint8_t op = request[0];
+    uint8_t block = request[1];
+
+    if (op == 0x60 || op == 0x61)
+    {
+        int sector = SimCard::sectorOf(block);
+        const uint8_t *trailer = card->blocks[SimCard::trailerOf(sector)];
+        if (block >= card->blockCount || memcmp(request + 2, op == 0x60 ? trailer : trailer + 10, 6) != 0)
+        {
+            // Failed authentication halts the tag
+            card->halted = true;
+            card->authSector = -1;
+            put(0x14);
+            return;
+        }
+        card->authSector = sector;
+        put(0x00);
+        return;
+    }
+
+    if ((op == 0x30 || op == 0xA0) && card->authSector != SimCard::sectorOf(block))
+    {
+        card->halted = true;
+        put(0x14);
+        return;
+    }
+
+    if (op == 0x30)
+    {
+        put(0x00);
+        put(card->blocks[block], 16);
+    }
+    else if (op == 0xA0 && length >= 18)
+    {
+        memcpy(card->blocks[block], request + 2, 16);
+        put(0x00);
+    }
+    else
+    {
+        put(0x27); // Wrong context
+    }
+}
+
+void SimPN532::ntagExchange(SimCard *card, const uint8_t *request, int length)
+{
+    uint8_t op = request[0];
+    uint8_t page = request[1];
+
+    auto isProtected = [card](int p) { return p >= card->protectFrom && !card->passwordOk; };
+    auto nak = [this, card]() {
+        card->halted = true;
+        card->passwordOk = false;
+        put(0x01);
+    };
+
+    switch (op)
+    {
+    case 0x60: // GET_VERSION
+    {
+        if (!card->storage)
+        {
+            nak();
+            return;
+        }
+        const uint8_t version[] = {0x00, 0x04, 0x04, 0x02, 0x01, 0x00, card->storage, 0x03};
+        put(0x00);
+        put(version, sizeof(version));
+        return;
+    }
+
+    case 0x30: // READ, four pages
+        if (isProtected(page))
+        {
+            nak();
+            return;
+        }
+        put(0x00);
+        for (int i = 0; i < 4; i++)
+        {
+            put(card->pages[(page + i) & 0xFF], 4);
+        }
+        return;
+
+    case 0x3A: // FAST_READ
+    {
+        int last = request[2];
+        if (last - page + 1 > 60)
+        {
+            nak();
+            return;
+        }
+        for (int p = page; p <= last; p++)
+        {
+            if (isProtected(p))
+            {
+                nak();
+                return;
+            }
+        }
+        put(0x00);
+        for (int p = page; p <= last; p++)
+        {
+            put(card->pages[p], 4);
+        }
+        return;
+    }
+
+    case 0xA2: // WRITE
+        if (isProtected(page) || length < 6)
+        {
+            nak();
+            return;
+        }
+        memcpy(card->pages[page], request + 2, 4);
+        put(0x00);
+        return;
+
+    case 0x1B: // PWD_AUTH, answered with the PACK
+        if (memcmp(request + 1, card->password, 4) != 0)
+        {
+            nak();
+            return;
+        }
+        card->passwordOk = true;
+        put(0x00);
+        put(0x80);
+        put(0x80);
+        return;
+
+    default:
+        nak();
+        return;
+    }
+}
+
+static std::map<uint8_t, SimPN532 *> sims;
+
+SimPN532 *simForPin(uint8_t ssPin)
+{
+    auto found = sims.find(ssPin);
+    return found == sims.end() ? nullptr : found->second;
+}
+
+void simAttach(uint8_t ssPin, SimPN532 *sim)
+{
+    sims[ssPin] = sim;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <Arduino.h>
+#include "FrameTrace.h"
+#include <random>
+#include <vector>
+
+// One simulated tag: MIFARE Classic blocks with sector trailers, or NTAG21x pages with an optional password
+struct SimCard
+{
+    uint8_t uid[10];
+    uint8_t uidLength;
+    uint16_t atqa;
+    uint8_t sak;
+
+    // MIFARE Classic
+    uint8_t blocks[256][16];
+    int blockCount;
+    int authSector;
+
+    // NTAG21x
+    bool ntag;
+    uint8_t storage; // GET_VERSION storage size byte
+    int userPages;
+    uint8_t pages[256][4];
+    uint8_t password[4];
+    int protectFrom; // First page behind the password, 255 for none
+    bool passwordOk;
+
+    // Selection state: halted until the next selection, hlt until the field is reset
+    bool halted;
+    bool hlt;
+
+    // Classic card in transport configuration, sak 0x08 (1K), 0x18 (4K) or 0x09 (Mini)
+    explicit SimCard(uint8_t sak = 0x08);
+
+    // Turns the card into an NTAG21x with the given storage byte (0x0F 213, 0x11 215, 0x13 216)
+    void makeNtag(uint8_t storageSize);
+    // Key B of every sector becomes its 6 bytes of key, like ENROLL leaves it.
+    // NTAG password becomes the first 4 bytes with every user page protected.
+    void enroll(const uint8_t *key);
+
+    int sectors() const;
+    static int sectorOf(int block);
+    static int trailerOf(int sector);
+};
+
+// PN532 command interpreter working on the cards currently in its field
+class SimPN532
+{
+public:
+    std::vector<SimCard *> field;
+    long frames;
+    // Share of tag exchanges lost, as for a tag at the edge of the field; the tag falls back to idle
+    int lossPercent;
+
+    SimPN532();
+    virtual ~SimPN532() {}
+
+    // Handles one command frame (command code first, no TFI) and prepares its response
+    virtual void handle(const uint8_t *command, int length);
+    const uint8_t *response() const { return responseData; }
+    int responseLength() const { return responseSize; }
+
+    // How the last exchange ends at the transport, always OK for the model
+    TraceResult result() const { return exchangeResult; }
+    // Time the last exchange took, -1 to charge the modelled frame cost
+    int32_t durationUs() const { return exchangeUs; }
+
+protected:
+    uint8_t responseData[300];
+    int responseSize;
+    TraceResult exchangeResult;
+    int32_t exchangeUs;
+
+private:
+    SimCard *targets[3]; // Indexed by Tg, 1 and 2
+    std::mt19937 lossRandom;
+
+    void listPassiveTargets(const uint8_t *command, int length);
+    void dataExchange(const uint8_t *command, int length);
+    void classicExchange(SimCard *card, const uint8_t *request, int length);
+    void ntagExchange(SimCard *card, const uint8_t *request, int length);
+    void put(uint8_t value) { responseData[responseSize++] = value; }
+    void put(const uint8_t *data, int length);
+};
+
+// Simulator behind the PN532 with the given chip-select pin, the host transport talks to it
+SimPN532 *simForPin(uint8_t ssPin);
+void simAttach(uint8_t ssPin, SimPN532 *sim);
+
+// Simulated time charged per frame exchange: fixed turnaround plus per byte on the wire
+void simSetFrameCost(uint32_t frameUs, uint32_t byteUs);
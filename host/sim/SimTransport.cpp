@@ -0,0 +1,65 @@
+#include "PN532SpiTransport.h"
+#include "SimPN532.h"
+
+// Host build of the SPI transport: frames go straight to the simulator of the same chip-select
+// pin and the virtual clock is charged for the exchange instead of polling the ready bit.
+// A replayed exchange is charged its captured duration and ends the way it did on the device.
+
+static uint32_t frameCostUs = 0;
+static uint32_t byteCostUs = 0;
+
+void simSetFrameCost(uint32_t frameUs, uint32_t byteUs)
+{
+    frameCostUs = frameUs;
+    byteCostUs = byteUs;
+}
+
+PN532SpiTransport::PN532SpiTransport(uint8_t ssPin, SPIClass *spi)
+{
+    this->ssPin = ssPin;
+    this->spi = spi;
+}
+
+void PN532SpiTransport::begin() {}
+
+void PN532SpiTransport::wakeup() {}
+
+bool PN532SpiTransport::sendCommand(const uint8_t *command, uint8_t commandLength)
+{
+    SimPN532 *sim = simForPin(ssPin);
+    if (!sim)
+    {
+        return false;
+    }
+
+    sim->handle(command, commandLength);
+    if (sim->result() == TraceResult::TIMEOUT)
+    {
+        // waitReady() runs into its timeout, that is the time charged
+        return true;
+    }
+    hostAdvanceClock(sim->durationUs() >= 0 ? sim->durationUs() : frameCostUs + (commandLength + sim->responseLength()) * byteCostUs);
+    return sim->result() != TraceResult::NO_ACK;
+}
+
+bool PN532SpiTransport::isReady()
+{
+    SimPN532 *sim = simForPin(ssPin);
+    return sim && sim->result() != TraceResult::TIMEOUT;
+}
+
+bool PN532SpiTransport::readResponse(uint8_t *response, uint8_t *responseLength)
+{
+    SimPN532 *sim = simForPin(ssPin);
+    if (!sim || sim->result() != TraceResult::OK || sim->responseLength() > *responseLength)
+    {
+        *responseLength = 0;
+        return false;
+    }
+
+    memcpy(response, sim->response(), sim->responseLength());
+    *responseLength = sim->responseLength();
+    return true;
+}
+
+void PN532SpiTransport::abort() {}
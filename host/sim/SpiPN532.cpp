@@ -0,0 +1,104 @@
+#include "SpiPN532.h"
+#include <algorithm>
+
+#define SPI_DATAWRITE 0x01
+#define SPI_STATREAD 0x02
+#define SPI_DATAREAD 0x03
+
+static const uint8_t ACK_FRAME[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+
+void SpiPN532::select()
+{
+    operation = -1;
+    input.clear();
+    readPosition = 0;
+}
+
+uint8_t SpiPN532::transfer(uint8_t value)
+{
+    if (operation < 0)
+    {
+        operation = value;
+        return 0;
+    }
+    switch (operation)
+    {
+    case SPI_DATAWRITE:
+        input.push_back(value);
+        return 0;
+    case SPI_STATREAD:
+        return output.empty() ? 0x00 : 0x01;
+    case SPI_DATAREAD:
+        if (output.empty() || readPosition >= output.front().size())
+        {
+            return 0x00;
+        }
+        return output.front()[readPosition++];
+    default:
+        return 0x00;
+    }
+}
+
+void SpiPN532::deselect()
+{
+    if (operation == SPI_DATAWRITE)
+    {
+        receive();
+    }
+    else if (operation == SPI_DATAREAD && readPosition > 0 && !output.empty())
+    {
+        // A frame is gone once it has been read, whether the host clocked out all of it or not
+        output.pop_front();
+    }
+    operation = -1;
+}
+
+void SpiPN532::receive()
+{
+    if (input.size() == sizeof(ACK_FRAME) && std::equal(input.begin(), input.end(), ACK_FRAME))
+    {
+        aborts++;
+        output.clear();
+        return;
+    }
+
+    // 00 00 FF LEN LCS D4 <command> DCS 00
+    if (input.size() < 8 || input[0] != 0x00 || input[1] != 0x00 || input[2] != 0xFF)
+    {
+        framesRejected++;
+        return;
+    }
+    uint8_t length = input[3];
+    uint8_t checksum = 0;
+    for (size_t i = 5; i < 5 + (size_t)length + 1 && i < input.size(); i++)
+    {
+        checksum += input[i];
+    }
+    if ((uint8_t)(length + input[4]) != 0 || length < 2 || input.size() != (size_t)length + 7 || input[5] != 0xD4 ||
+        checksum != 0)
+    {
+        framesRejected++;
+        return;
+    }
+    framesReceived++;
+
+    sim->handle(input.data() + 6, length - 1);
+    output.clear();
+    output.emplace_back(ACK_FRAME, ACK_FRAME + sizeof(ACK_FRAME));
+
+    // 00 00 FF LEN LCS D5 <response> DCS 00
+    std::vector<uint8_t> frame = {0x00, 0x00, 0xFF};
+    uint8_t responseLength = (uint8_t)(sim->responseLength() + 1);
+    frame.push_back(responseLength);
+    frame.push_back((uint8_t)(~responseLength + 1));
+    frame.push_back(0xD5);
+    checksum = 0xD5;
+    for (int i = 0; i < sim->responseLength(); i++)
+    {
+        frame.push_back(sim->response()[i]);
+        checksum += sim->response()[i];
+    }
+    frame.push_back((uint8_t)(~checksum + 1));
+    frame.push_back(0x00);
+    output.push_back(frame);
+}
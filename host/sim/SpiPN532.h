@@ -0,0 +1,32 @@
+#pragma once
+#include "SimPN532.h"
+#include <SPI.h>
+#include <deque>
+#include <vector>
+
+// The PN532 SPI frame layer in front of a simulated PN532, so the device transport
+// (PN532SpiTransport) can run on the host: status reads, ACK frames, information frames with
+// their length and data checksums, and an ACK from the host aborting the pending response.
+// A command frame that fails its checksums is dropped without an ACK, as the chip does.
+class SpiPN532 : public SpiDevice
+{
+public:
+    long framesReceived = 0; // Command frames that passed their checksums
+    long framesRejected = 0; // Command frames dropped for a bad preamble, length or checksum
+    long aborts = 0;         // ACK frames sent by the host
+
+    explicit SpiPN532(SimPN532 *sim) : sim(sim) {}
+
+    void select() override;
+    uint8_t transfer(uint8_t value) override;
+    void deselect() override;
+
+private:
+    SimPN532 *sim;
+    int operation = -1;          // SPI operation code of the current selection, -1 before it
+    std::vector<uint8_t> input;  // Bytes written in the current selection
+    size_t readPosition = 0;     // Bytes of the front frame read in the current selection
+    std::deque<std::vector<uint8_t>> output; // ACK and response frames waiting to be read
+
+    void receive();
+};
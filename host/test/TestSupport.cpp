@@ -0,0 +1,102 @@
+#include "TestSupport.h"
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <ftw.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int testFailures = 0;
+
+PtySim::PtySim(const std::string &binary, const std::string &link) : binary(binary), link(link)
+{
+    pid = -1;
+    output = -1;
+}
+
+PtySim::~PtySim()
+{
+    stop();
+}
+
+bool PtySim::start(int readers)
+{
+    stop();
+
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0)
+    {
+        return false;
+    }
+    pid = fork();
+    if (pid == 0)
+    {
+        dup2(pipeFds[1], STDOUT_FILENO);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        std::string count = std::to_string(readers);
+        execl(binary.c_str(), binary.c_str(), "--readers", count.c_str(), "--link", link.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    close(pipeFds[1]);
+    output = pipeFds[0];
+    if (pid < 0)
+    {
+        stop();
+        return false;
+    }
+
+    // The pty path is printed once the link is in place
+    char line[256];
+    size_t length = 0;
+    while (length < sizeof(line))
+    {
+        pollfd readable = {output, POLLIN, 0};
+        if (poll(&readable, 1, 5000) <= 0 || read(output, line + length, 1) != 1)
+        {
+            stop();
+            return false;
+        }
+        if (line[length++] == '\n')
+        {
+            return true;
+        }
+    }
+    stop();
+    return false;
+}
+
+void PtySim::stop()
+{
+    if (pid > 0)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+        pid = -1;
+    }
+    if (output >= 0)
+    {
+        close(output);
+        output = -1;
+    }
+}
+
+TempDir::TempDir()
+{
+    char pattern[] = "/tmp/rfid_test.XXXXXX";
+    path = mkdtemp(pattern) ? pattern : "/tmp";
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+TempDir::~TempDir()
+{
+    if (path != "/tmp")
+    {
+        nftw(path.c_str(), removeEntry, 8, FTW_DEPTH | FTW_PHYS);
+    }
+}
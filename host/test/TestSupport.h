@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <sys/types.h>
+
+// Shared pieces of the host tests. Each test is a plain executable run by ctest: it exits 0
+// if every CHECK held and 1 otherwise, printing each failed condition with its line.
+
+extern int testFailures;
+
+#define CHECK(condition)                                                                  \
+    do                                                                                    \
+    {                                                                                     \
+        if (!(condition))                                                                 \
+        {                                                                                 \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            testFailures++;                                                               \
+        }                                                                                 \
+    } while (0)
+
+// rfid_ptysim run as a child process, its pty reachable through a fixed symlink so it can be
+// stopped and started again under the same path, like a board that is unplugged and plugged in.
+class PtySim
+{
+public:
+    PtySim(const std::string &binary, const std::string &link);
+    ~PtySim();
+    PtySim(const PtySim &) = delete;
+    PtySim &operator=(const PtySim &) = delete;
+
+    // Waits until the simulator serves its pty, false if it did not start
+    bool start(int readers);
+    // Terminates the simulator, which hangs up the pty
+    void stop();
+    const std::string &path() const { return link; }
+
+private:
+    std::string binary;
+    std::string link;
+    pid_t pid;
+    int output; // The simulator's stdout, kept open while it runs
+};
+
+// Directory for sockets and links of one test run, removed with its contents by the destructor
+class TempDir
+{
+public:
+    TempDir();
+    ~TempDir();
+    std::string file(const std::string &name) const { return path + "/" + name; }
+
+private:
+    std::string path;
+};
@@ -0,0 +1,318 @@
+// ReaderClient against rfid_ptysim: pipelined commands on two readers, rejections matched by
+// their echoed command, a line too long for the firmware, main loop replies overtaking queued
+// ones, and the Hex and Reply parsers. A scripted board on a bare pty drops a reply, which has
+// to end in a resync instead of shifting later replies.
+//
+//   client_test RFID_PTYSIM
+#include "ReaderClient.h"
+#include "TestSupport.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace rfid;
+
+static Bytes repeated(const char *pattern, size_t length)
+{
+    Bytes bytes(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        bytes[i] = (uint8_t)pattern[i % strlen(pattern)];
+    }
+    return bytes;
+}
+
+// READ returns the stored bytes zero padded to at least 512
+static bool holds(const Result<Bytes> &read, const Bytes &data)
+{
+    return read.ok && read.value.size() >= data.size() && std::equal(data.begin(), data.end(), read.value.begin()) &&
+           std::all_of(read.value.begin() + data.size(), read.value.end(), [](uint8_t b) { return b == 0; });
+}
+
+static void testHex()
+{
+    Bytes all(256);
+    for (int i = 0; i < 256; i++)
+    {
+        all[i] = (uint8_t)i;
+    }
+    std::string text = Hex::encode(all);
+    CHECK(text.size() == 512);
+    CHECK(text.compare(0, 8, "00010203") == 0);
+    CHECK(text.compare(504, 8, "FCFDFEFF") == 0);
+
+    Bytes decoded;
+    CHECK(Hex::decode(text, decoded) && decoded == all);
+    CHECK(Hex::decode("a1B2c3", decoded) && decoded == Bytes({0xA1, 0xB2, 0xC3}));
+    CHECK(!Hex::decode("A1B", decoded));
+    CHECK(!Hex::decode("A1G2", decoded));
+    CHECK(!Hex::decode("A1 2", decoded));
+
+    std::string appended = "DATA ";
+    Hex::append(appended, all.data(), 2);
+    CHECK(appended == "DATA 0001");
+}
+
+static void testReply()
+{
+    Reply reply;
+    CHECK(Reply::parse("@1 ERR INVALID_LENGTH - Key must be 192 (1K) or 480 (4K) characters (Command: '@1 READ 00')", reply));
+    CHECK(reply.reader == 1 && !reply.ok && reply.code == "INVALID_LENGTH");
+    CHECK(reply.description == "Key must be 192 (1K) or 480 (4K) characters");
+    CHECK(reply.rejection() && reply.echoes("@1 READ 00") && !reply.echoes("@1 READ 0"));
+
+    CHECK(Reply::parse("ERR NO_TAG - No RFID tag detected in range (SCAN_UID operation)", reply));
+    CHECK(reply.reader == -1 && reply.context == "SCAN_UID operation" && !reply.rejection());
+
+    CHECK(Reply::parse("@0 OK DATA 0102 VERIFIED", reply));
+    CHECK(reply.ok && reply.word(0) == "DATA" && reply.word(1) == "0102" && reply.word(3).empty());
+    CHECK(!Reply::parse("CAPTURE @0 END 1 0", reply));
+
+    CHECK(Reply::parse("@0 ERR INVALID_LENGTH - Too long (Command: '@0 WRITE 0102...')", reply));
+    CHECK(reply.echoes("@0 WRITE 01020304") && !reply.echoes("@0 WRITE 0102") && !reply.echoes("@0 WRITE 0103"));
+}
+
+static void testPipelining(ReaderClient &client)
+{
+    Bytes key = repeated("\xA1\xB2\xC3\xD4\xE5\xF6", 96);
+    Bytes first = repeated("first", 40);
+    Bytes second = repeated("second", 300);
+    Bytes third = repeated("third", 20);
+    Bytes other = repeated("reader one", 64);
+
+    // Blank cards, WRITE needs the sectors keyed first
+    std::future<Result<EnrollInfo>> enroll0 = client.enroll(key, 0);
+    std::future<Result<EnrollInfo>> enroll1 = client.enroll(key, 1);
+    Result<EnrollInfo> enrolled = enroll0.get();
+    CHECK(enrolled.ok && enrolled.value.enrolled == 0xFFFF && enrolled.value.skipped == 0);
+    CHECK(enroll1.get().ok);
+
+    // Six commands on reader 0 are more than its firmware queue, the last ones wait in the client
+    std::future<Result<Done>> write1 = client.write(key, first, 0);
+    std::future<Result<Bytes>> read1 = client.read(key, 0);
+    std::future<Result<Done>> write2 = client.write(key, second, 0);
+    std::future<Result<Bytes>> read2 = client.read(key, 0);
+    std::future<Result<Done>> write3 = client.write(key, third, 0);
+    std::future<Result<Bytes>> read3 = client.read(key, 0);
+    std::future<Result<Done>> writeOther = client.write(key, other, 1);
+    std::future<Result<Bytes>> readOther = client.read(key, 1);
+
+    // Answered by the main loop while the readers are still busy
+    std::future<Result<std::string>> version = client.version();
+    CHECK(version.wait_for(std::chrono::seconds(2)) == std::future_status::ready);
+    Result<std::string> versionResult = version.get();
+    CHECK(versionResult.ok && versionResult.value == client.firmwareVersion());
+    CHECK(read3.wait_for(std::chrono::seconds(0)) != std::future_status::ready);
+
+    CHECK(write1.get().ok);
+    CHECK(holds(read1.get(), first));
+    CHECK(write2.get().ok);
+    CHECK(holds(read2.get(), second));
+    CHECK(write3.get().ok);
+    CHECK(holds(read3.get(), third));
+    CHECK(writeOther.get().ok);
+    CHECK(holds(readOther.get(), other));
+}
+
+static void testRejections(ReaderClient &client)
+{
+    Bytes key = repeated("\xA1\xB2\xC3\xD4\xE5\xF6", 96);
+    Bytes shortKey = repeated("\x01\x02", 10);
+
+    // The main loop rejects the short keys at once, ahead of the replies of the queued reads
+    std::future<Result<Bytes>> before = client.read(key, 0);
+    std::future<Result<Bytes>> rejected = client.read(shortKey, 0);
+    std::future<Result<Bytes>> otherReader = client.scanUid(1);
+    std::future<Result<Done>> rejectedWrite = client.write(shortKey, Bytes({1, 2, 3}), 1);
+    std::future<Result<Bytes>> after = client.read(key, 0);
+
+    Result<Bytes> rejectedResult = rejected.get();
+    CHECK(!rejectedResult.ok && rejectedResult.error.code == "INVALID_LENGTH");
+    CHECK(rejectedResult.error.context.compare(0, 16, "Command: '@0 REA") == 0);
+    Result<Done> rejectedWriteResult = rejectedWrite.get();
+    CHECK(!rejectedWriteResult.ok && rejectedWriteResult.error.code == "INVALID_LENGTH");
+    CHECK(rejectedWriteResult.error.context.compare(0, 16, "Command: '@1 WRI") == 0);
+
+    CHECK(before.get().ok);
+    Result<Bytes> uid = otherReader.get();
+    CHECK(uid.ok && uid.value.size() == 4 && uid.value[3] == 1);
+    CHECK(after.get().ok);
+}
+
+static void testLongLine(ReaderClient &client)
+{
+    // Past the firmware's line limit: one rejection for the whole line, the next command is unaffected
+    Bytes key = repeated("\xA1\xB2\xC3\xD4\xE5\xF6", 96);
+    std::future<Result<Done>> tooLong = client.write(key, Bytes(5000, 0x5A), 1);
+    std::future<Result<Bytes>> after = client.scanUid(1);
+
+    Result<Done> tooLongResult = tooLong.get();
+    CHECK(!tooLongResult.ok && tooLongResult.error.code == "INVALID_LENGTH");
+    Result<Bytes> uid = after.get();
+    CHECK(uid.ok && uid.value.size() == 4 && uid.value[3] == 1);
+}
+
+static void testClose(ReaderClient &client)
+{
+    Bytes key = repeated("\xA1\xB2\xC3\xD4\xE5\xF6", 96);
+    std::future<Result<Bytes>> pending = client.read(key, 0);
+    client.close();
+    Result<Bytes> result = pending.get();
+    CHECK(!result.ok && result.error.code == "CLOSED");
+
+    result = client.scanUid(0).get();
+    CHECK(!result.ok && result.error.code == "CLOSED");
+}
+
+// Board played by the test on the master side of a pty, the client opens the other side
+class ScriptedBoard
+{
+public:
+    ScriptedBoard()
+    {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master >= 0 && (grantpt(master) != 0 || unlockpt(master) != 0))
+        {
+            ::close(master);
+            master = -1;
+        }
+    }
+
+    ~ScriptedBoard()
+    {
+        if (master >= 0)
+        {
+            ::close(master);
+        }
+    }
+
+    std::string path() const { return master >= 0 ? ptsname(master) : ""; }
+
+    // Next line the client sent other than a repeated handshake probe, empty if none came in time
+    std::string command(int timeoutMs = 2000)
+    {
+        for (std::string line = this->line(timeoutMs); !line.empty(); line = this->line(timeoutMs))
+        {
+            if (line != "@0 VERSION")
+            {
+                return line;
+            }
+        }
+        return "";
+    }
+
+    // Waits for the handshake probe and answers it
+    bool handshake(int timeoutMs = 5000)
+    {
+        for (std::string line = this->line(timeoutMs); !line.empty(); line = this->line(timeoutMs))
+        {
+            if (line == "@0 VERSION")
+            {
+                reply("@0 OK VERSION 1.4.0");
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void reply(const std::string &line)
+    {
+        std::string output = line + "\n";
+        (void)!::write(master, output.data(), output.size());
+    }
+
+private:
+    int master;
+    std::string input;
+
+    std::string line(int timeoutMs)
+    {
+        size_t end;
+        while ((end = input.find('\n')) == std::string::npos)
+        {
+            pollfd readable = {master, POLLIN, 0};
+            char chunk[256];
+            ssize_t count;
+            if (poll(&readable, 1, timeoutMs) <= 0 || (count = ::read(master, chunk, sizeof(chunk))) <= 0)
+            {
+                return "";
+            }
+            input.append(chunk, count);
+        }
+        std::string line = input.substr(0, end);
+        input.erase(0, end + 1);
+        return line;
+    }
+};
+
+static void testDroppedReply()
+{
+    ScriptedBoard board;
+    CHECK(!board.path().empty());
+    ReaderClient client;
+    std::string error;
+    bool found = false;
+    std::thread answer([&board, &found]() { found = board.handshake(); });
+    CHECK(client.open(board.path(), error));
+    answer.join();
+    CHECK(found && client.pipelined());
+    client.setTimeout(300);
+
+    // The reply to the first SCAN_UID is lost on the link
+    std::future<Result<Bytes>> lost = client.scanUid(0);
+    CHECK(board.command() == "@0 SCAN_UID");
+    Result<Bytes> lostResult = lost.get();
+    CHECK(!lostResult.ok && lostResult.error.code == "TIMEOUT");
+
+    // Its place is kept for one more timeout, then whatever the reader has pending fails
+    // and the link is resynchronized
+    std::future<Result<Bytes>> pending = client.scanUid(0);
+    CHECK(board.command() == "@0 SCAN_UID");
+    Result<Bytes> pendingResult = pending.get();
+    CHECK(!pendingResult.ok && pendingResult.error.code == "TIMEOUT");
+    CHECK(board.handshake());
+
+    // Replies line up with their commands again
+    std::future<Result<Bytes>> after = client.scanUid(0);
+    CHECK(board.command() == "@0 SCAN_UID");
+    board.reply("@0 OK UID 0A0B0C0D");
+    Result<Bytes> afterResult = after.get();
+    CHECK(afterResult.ok && afterResult.value == Bytes({0x0A, 0x0B, 0x0C, 0x0D}));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: client_test RFID_PTYSIM\n");
+        return 2;
+    }
+
+    testHex();
+    testReply();
+    testDroppedReply();
+
+    TempDir dir;
+    PtySim board(argv[1], dir.file("tty"));
+    if (!board.start(2))
+    {
+        fprintf(stderr, "rfid_ptysim did not start\n");
+        return 1;
+    }
+
+    ReaderClient client;
+    std::string error;
+    CHECK(client.open(board.path(), error));
+    CHECK(client.pipelined());
+    CHECK(!client.firmwareVersion().empty());
+
+    testPipelining(client);
+    testRejections(client);
+    testLongLine(client);
+    testClose(client);
+
+    return testFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+// Daemon against two rfid_ptysim boards: replies in order per reader, BUSY past the waiting
+// limit, ARM refused, and CLOSED followed by a reopen when a board hangs up.
+//
+//   daemon_test RFID_PTYSIM
+#include "Daemon.h"
+#include "Hex.h"
+#include "TestSupport.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace rfid;
+
+static const std::string KEY = [] {
+    std::string key;
+    for (int i = 0; i < 16; i++)
+    {
+        key += "A1B2C3D4E5F6";
+    }
+    return key;
+}();
+
+// One application connection to the daemon socket
+class Connection
+{
+public:
+    explicit Connection(const std::string &path)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        snprintf(address.sun_path, sizeof(address.sun_path), "%s", path.c_str());
+        if (connect(fd, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    ~Connection()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    bool connected() const { return fd >= 0; }
+
+    void send(const std::string &lines)
+    {
+        size_t sent = 0;
+        while (sent < lines.size())
+        {
+            ssize_t written = ::send(fd, lines.data() + sent, lines.size() - sent, MSG_NOSIGNAL);
+            if (written <= 0)
+            {
+                return;
+            }
+            sent += written;
+        }
+    }
+
+    // Next reply line, empty if none arrived in time
+    std::string line(int timeoutMs = 10000)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        size_t end;
+        while ((end = input.find('\n')) == std::string::npos)
+        {
+            int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            pollfd readable = {fd, POLLIN, 0};
+            char chunk[4096];
+            ssize_t count;
+            if (left <= 0 || poll(&readable, 1, left) <= 0 || (count = read(fd, chunk, sizeof(chunk))) <= 0)
+            {
+                return "";
+            }
+            input.append(chunk, count);
+        }
+        std::string reply = input.substr(0, end);
+        input.erase(0, end + 1);
+        return reply;
+    }
+
+    std::vector<std::string> lines(size_t count)
+    {
+        std::vector<std::string> replies;
+        for (size_t i = 0; i < count; i++)
+        {
+            replies.push_back(line());
+        }
+        return replies;
+    }
+
+private:
+    int fd;
+    std::string input;
+};
+
+static bool startsWith(const std::string &text, const std::string &prefix)
+{
+    return text.compare(0, prefix.size(), prefix) == 0;
+}
+
+// State of a device as LIST reports it
+static std::string deviceState(Connection &connection, const std::string &name)
+{
+    connection.send("LIST\n");
+    std::string state;
+    for (std::string reply = connection.line(); startsWith(reply, "OK DEVICE "); reply = connection.line())
+    {
+        char device[64], path[256], deviceState[16];
+        if (sscanf(reply.c_str(), "OK DEVICE %63s %255s %15s", device, path, deviceState) == 3 && name == device)
+        {
+            state = deviceState;
+        }
+    }
+    return state;
+}
+
+static bool waitReady(Connection &connection, const std::string &name, int timeoutMs)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        if (deviceState(connection, name) == "READY")
+        {
+            return true;
+        }
+        usleep(100000);
+    }
+    return false;
+}
+
+static std::string payload(const std::string &device, int reader, int round)
+{
+    std::string text = device + " reader " + std::to_string(reader) + " round " + std::to_string(round);
+    return Hex::encode(Bytes(text.begin(), text.end()));
+}
+
+static void testOrder(Connection &connection)
+{
+    // Every reader gets ENROLL then WRITE/READ pairs, all sent at once and interleaved across
+    // readers, so the firmware queues fill and the daemon holds the rest
+    const char *devices[] = {"a", "b"};
+    const int rounds = 3;
+    std::string lines;
+    std::map<std::string, std::vector<std::string>> expected;
+    for (int round = -1; round < rounds; round++)
+    {
+        for (const char *device : devices)
+        {
+            for (int reader = 0; reader < 2; reader++)
+            {
+                std::string address = std::string(device) + " @" + std::to_string(reader);
+                std::vector<std::string> &replies = expected[address];
+                if (round < 0)
+                {
+                    lines += address + " ENROLL " + KEY + "\n";
+                    replies.push_back(address + " OK ENROLL_DONE");
+                    continue;
+                }
+                std::string data = payload(device, reader, round);
+                lines += address + " WRITE " + KEY + " " + data + "\n";
+                lines += address + " READ " + KEY + "\n";
+                replies.push_back(address + " OK WRITE_DONE");
+                replies.push_back(address + " OK DATA " + data + "00");
+            }
+        }
+    }
+    connection.send(lines);
+
+    std::map<std::string, size_t> next;
+    for (size_t i = 0; i < 4 * (1 + 2 * rounds); i++)
+    {
+        std::string reply = connection.line();
+        std::string address = reply.substr(0, reply.find(' ', reply.find('@')));
+        auto found = expected.find(address);
+        CHECK(found != expected.end());
+        if (found == expected.end())
+        {
+            continue;
+        }
+        size_t index = next[address]++;
+        CHECK(index < found->second.size() && startsWith(reply, found->second[index]));
+    }
+}
+
+static void testBusy(Connection &connection)
+{
+    // 4 in the firmware queue and MAX_WAITING in the daemon, the rest is turned away at once
+    const size_t sent = 4 + Daemon::MAX_WAITING + 3;
+    std::string lines;
+    for (size_t i = 0; i < sent; i++)
+    {
+        lines += "a @0 SCAN_UID\n";
+    }
+    connection.send(lines);
+
+    size_t busy = 0;
+    size_t served = 0;
+    for (const std::string &reply : connection.lines(sent))
+    {
+        if (startsWith(reply, "a @0 ERR BUSY"))
+        {
+            // Only ahead of the served ones, they are answered without waiting for the reader
+            CHECK(served == 0);
+            busy++;
+        }
+        else if (startsWith(reply, "a @0 OK UID "))
+        {
+            served++;
+        }
+    }
+    CHECK(busy == 3);
+    CHECK(served == sent - 3);
+}
+
+static void testArm(Connection &connection)
+{
+    // Refused by the daemon, the reader stays free for the commands queued behind
+    connection.send("a @1 ARM SCAN_UID COUNT 2\na @0 #04A1B200 disarm\na @1 SCAN_UID\n");
+    CHECK(startsWith(connection.line(), "a @1 ERR UNSUPPORTED - "));
+    CHECK(startsWith(connection.line(), "a @0 ERR UNSUPPORTED - "));
+    CHECK(startsWith(connection.line(), "a @1 OK UID 04A1B201"));
+    CHECK(connection.line(500).empty());
+}
+
+static void testHangup(Connection &connection, PtySim &board)
+{
+    connection.send("b @0 SCAN_UID\nb @0 SCAN_UID\nb @1 SCAN_UID\n");
+    usleep(30000);
+    board.stop();
+
+    // Whatever the board had not answered fails, nothing is left hanging
+    size_t closed = 0;
+    for (const std::string &reply : connection.lines(3))
+    {
+        CHECK(startsWith(reply, "b @0 ") || startsWith(reply, "b @1 "));
+        closed += reply.find(" ERR CLOSED ") != std::string::npos ? 1 : 0;
+    }
+    CHECK(closed >= 2);
+
+    CHECK(deviceState(connection, "b") == "CLOSED");
+    connection.send("b @0 SCAN_UID\n");
+    CHECK(startsWith(connection.line(), "b @0 ERR CLOSED"));
+
+    // The other board carries on
+    connection.send("a @1 SCAN_UID\n");
+    CHECK(startsWith(connection.line(), "a @1 OK UID "));
+
+    // Plugged in again under the same path, the daemon reopens and probes it by itself
+    CHECK(board.start(2));
+    CHECK(waitReady(connection, "b", 10000));
+    connection.send("b @1 SCAN_UID\n");
+    CHECK(startsWith(connection.line(), "b @1 OK UID 04A1B201"));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: daemon_test RFID_PTYSIM\n");
+        return 2;
+    }
+
+    TempDir dir;
+    PtySim boardA(argv[1], dir.file("a"));
+    PtySim boardB(argv[1], dir.file("b"));
+    if (!boardA.start(2) || !boardB.start(2))
+    {
+        fprintf(stderr, "rfid_ptysim did not start\n");
+        return 1;
+    }
+
+    Daemon daemon;
+    std::string error;
+    if (!daemon.addDevice("a", boardA.path(), error) || !daemon.addDevice("b", boardB.path(), error) ||
+        !daemon.listen(dir.file("rfidd.sock"), error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    std::thread loop([&daemon]() { daemon.run(); });
+
+    Connection connection(dir.file("rfidd.sock"));
+    CHECK(connection.connected());
+    CHECK(waitReady(connection, "a", 10000) && waitReady(connection, "b", 10000));
+
+    testOrder(connection);
+    testBusy(connection);
+    testArm(connection);
+    testHangup(connection, boardB);
+
+    daemon.stop();
+    loop.join();
+    return testFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+// CommandParser on the host build of the firmware: UID lengths accepted by WRITE_RESUME and by
+// the #<uid> prefix.
+//
+//   parser_test
+#include "CommandParser.h"
+#include "TestSupport.h"
+
+static String repeated(const char *pattern, unsigned int length)
+{
+    String text;
+    while (text.length() < length)
+    {
+        text += pattern;
+    }
+    return text.substring(0, length);
+}
+
+static ParsedCommand resume(const String &uid)
+{
+    return CommandParser::parse("WRITE_RESUME " + repeated("A1B2C3D4E5F6", 192) + " " + uid + " 12 " + repeated("00", 64));
+}
+
+static void testResumeUid()
+{
+    // 4, 7 and 10 byte UIDs, the lengths WRITE_FAIL can report
+    const char *valid[] = {"04A1B2C3", "04A1B2C3D4E5F6", "04A1B2C3D4E5F6A7B8C9"};
+    for (const char *uid : valid)
+    {
+        ParsedCommand command = resume(uid);
+        CHECK(command.error == ParseError::NONE && command.code == CommandCode::WRITE_RESUME);
+        CHECK(command.uid == uid && command.blockOffset == 12);
+    }
+
+    const char *invalid[] = {"04A1B2", "04A1B2C3D4", "04A1B2C3D4E5F6A7B8", "04A1B2C3D4E5F6A7B8C9D0"};
+    for (const char *uid : invalid)
+    {
+        CHECK(resume(uid).error == ParseError::INVALID_HEX_LENGTH);
+    }
+    CHECK(resume("04A1B2C3D4E5F6A7B8CG").error == ParseError::INVALID_HEX_FORMAT);
+}
+
+static void testTagPrefix()
+{
+    ParsedCommand command = CommandParser::parse("@1 #04A1B2C3D4E5F6A7B8C9 SCAN_UID");
+    CHECK(command.error == ParseError::NONE && command.reader == 1 && command.tag == "04A1B2C3D4E5F6A7B8C9");
+
+    command = CommandParser::parse("@1 #04A1B2C3D4 SCAN_UID");
+    CHECK(command.error == ParseError::INVALID_HEX_LENGTH && command.reader == 1);
+}
+
+int main()
+{
+    testResumeUid();
+    testTagPrefix();
+    return testFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,85 @@
+// The device SPI transport (src/PN532SpiTransport.cpp) against the PN532 SPI frame layer of
+// the simulator: SCAN_UID, WRITE and READ through RFIDController on a MIFARE Classic 1K
+// and an NTAG215, and an aborted command. The other host targets replace the transport with
+// the simulator's, so this is the only host run of its framing.
+//
+//   spi_test
+#include "PN532SpiTransport.h"
+#include "RFIDController.h"
+#include "SpiPN532.h"
+#include "TestSupport.h"
+
+static const uint8_t SS_PIN = 5;
+static const uint8_t RESET_PIN = 4;
+
+static String repeated(const char *pattern, unsigned int length)
+{
+    String text;
+    while (text.length() < length)
+    {
+        text += pattern;
+    }
+    return text.substring(0, length);
+}
+
+// READ answers with the stored bytes zero padded to at least 512
+static bool holds(const ReadResult &read, const String &data)
+{
+    return read.status == ReadStatus::DONE && read.data.startsWith(data) &&
+           read.data.substring(data.length()) == repeated("0", read.data.length() - data.length());
+}
+
+static void testCard(SimPN532 &sim, SimCard &card, const char *uid)
+{
+    RFIDController rfid;
+    rfid.begin(SS_PIN, RESET_PIN);
+    sim.field = {&card};
+    String key = repeated("A1B2C3D4E5F6", 192);
+    String data = repeated("0123456789ABCDEF", 600);
+
+    CHECK(rfid.scanUID() == uid);
+    // ENROLL is for MIFARE Classic, NTAG payloads are written without a password here
+    CHECK(rfid.enrollKey(key).status == (card.ntag ? EnrollStatus::UNSUPPORTED : EnrollStatus::DONE));
+    WriteResult written = rfid.writeData(key, data);
+    CHECK(written.status == WriteStatus::DONE && written.uid == uid);
+    CHECK(holds(rfid.readData(key), data));
+}
+
+static void testAbort(SpiPN532 &spi)
+{
+    PN532SpiTransport transport(SS_PIN);
+    transport.begin();
+
+    // GetFirmwareVersion, answered with an ACK and then its response
+    const uint8_t getFirmwareVersion[] = {0x02};
+    uint8_t response[16];
+    uint8_t responseLength = sizeof(response);
+    CHECK(transport.exchange(getFirmwareVersion, 1, response, &responseLength, 100));
+    CHECK(responseLength == 5 && response[0] == 0x03);
+
+    // The host's ACK frame drops the response that was waiting
+    long aborts = spi.aborts;
+    CHECK(transport.sendCommand(getFirmwareVersion, 1) && transport.isReady());
+    transport.abort();
+    CHECK(spi.aborts == aborts + 1 && !transport.isReady());
+}
+
+int main()
+{
+    SimPN532 sim;
+    SpiPN532 spi(&sim);
+    spiAttach(SS_PIN, &spi);
+
+    SimCard classic(0x08);
+    testCard(sim, classic, "04A1B2C3");
+
+    SimCard ntag(0x00);
+    ntag.makeNtag(0x11);
+    testCard(sim, ntag, "04112233445566");
+
+    testAbort(spi);
+
+    CHECK(spi.framesReceived > 100);
+    CHECK(spi.framesRejected == 0);
+    return testFailures > 0 ? 1 : 0;
+}
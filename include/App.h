@@ -1,7 +1,19 @@
 #pragma once
-#include "RFIDController.h"
+#include "ReaderWorker.h"
+#include "ReaderPins.h"
 #include "CommandParser.h"
 #include "Response.h"
+#include "Stats.h"
+#include "FrameTrace.h"
+#include "Capture.h"
+#include "Scheduler.h"
+
+// Longest command line kept, a full 4K WRITE is 7336 characters. A longer line is dropped up
+// to its newline and answered with a single INVALID_LENGTH error.
+#define SERIAL_LINE_MAX 8192
+
+// Characters of a dropped line echoed in its error, enough for the prefixes and command name
+#define SERIAL_LINE_ECHO 48
 
 class App
 {
@@ -11,7 +23,13 @@ public:
     void loop();
 
 private:
-    RFIDController rfid;
+    ReaderWorker readers[RFID_READER_COUNT];
+    String inputLine;
+    // The line being received outgrew SERIAL_LINE_MAX, the rest of it is dropped
+    bool inputOverflow;
 
+    void readSerial();
     void handleCommand(const String &cmd);
+    void rejectLongLine(const String &head);
+    void handleTrace(const String &action);
 };
@@ -0,0 +1,57 @@
+#pragma once
+#include <Arduino.h>
+
+// Key that authenticated a sector: which key slot (A/B) and which key material
+enum class AuthSlot : uint8_t
+{
+    UNKNOWN,
+    USER_KEY_B,    // Key B with the sector key from the command
+    USER_KEY_A,    // Key A with the sector key from the command
+    FACTORY_KEY_A, // Key A with FFFFFFFFFFFF
+    FACTORY_KEY_B  // Key B with FFFFFFFFFFFF
+};
+
+// Remembers, per tag UID and sector, which key slot last authenticated, so later
+// operations on the same tag try the known-good key first. Every failed MIFARE
+// authentication costs the attempt plus a re-select of the tag.
+class AuthCache
+{
+public:
+    static const uint8_t MAX_ENTRIES = 8;
+    static const uint8_t MAX_SECTORS = 40;
+
+    AuthCache();
+
+    // Slot that last worked for this sector of the tag, UNKNOWN if none is cached
+    AuthSlot lookup(const uint8_t *uid, uint8_t uidLength, uint8_t sector);
+    void remember(const uint8_t *uid, uint8_t uidLength, uint8_t sector, AuthSlot slot);
+    void clear();
+
+    // Counters reported by AUTH_CACHE
+    void recordFailedAttempt();
+    void recordAvoidedAttempts(uint8_t count);
+    uint8_t entryCount() const;
+    uint32_t hits() const;
+    uint32_t misses() const;
+    uint32_t failedAttempts() const;
+    uint32_t avoidedAttempts() const;
+
+private:
+    struct Entry
+    {
+        uint8_t uid[10];
+        uint8_t uidLength;
+        uint32_t lastUsed;
+        AuthSlot slots[MAX_SECTORS];
+    };
+
+    Entry entries[MAX_ENTRIES];
+    uint8_t used;
+    uint32_t useCounter;
+    uint32_t hitCount;
+    uint32_t missCount;
+    uint32_t failedCount;
+    uint32_t avoidedCount;
+
+    Entry *find(const uint8_t *uid, uint8_t uidLength);
+};
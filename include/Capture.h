@@ -0,0 +1,48 @@
+#pragma once
+#include <Arduino.h>
+#include "FrameTrace.h"
+#include "ReaderPins.h"
+
+// Capture text a reader may buffer for one command. Exchanges past it are left out and
+// the END line says TRUNCATED; a 4K READ with its retries stays well below.
+#ifndef CAPTURE_BUFFER_SIZE
+#define CAPTURE_BUFFER_SIZE 16384
+#endif
+
+// Session capture for offline replay (CAPTURE ON|OFF). While on, every command a reader
+// runs is logged with each PN532 exchange in full, its result and its duration, and a
+// CRC of the reply lines:
+//   CAPTURE @<reader> CMD <command line>
+//   CAPTURE @<reader> X <us> <result> <tx hex> <rx hex or ->
+//   CAPTURE @<reader> END <us> <reply crc32> [TRUNCATED]
+// An armed operation is recorded as ARM_TAG <op> together with the poll that found its tag.
+// Keys are left out: the key argument of the command line is recorded as zeros and the
+// key bytes of the frames as 00 (see FrameTrace::maskKeys). Payloads are recorded as they
+// are, a capture holds whatever the cards held.
+// The lines of a command are buffered and sent after its reply, so writing them does not
+// add UART time to the exchanges being measured. Off by default, exchanges only pay for the
+// isEnabled() check while it is off.
+class Capture
+{
+public:
+    static bool isEnabled() { return enabled; }
+    static void setEnabled(bool on);
+
+    // Bracket one command on a reader task; its lines go out from endCommand()
+    static void beginCommand(uint8_t reader, const String &line);
+    static void endCommand();
+    // Drops the command begun on this task without sending anything, for an armed reader's
+    // poll that found no new tag
+    static void cancelCommand();
+
+    // Called on the reader task for every PN532 exchange and every reply line
+    static void exchange(uint32_t durationUs, TraceResult result, const uint8_t *command, uint8_t commandLength,
+                         const uint8_t *response, uint8_t responseLength);
+    static void replyLine(const String &line);
+
+    // CRC-32 (IEEE 802.3) continued from crc, start with 0
+    static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+private:
+    static volatile bool enabled;
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <Arduino.h>
+
+enum class CardType
+{
+    UNKNOWN,
+    MIFARE_MINI,
+    MIFARE_CLASSIC_1K,
+    MIFARE_CLASSIC_4K,
+    MIFARE_ULTRALIGHT,
+    NTAG213,
+    NTAG215,
+    NTAG216
+};
+
+// One payload block: where it lives on the card and where it sits in the payload
+struct BlockSlot
+{
+    uint8_t block;
+    uint16_t offset;
+};
+
+// Maps the payload onto the data blocks of a MIFARE Classic card, or the user pages
+// of an NTAG21x / MIFARE Ultralight.
+//
+// Payload blocks are numbered in this order, so cards written by older firmware
+// (blocks 1 and 2 of sectors 0-15 only) keep their byte positions:
+//   1. blocks 1 and 2 of sectors 0-15
+//   2. block 0 of sectors 2-15 (block 0 of sector 0 is the manufacturer block,
+//      block 0 of sector 1 holds the payload metadata)
+//   3. every data block of sectors 16-39 (4K only)
+//
+// Page based tags keep the metadata in the first user page (page 4) and the payload
+// in the user pages that follow it.
+class CardLayout
+{
+public:
+    static const uint8_t METADATA_BLOCK = 4; // Sector 1, block 0
+    static const uint8_t METADATA_PAGE = 4;  // First user page of NTAG21x / Ultralight
+    static const uint8_t MAX_SECTORS = 40;
+    static const uint16_t MAX_DATA_BLOCKS = 214;
+    static const uint16_t MAX_CAPACITY = MAX_DATA_BLOCKS * 16;
+    static const uint8_t MAX_USER_PAGES = 222; // NTAG216
+
+    CardLayout();
+    CardLayout(CardType type);
+
+    static CardType detect(uint16_t atqa, uint8_t sak);
+    // Refines MIFARE_ULTRALIGHT using the 8-byte GET_VERSION response
+    static CardType detectFromVersion(const uint8_t *version);
+
+    CardType type() const;
+    String typeName() const;
+    uint8_t sectorCount() const;
+    uint8_t blocksInSector(uint8_t sector) const;
+    uint8_t firstBlock(uint8_t sector) const;
+    uint8_t trailerBlock(uint8_t sector) const;
+    uint8_t sectorOf(uint8_t block) const;
+    uint16_t dataBlockCount() const;
+    uint16_t capacity() const;
+
+    // NTAG21x / Ultralight: no sectors, 4-byte pages, no authentication per block
+    bool isPageBased() const;
+    bool supportsFastRead() const;
+    uint8_t userPageCount() const;
+
+    // Fills slots with the blocks holding the first payloadLength bytes, grouped by
+    // sector so each sector needs a single authentication. Returns the slot count.
+    uint16_t plan(uint16_t payloadLength, BlockSlot *slots) const;
+
+private:
+    CardType cardType;
+
+    // Payload block index of a block within a sector, or -1 if it carries no payload
+    int payloadIndex(uint8_t sector, uint8_t blockInSector) const;
+};
@@ -5,8 +5,20 @@ enum class CommandCode
 {
     SCAN_UID,
     READ,
+    DIGEST,
+    VERIFY,
     WRITE,
+    WRITE_RESUME,
     ENROLL,
+    PROVISION,
+    INFO,
+    INVENTORY,
+    AUTH_CACHE,
+    STATS,
+    TRACE,
+    CAPTURE,
+    ARM,
+    DISARM,
     VERSION,
     HELP,
     UNKNOWN
@@ -27,6 +39,13 @@ struct ParsedCommand
     CommandCode code;
     String arg1;
     String arg2;
+    String uid;
+    uint16_t blockOffset;
+    bool verify;
+    int8_t reader;      // Reader index from an @n prefix, -1 if the command had none
+    String tag;         // UID from a #<uid> prefix, empty if the command had none
+    uint32_t timeoutMs; // ARM: wait allowed per tag, 0 waits forever
+    uint16_t count;     // ARM: tags to serve
     ParseError error;
     String errorDetails;
     String originalCommand;
@@ -40,6 +59,11 @@ public:
     static String getAllCommandsHelp();
 
 private:
+    // Parses a command line with any reader prefix already removed, cmd is the full line for error reports
+    static ParsedCommand parseLine(const String &cmd, const String &line);
     static bool isValidHexString(const String &str, int expectedLength);
+    static bool isValidDecimalString(const String &str);
+    static bool isValidKeyLength(const String &key);
+    static bool isValidDataLength(const String &data);
     static ParsedCommand createErrorResult(const String &originalCmd, ParseError error, const String &details);
 };
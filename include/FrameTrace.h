@@ -0,0 +1,60 @@
+#pragma once
+#include <Arduino.h>
+
+// Number of exchanges kept, the oldest is overwritten once the ring is full
+#ifndef FRAME_TRACE_DEPTH
+#define FRAME_TRACE_DEPTH 32
+#endif
+
+// Bytes of each command and response frame kept per exchange, longer frames are cut
+#define FRAME_TRACE_BYTES 16
+
+// How a PN532 exchange ended at the transport
+enum class TraceResult : uint8_t
+{
+    OK,
+    NO_ACK,   // Command frame was not acknowledged
+    TIMEOUT,  // No response before the command timeout, the command was aborted
+    BAD_FRAME // Response failed its checksums or did not fit the buffer
+};
+
+// Ring of the last PN532 command/response exchanges of all readers, for TRACE DUMP.
+// Off by default, exchanges only pay for the isEnabled() check while it is off.
+class FrameTrace
+{
+public:
+    struct Entry
+    {
+        uint32_t timeUs;     // micros() when the command was sent
+        uint32_t durationUs; // Until the response was read or the exchange failed
+        uint8_t reader;
+        TraceResult result;
+        uint8_t commandLength;  // Full lengths, the bytes below may be cut
+        uint8_t responseLength;
+        uint8_t command[FRAME_TRACE_BYTES];
+        uint8_t response[FRAME_TRACE_BYTES];
+    };
+
+    static bool isEnabled() { return enabled; }
+    // Switching on starts from an empty ring
+    static void setEnabled(bool on);
+
+    // Keys in the command frame are recorded masked, see maskKeys
+    static void record(uint8_t reader, uint32_t timeUs, uint32_t durationUs, TraceResult result,
+                       const uint8_t *command, uint8_t commandLength, const uint8_t *response, uint8_t responseLength);
+
+    // Overwrites the secrets in the first length bytes of a PN532 command frame with 00: the key
+    // of a MIFARE authentication (60/61), Key A and Key B of a sector trailer write (A0) and the
+    // NTAG PWD_AUTH password (1B)
+    static void maskKeys(uint8_t *command, uint8_t length);
+
+    // Copies the recorded exchanges oldest first, returns how many were copied
+    static uint8_t snapshot(Entry *entries);
+    // "<timeUs> @<reader> <result> <durationUs>us TX <hex> RX <hex>", cut frames end in ".."
+    static String format(const Entry &entry);
+    // "OK", "NO_ACK", "TIMEOUT" or "BAD_FRAME"
+    static const char *resultName(TraceResult result);
+
+private:
+    static volatile bool enabled;
+};
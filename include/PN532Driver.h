@@ -0,0 +1,61 @@
+#pragma once
+#include <Arduino.h>
+#include "PN532Transport.h"
+
+#define MIFARE_KEY_A 0
+#define MIFARE_KEY_B 1
+
+// One ISO14443A target as reported by InListPassiveTarget
+struct TargetInfo
+{
+    uint8_t tg;        // Logical target number assigned by the PN532
+    uint16_t atqa;     // SENS_RES
+    uint8_t sak;       // SEL_RES
+    uint8_t uid[10];
+    uint8_t uidLength;
+};
+
+// PN532 command set used by the reader, built on a frame-level transport
+class PN532Driver
+{
+public:
+    PN532Driver(PN532Transport *transport);
+
+    bool begin();
+    uint32_t getFirmwareVersion();
+    bool setPassiveActivationRetries(uint8_t maxRetries);
+    // Switching the field off resets every tag in range to its idle state
+    bool setRfField(bool on);
+
+    // Lists up to maxTargets ISO14443A targets in the field, returns how many were found
+    uint8_t listPassiveTargets(TargetInfo *targets, uint8_t maxTargets);
+    // Selects the target with this UID directly, without resolving the other tags in the field
+    bool selectTarget(const uint8_t *uid, uint8_t uidLength, TargetInfo *target);
+    bool releaseTarget(uint8_t tg);
+
+    // MIFARE Classic, issued through InDataExchange to the given target
+    bool mifareAuthenticate(const TargetInfo &target, uint8_t block, uint8_t keyType, const uint8_t *key);
+    bool mifareReadBlock(const TargetInfo &target, uint8_t block, uint8_t *data);
+    bool mifareWriteBlock(const TargetInfo &target, uint8_t block, const uint8_t *data);
+
+    // NTAG21x / MIFARE Ultralight, pages are 4 bytes
+    bool ntagGetVersion(const TargetInfo &target, uint8_t *version);
+    bool ntagReadPages(const TargetInfo &target, uint8_t page, uint8_t *data);
+    bool ntagFastRead(const TargetInfo &target, uint8_t startPage, uint8_t endPage, uint8_t *data);
+    bool ntagWritePage(const TargetInfo &target, uint8_t page, const uint8_t *data);
+    bool ntagPasswordAuth(const TargetInfo &target, const uint8_t *password);
+
+    // The last data exchange failed because the tag rejected a MIFARE authentication,
+    // rather than through a radio or PN532 error
+    bool authRejected() const;
+
+private:
+    PN532Transport *transport;
+    uint8_t frame[PN532_FRAME_SIZE];
+    uint8_t exchangeStatus; // Error code of the last data exchange, 0xFF if the PN532 did not answer
+
+    // Runs one command; on success frame holds the response parameters and *length their count
+    bool command(const uint8_t *cmd, uint8_t cmdLength, uint8_t *length, uint16_t timeoutMs);
+    uint8_t listTargets(const uint8_t *cmd, uint8_t cmdLength, TargetInfo *targets, uint8_t maxTargets);
+    bool dataExchange(uint8_t tg, const uint8_t *data, uint8_t dataLength, uint8_t *length);
+};
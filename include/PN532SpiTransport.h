@@ -0,0 +1,26 @@
+#pragma once
+#include <Arduino.h>
+#include <SPI.h>
+#include "PN532Transport.h"
+
+// PN532 on a hardware SPI bus with a dedicated chip-select pin
+class PN532SpiTransport : public PN532Transport
+{
+public:
+    PN532SpiTransport(uint8_t ssPin, SPIClass *spi = &SPI);
+
+    void begin() override;
+    void wakeup() override;
+    bool sendCommand(const uint8_t *command, uint8_t commandLength) override;
+    bool isReady() override;
+    bool readResponse(uint8_t *response, uint8_t *responseLength) override;
+    void abort() override;
+
+private:
+    uint8_t ssPin;
+    SPIClass *spi;
+
+    void select();
+    void deselect();
+    bool readAck();
+};
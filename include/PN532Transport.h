@@ -0,0 +1,41 @@
+#pragma once
+#include <Arduino.h>
+#include "FrameTrace.h"
+#include "Capture.h"
+
+// Maximum payload of a normal PN532 information frame (LEN is a single byte)
+#define PN532_FRAME_SIZE 255
+
+// Frame-level link to one PN532. A command is the PN532 command code followed by its
+// parameters (without the TFI byte); a response starts with the command code + 1.
+class PN532Transport
+{
+public:
+    virtual ~PN532Transport() {}
+
+    virtual void begin() = 0;
+    virtual void wakeup() = 0;
+
+    // Sends one command frame and waits for the PN532 ACK frame
+    virtual bool sendCommand(const uint8_t *command, uint8_t commandLength) = 0;
+    // True once the response to the last command is ready to be read
+    virtual bool isReady() = 0;
+    // Reads the pending response frame. responseLength holds the buffer size on entry
+    // and the number of bytes received on return.
+    virtual bool readResponse(uint8_t *response, uint8_t *responseLength) = 0;
+    // Aborts the command currently being processed by the PN532
+    virtual void abort() = 0;
+
+    // Sends a command and blocks until its response arrives or timeoutMs elapses,
+    // and records it in the frame trace and the session capture while they are on
+    bool exchange(const uint8_t *command, uint8_t commandLength, uint8_t *response, uint8_t *responseLength, uint16_t timeoutMs);
+
+    // Reader index shown for this PN532 in TRACE DUMP
+    void setTraceId(uint8_t id) { traceId = id; }
+
+protected:
+    uint8_t traceId = 0;
+
+    bool waitReady(uint16_t timeoutMs);
+    TraceResult exchangeFrames(const uint8_t *command, uint8_t commandLength, uint8_t *response, uint8_t *responseLength, uint16_t timeoutMs);
+};
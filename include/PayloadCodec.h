@@ -0,0 +1,17 @@
+#pragma once
+#include <Arduino.h>
+
+// LZ4 block format codec for tag payloads. Payloads are at most a few KB, so the compressor
+// keeps a small hash table on the stack and does a single greedy pass; the output can be
+// decoded by any LZ4 block decoder.
+class PayloadCodec
+{
+public:
+    // Compresses length bytes into out. Returns the compressed length, or 0 if it would
+    // take more than capacity bytes.
+    static uint16_t compress(const uint8_t *in, uint16_t length, uint8_t *out, uint16_t capacity);
+
+    // Decodes a compressed payload that must expand to exactly outLength bytes.
+    // False for a corrupt stream, out is then undefined.
+    static bool decompress(const uint8_t *in, uint16_t length, uint8_t *out, uint16_t outLength);
+};
@@ -1,35 +1,222 @@
 #pragma once
 #include <Arduino.h>
-#include <Wire.h>
 #include <SPI.h>
-#include <Adafruit_PN532.h>
-#include <map>
+#include "PN532Driver.h"
+#include "CardLayout.h"
+#include "AuthCache.h"
 #include "Response.h"
 
+// Passive activation retries per poll while armed, a few tens of milliseconds without a tag
+#define ARM_POLL_RETRIES 0x10
+
+// Tags INVENTORY reports and remembers
+#define MAX_INVENTORY_TAGS 8
+
+// Retries of one MIFARE Classic authentication or block exchange after a radio error: the tag
+// is selected again (same UID only), the sector authenticated again and the exchange repeated
+#ifndef BLOCK_RETRY_LIMIT
+#define BLOCK_RETRY_LIMIT 2
+#endif
+
+// Retries one command may spend in total, bounds the time lost on a tag that has left the field
+#ifndef BLOCK_RETRY_BUDGET
+#define BLOCK_RETRY_BUDGET 8
+#endif
+
+// WRITE stores MIFARE Classic payloads LZ4 compressed when that takes fewer authentications
+// and block exchanges than storing them as they are; 0 always stores them as they are.
+// READ expands compressed payloads either way.
+#ifndef PAYLOAD_COMPRESSION
+#define PAYLOAD_COMPRESSION 1
+#endif
+
+// Times READ reads a sector again after it failed its checksum before reporting it corrupt
+#ifndef SECTOR_REREAD_LIMIT
+#define SECTOR_REREAD_LIMIT 2
+#endif
+
+enum class ReadStatus
+{
+    DONE,
+    FAILED,
+    UNREADABLE,
+    CORRUPT
+};
+
+enum class WriteStatus
+{
+    DONE,
+    NO_TAG,
+    UID_MISMATCH,
+    TOO_LARGE,
+    VERIFY_FAILED,
+    FAILED
+};
+
+enum class EnrollStatus
+{
+    DONE,
+    NO_TAG,
+    UNSUPPORTED,
+    FAILED
+};
+
+// Per-sector outcome of ENROLL, bit n stands for sector n
+struct EnrollResult
+{
+    EnrollStatus status;
+    String uid;
+    uint8_t sectors;   // Sectors covered by the key on this card
+    uint64_t enrolled; // Trailer written with the new keys
+    uint64_t skipped;  // Already opened with the target Key B, left untouched
+    uint64_t failed;   // Neither the target Key B nor the factory key authenticated, or the write failed
+};
+
+struct ReadResult
+{
+    ReadStatus status;
+    String uid;
+    String data;        // Payload (SHA-256 digest for readDigest) as hex, empty unless DONE
+    bool verified;      // Every sector matched the checksums stored with the payload
+    uint8_t sectors;    // Sectors of the card, 0 for NTAG / Ultralight
+    uint64_t corrupted; // Sectors still failing their checksum after the re-reads, bit n for sector n
+};
+
+struct WriteResult
+{
+    WriteStatus status;
+    String uid;             // UID of the tag that was written, empty if none was found
+    uint16_t blocksWritten; // Data blocks (pages on NTAG) acknowledged by the tag, counted in write order
+    uint16_t blocksTotal;   // Data blocks (pages on NTAG) the payload occupies
+};
+
+// Contents of the MIFARE Classic metadata block (block 4)
+struct PayloadMetadata
+{
+    uint16_t length;         // Payload bytes stored on the card
+    uint16_t originalLength; // Payload bytes once expanded, length if not compressed
+    bool compressed;
+    uint64_t sectorMap;      // Sectors holding non-zero payload bytes, bit n for sector n; all set on legacy cards
+    bool checksummed;        // A CRC-16 per sector follows the payload, starting on the next block
+    uint16_t tableCrc;       // CRC-16 of that checksum table
+};
+
+// Outcome of PROVISION, which enrolls and writes the card in one session
+struct ProvisionResult
+{
+    EnrollResult enroll;
+    WriteResult write;
+    bool verified; // Every written block was read back and matched
+};
+
 class RFIDController
 {
 public:
     RFIDController();
-    void begin();
+    void begin(uint8_t ssPin, uint8_t resetPin, uint8_t readerIndex = 0);
     String scanUID();
-    String readData(const String &key);
-    bool writeData(const String &key, const String &data);
-    bool enrollKey(const String &key);
-    String getVersion();
+    String cardInfo();
+    // Lists every tag in the field with its type, remembered so #<uid> commands skip detection
+    String inventory();
+    // Makes the following operations select the tag with this UID, "" for any tag
+    bool addressTag(const String &uid);
+    ReadResult readData(const String &key);
+    // SHA-256 of the bytes readData would return, so only the digest has to cross the serial link
+    ReadResult readDigest(const String &key);
+    WriteResult writeData(const String &key, const String &data);
+    WriteResult resumeWrite(const String &key, const String &uid, uint16_t fromBlock, const String &data);
+    EnrollResult enrollKey(const String &key);
+    ProvisionResult provision(const String &key, const String &data, bool verify);
+    static String getVersion();
+    // Armed mode keeps the PN532 initialized between operations and polls with short detection attempts
+    void setArmed(bool armed);
+    String pollTag();
+    String authCacheStats();
+    void clearAuthCache();
 
 private:
-    Adafruit_PN532 *nfc;
+    PN532Transport *transport;
+    PN532Driver *nfc;
     uint8_t ssPin;
     uint8_t resetPin;
     bool isNFCPowered;
+    bool holdPower;
+
+    // Tag selected by the current operation and the layout derived from its SAK/ATQA
+    TargetInfo target;
+    CardLayout layout;
+    bool pagesUnlocked;
+    // Cleared when the tag stops answering or a re-select finds it gone or replaced
+    bool tagSelected;
+    // Radio error retries left to the current operation
+    uint8_t retryBudget;
+
+    // Tags found by the last INVENTORY and the tag addressed by the current command
+    TargetInfo inventoryTags[MAX_INVENTORY_TAGS];
+    CardType inventoryTypes[MAX_INVENTORY_TAGS];
+    uint8_t inventoryCount;
+    uint8_t addressedUid[10];
+    uint8_t addressedUidLength;
+
+    // Which key opened each sector of recently seen tags
+    AuthCache authCache;
+
+    // Payload staging area, large enough for a MIFARE Classic 4K
+    uint8_t payload[CardLayout::MAX_CAPACITY];
+    // Compressed form of the payload while writing, expanded form while reading
+    uint8_t staging[CardLayout::MAX_CAPACITY];
 
     bool powerUpNFC();
     void powerDownNFC();
     bool initializeNFC();
-    String bytesToHex(uint8_t *data, uint16_t length);
-    void hexToBytes(const String &hex, uint8_t *bytes);
-    bool isDataAllZeros(const String &data);
-    uint16_t readPayloadLength(const String &key, uint8_t *uid, uint8_t uidLength);
-    bool writePayloadLength(const String &key, uint16_t length, uint8_t *uid, uint8_t uidLength);
+    bool detectTag();
+    bool selectOrListTag();
+    bool reselectTag();
+    CardType identifyTag(const TargetInfo &tag);
+    CardType inventoryType(const TargetInfo &tag);
+    // Authenticates the sector holding block, trying the given key slots with the cached one first
+    AuthSlot authenticateSector(uint8_t block, const uint8_t *sectorKey, const AuthSlot *slots, uint8_t slotCount);
+    // Takes one retry after a radio error and selects the tag again, false once the retries are used up
+    bool retryExchange(uint8_t &retries);
+    // After a failed block exchange: selects the tag and opens the sector of block again
+    bool recoverBlock(uint8_t block, const uint8_t *sectorKey, uint8_t &retries);
+    void buildSectorTrailer(uint8_t sector, const uint8_t *sectorKey, uint8_t *trailerData);
+    void buildMetadataBlock(const PayloadMetadata &metadata, uint8_t *blockData);
+    // Sectors of the planned payload blocks that hold a non-zero byte of data
+    uint64_t usedSectors(const uint8_t *data, const BlockSlot *slots, uint16_t slotCount);
+    // Replaces payload, slots and metadata with the compressed payload if that is cheaper to write
+    void compressPayload(PayloadMetadata &metadata, BlockSlot *slots, uint16_t &slotCount);
+    // Adds the sector checksum table after the payload and extends slots and metadata to it, if it fits
+    void appendChecksums(PayloadMetadata &metadata, BlockSlot *slots, uint16_t &slotCount);
+    // Payload and checksum table bytes on the card
+    uint16_t storedLength(const PayloadMetadata &metadata);
+    // Sectors whose payload blocks do not match the checksum table; the table's own sectors if it is damaged
+    uint64_t corruptedSectors(const PayloadMetadata &metadata, const BlockSlot *slots, uint16_t slotCount);
+    bool metadataIntact(const uint8_t *blockData);
+    bool writeVerifiedBlock(uint8_t block, const uint8_t *data, bool verify);
+    String bytesToHex(const uint8_t *data, uint16_t length);
+    uint16_t hexToBytes(const String &hex, uint8_t *bytes);
+    // FAILED if block 4 cannot be authenticated, UNREADABLE if it cannot be read, CORRUPT if it
+    // fails its own checksum even after reading it again or its flags come with lengths that do not
+    // fit the card. Only a block without flags, from earlier firmware, keeps the legacy 512-byte area.
+    ReadStatus readMetadata(const uint8_t *keyBytes, PayloadMetadata &metadata);
+    bool writeMetadata(const uint8_t *keyBytes, const PayloadMetadata &metadata);
     uint16_t calculatePayloadLength(const String &data);
+    WriteResult writeDataFrom(const String &key, const String &data, uint16_t fromBlock, const String &expectedUid);
+
+    // Leaves the replyLength bytes READ returns in the payload buffer
+    ReadResult readPayload(const String &key, uint16_t *replyLength);
+
+    // MIFARE Classic payload access, sector by sector with Key B
+    bool readBlocks(const uint8_t *keyBytes, uint8_t keySectors, uint16_t *replyLength, ReadResult &result);
+    // Reads the planned blocks of the sectors in sectorMap into the payload
+    bool readSectors(const uint8_t *keyBytes, uint8_t keySectors, const BlockSlot *slots, uint16_t slotCount, uint64_t sectorMap);
+    void writeBlocks(const uint8_t *keyBytes, uint8_t keySectors, uint16_t payloadLength, uint16_t fromBlock, WriteResult &result);
+
+    // NTAG21x / Ultralight payload access, FAST_READ bursts and changed-page writes
+    bool readPages(const uint8_t *keyBytes, uint16_t *replyLength);
+    void writePages(const uint8_t *keyBytes, uint16_t payloadLength, uint16_t fromBlock, WriteResult &result);
+    bool readPageRange(const uint8_t *keyBytes, uint8_t firstPage, uint8_t count, uint8_t *data);
+    bool writePage(const uint8_t *keyBytes, uint8_t page, const uint8_t *data);
+    bool unlockPages(const uint8_t *keyBytes);
 };
@@ -0,0 +1,21 @@
+#pragma once
+
+// Chip-select and RSTPDN pins of every PN532 on the shared SPI bus, reader @0 first.
+// Boards with several antennas override all three from build_flags, e.g.
+//   -DRFID_READER_COUNT=3 -DRFID_SS_PINS="{5, 16, 17}" -DRFID_RESET_PINS="{4, 21, 22}"
+// Every reader needs its own RSTPDN pin, powering one down must not reset the others.
+#ifndef RFID_READER_COUNT
+
+#ifdef ESP32C3_BOARD
+#define RFID_READER_COUNT 1
+#define RFID_SS_PINS {7}
+#define RFID_RESET_PINS {0}
+#endif
+
+#ifdef ESP32_BOARD
+#define RFID_READER_COUNT 1
+#define RFID_SS_PINS {5}
+#define RFID_RESET_PINS {4}
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+#include <Arduino.h>
+#include "RFIDController.h"
+#include "CommandParser.h"
+#include "Response.h"
+#include "Stats.h"
+#include "Capture.h"
+
+// UIDs remembered by an armed operation so a card left on the reader is not served twice
+#define ARM_SERVED_UIDS 32
+// UIDs whose armed operation failed, skipped until the field is found empty
+#define ARM_FAILED_UIDS 4
+// Commands waiting for a busy reader before further ones are refused with ERR BUSY
+#define READER_QUEUE_DEPTH 4
+#define READER_TASK_STACK 8192
+
+// One PN532 front-end: its controller, the task that runs its commands one after the
+// other, and the state of an armed operation
+class ReaderWorker
+{
+public:
+    ReaderWorker();
+    void begin(uint8_t index, uint8_t ssPin, uint8_t resetPin);
+
+    // Queues a parsed command for this reader, false if its queue is full
+    bool submit(const ParsedCommand &parsed);
+
+private:
+    RFIDController rfid;
+    uint8_t index;
+    QueueHandle_t queue;
+    char prefix[Response::PREFIX_SIZE];
+
+    // Operation armed by ARM, run on each new card until COUNT cards are served
+    bool armed;
+    bool armAddressed;
+    ParsedCommand armedCommand;
+    uint32_t armTimeoutMs;
+    uint32_t armWaitStart;
+    uint16_t armRemaining;
+    uint16_t armServed;
+    String servedUids[ARM_SERVED_UIDS];
+    uint16_t servedCount;
+    String failedUids[ARM_FAILED_UIDS];
+    uint8_t failedCount;
+
+    static void taskEntry(void *worker);
+    void run();
+
+    // Runs a parsed command and sends its reply, returns false if the operation failed
+    bool executeCommand(const ParsedCommand &parsed);
+    void arm(const ParsedCommand &parsed);
+    void disarm();
+    void serviceArmed();
+    bool isServed(const String &uid);
+    void markServed(const String &uid);
+    bool isFailed(const String &uid);
+    void markFailed(const String &uid);
+    // Sends reply, with VERIFIED if the checksums matched, or the error of a failed read
+    bool sendReadResult(const ReadResult &result, const String &operation, const String &reply);
+    bool sendWriteResult(const WriteResult &result, const String &operation);
+    bool sendEnrollResult(const EnrollResult &result, const String &operation);
+    bool sendProvisionResult(const ProvisionResult &result);
+    String sectorBitmap(uint64_t bits, uint8_t sectors);
+};
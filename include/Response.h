@@ -10,9 +10,23 @@ enum class ResponseStatus
 class Response
 {
 public:
+    // Creates the output lock, call once before any reader task starts
+    static void begin();
+    // Prefix put in front of every line sent from the calling task, "@1 " for replies to reader 1.
+    // Copied, up to PREFIX_SIZE - 1 characters
+    static void setLinePrefix(const char *prefix);
+    static const uint8_t PREFIX_SIZE = 16;
+
     static void sendOK(const String &message);
     static void sendError(const String &message);
     static void sendVerboseError(const String &errorCode, const String &description);
     static void sendVerboseError(const String &errorCode, const String &description, const String &context);
     static void send(const String &message, ResponseStatus status);
+    // Line as it is, without the task's prefix and not part of any reply (capture output)
+    static void sendRaw(const String &line);
+
+private:
+    // Whole lines only, so replies from different reader tasks never interleave
+    static void writeLine(const String &line);
+    static void writeLocked(const String &output);
 };
@@ -0,0 +1,32 @@
+#pragma once
+#include <Arduino.h>
+
+// Timers the main loop can run at once
+#define SCHEDULER_MAX_TIMERS 8
+// Longest the main loop sleeps without a timer or input to wake it
+#define SCHEDULER_IDLE_MS 1000
+
+typedef void (*TimerCallback)(void *context);
+
+// Cooperative executor of the main loop task. The loop sleeps in waitForEvent() until
+// serial input or another task calls wake(), or the next timer is due, so an idle board
+// leaves the CPU to the reader tasks and the idle task (light sleep when enabled).
+// Timer callbacks run on the loop task and must not block.
+class Scheduler
+{
+public:
+    // Binds the scheduler to the calling task, the one that will wait for events
+    static void begin();
+
+    // Returns the timer id, or -1 if all SCHEDULER_MAX_TIMERS are taken
+    static int8_t every(uint32_t periodMs, TimerCallback callback, void *context);
+    static int8_t after(uint32_t delayMs, TimerCallback callback, void *context);
+    static void cancel(int8_t id);
+
+    // Wakes the loop task, from other tasks and driver callbacks
+    static void wake();
+    // Blocks until wake() is called or a timer is due, at most SCHEDULER_IDLE_MS
+    static void waitForEvent();
+    // Runs the callbacks of every timer that is due
+    static void runDue();
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <Arduino.h>
+
+// Phases timed with micros() around the PN532 exchanges and the serial side
+enum class Phase : uint8_t
+{
+    COMMAND,     // Whole command, from dequeue to reply
+    POWER_UP,    // RSTPDN release, settle delay and PN532 initialization
+    DETECT,      // Target detection or selection
+    AUTH,        // One MIFARE authentication attempt
+    BLOCK_READ,  // One block read, or NTAG READ / FAST_READ burst
+    BLOCK_WRITE, // One block or page write
+    HEX_CODEC,   // Hex encoding or decoding of a payload
+    UART_TX,     // Handing one reply line to Serial
+    LOOP,        // One main loop pass: reading input, answering or queueing commands, timers
+    COUNT
+};
+
+// Latency histograms and counters reported by STATS. Recording takes a short critical
+// section and a few additions, cheap enough to stay enabled in production.
+class Stats
+{
+public:
+    // Bucket 0 holds durations under 64 us, bucket n covers [2^(n+5), 2^(n+6)) us, the last one everything from ~1 s
+    static const uint8_t BUCKETS = 16;
+    static const uint8_t MAX_ERROR_CODES = 12;
+
+    static void record(Phase phase, uint32_t micros);
+    static void recordCommand(bool success);
+    static void recordAuthRetry();
+    static void recordBlockRetry();
+    static void recordError(const String &errorCode);
+    static void reset();
+
+    // "OPS n FAILED n AUTH_RETRIES n BLOCK_RETRIES n ERRORS <code>=n,... <PHASE> N=n AVG=us MAX=us H=c0,c1,..." for every phase
+    static String report();
+};
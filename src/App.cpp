@@ -1,34 +1,186 @@
 #include "App.h"
 
-App::App() {}
+static const uint8_t READER_SS_PINS[] = RFID_SS_PINS;
+static const uint8_t READER_RESET_PINS[] = RFID_RESET_PINS;
+
+#ifdef RFID_STATUS_LED
+// Heartbeat: a short flash every period while the main loop is alive
+#define STATUS_LED_PERIOD_MS 1000
+#define STATUS_LED_FLASH_MS 30
+
+static void statusLedOff(void *)
+{
+    digitalWrite(RFID_STATUS_LED, LOW);
+}
+
+static void statusLedOn(void *)
+{
+    digitalWrite(RFID_STATUS_LED, HIGH);
+    Scheduler::after(STATUS_LED_FLASH_MS, statusLedOff, nullptr);
+}
+#endif
+
+#if ARDUINO_USB_CDC_ON_BOOT
+static void onSerialEvent(void *, esp_event_base_t, int32_t, void *)
+{
+    Scheduler::wake();
+}
+#endif
+
+#ifdef RFID_LIGHT_SLEEP
+#if ARDUINO_USB_CDC_ON_BOOT
+#error "RFID_LIGHT_SLEEP needs a UART console, light sleep drops the USB connection"
+#endif
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <driver/uart.h>
+
+// Lets the idle task enter light sleep whenever every task is blocked. The UART wakes the
+// chip on RX edges, the characters that do so are lost, so hosts send a bare newline first.
+static void enableLightSleep()
+{
+    uart_set_wakeup_threshold(UART_NUM_0, 3);
+    esp_sleep_enable_uart_wakeup(UART_NUM_0);
+
+    esp_pm_config_t config = {};
+    config.max_freq_mhz = getCpuFrequencyMhz();
+    config.min_freq_mhz = getXtalFrequencyMhz();
+    config.light_sleep_enable = true;
+    esp_pm_configure(&config);
+}
+#endif
+
+App::App()
+{
+    inputOverflow = false;
+}
 
 void App::setup()
 {
     // Serial configuration per API spec: 115200, 8N1, no flow control
-    Serial.setRxBufferSize(1024);
+    // Large enough for a full 4K WRITE line (480-char key + 6848-char data)
+    Serial.setRxBufferSize(8192);
     Serial.begin(115200);
     while (!Serial)
         delay(10);
 
-    rfid.begin();
+    Response::begin();
+
+    for (uint8_t i = 0; i < RFID_READER_COUNT; i++)
+    {
+        readers[i].begin(i, READER_SS_PINS[i], READER_RESET_PINS[i]);
+    }
+
+    // The loop sleeps between events, received bytes wake it
+    inputLine.reserve(SERIAL_LINE_MAX);
+    Scheduler::begin();
+#if ARDUINO_USB_CDC_ON_BOOT
+    Serial.onEvent(ARDUINO_HW_CDC_RX_EVENT, onSerialEvent);
+#else
+    Serial.onReceive(Scheduler::wake);
+#endif
+
+#ifdef RFID_STATUS_LED
+    pinMode(RFID_STATUS_LED, OUTPUT);
+    Scheduler::every(STATUS_LED_PERIOD_MS, statusLedOn, nullptr);
+#endif
+
+#ifdef RFID_LIGHT_SLEEP
+    enableLightSleep();
+#endif
 }
 
 void App::loop()
 {
-    // Handle Serial Commands
-    if (Serial.available() > 0)
+    // Sleeps until input arrives or a timer is due, tag operations run in the reader tasks
+    Scheduler::waitForEvent();
+
+    // Everything below must not block: the longest pass is the longest the board is deaf
+    uint32_t start = micros();
+    readSerial();
+    Scheduler::runDue();
+    Stats::record(Phase::LOOP, micros() - start);
+}
+
+void App::readSerial()
+{
+    // Takes whatever has arrived, a command runs once its newline is in
+    uint8_t chunk[256];
+    size_t count;
+    while (Serial.available() > 0 && (count = Serial.read(chunk, sizeof(chunk))) > 0)
+    {
+        size_t begin = 0;
+        while (begin < count)
+        {
+            const uint8_t *newline = (const uint8_t *)memchr(chunk + begin, '\n', count - begin);
+            size_t end = newline != nullptr ? newline - chunk : count;
+            size_t room = SERIAL_LINE_MAX - inputLine.length();
+            size_t take = end - begin < room ? end - begin : room;
+            inputLine.concat((const char *)chunk + begin, take);
+            if (take < end - begin)
+            {
+                // Over-long, everything up to the newline is dropped
+                inputOverflow = true;
+            }
+            begin = end;
+
+            if (begin == count)
+            {
+                break;
+            }
+            begin++; // The newline
+
+            String command = inputLine;
+            inputLine = "";
+            if (inputOverflow)
+            {
+                inputOverflow = false;
+                rejectLongLine(command.substring(0, SERIAL_LINE_ECHO));
+                continue;
+            }
+            command.trim();
+            if (command.length() == 0)
+            {
+                // Blank lines are ignored, a host can send one to wake a sleeping board
+                continue;
+            }
+            command.toUpperCase();
+            handleCommand(command);
+        }
+    }
+}
+
+void App::rejectLongLine(const String &head)
+{
+    // One reply for the whole line, addressed like the command and echoing its start so hosts
+    // can still match it
+    String echo = head;
+    echo.trim();
+    echo.toUpperCase();
+    ParsedCommand parsed = CommandParser::parse(echo);
+
+    char prefix[Response::PREFIX_SIZE] = "";
+    if (parsed.reader >= 0)
     {
-        String command = Serial.readStringUntil('\n');
-        command.trim();
-        command.toUpperCase();
-        handleCommand(command);
+        snprintf(prefix, sizeof(prefix), "@%d ", parsed.reader);
     }
+    Response::setLinePrefix(prefix);
+    Response::sendVerboseError("INVALID_LENGTH", "Command line is longer than " + String(SERIAL_LINE_MAX) + " characters and was dropped",
+                               "Command: '" + echo + "...'");
 }
 
 void App::handleCommand(const String &cmd)
 {
     ParsedCommand parsed = CommandParser::parse(cmd);
 
+    // Replies sent from here carry the reader prefix the command was addressed with
+    char prefix[Response::PREFIX_SIZE] = "";
+    if (parsed.reader >= 0)
+    {
+        snprintf(prefix, sizeof(prefix), "@%d ", parsed.reader);
+    }
+    Response::setLinePrefix(prefix);
+
     // Handle parsing errors first
     if (parsed.error != ParseError::NONE)
     {
@@ -59,73 +211,38 @@ void App::handleCommand(const String &cmd)
         return;
     }
 
-    // Handle valid commands
-    switch (parsed.code)
+    // Commands that do not touch a reader are answered right away
+    if (parsed.code == CommandCode::VERSION)
     {
-    case CommandCode::SCAN_UID:
-    {
-        String uid = rfid.scanUID();
-        if (uid.length() > 0)
-        {
-            Response::sendOK("UID " + uid);
-        }
-        else
-        {
-            Response::sendVerboseError("NO_TAG", "No RFID tag detected in range", "SCAN_UID operation");
-        }
-    }
-    break;
-
-    case CommandCode::READ:
-    {
-        String data = rfid.readData(parsed.arg1);
-        if (data.length() > 0)
-        {
-            Response::sendOK("DATA " + data);
-        }
-        else
-        {
-            Response::sendVerboseError("AUTH_FAILED", "Authentication failed or no tag present", "READ operation with provided key");
-        }
+        Response::sendOK("VERSION " + RFIDController::getVersion());
+        return;
     }
-    break;
 
-    case CommandCode::WRITE:
+    if (parsed.code == CommandCode::STATS)
     {
-        bool success = rfid.writeData(parsed.arg1, parsed.arg2);
-        if (success)
-        {
-            Response::sendOK("WRITE_DONE");
-        }
-        else
+        // Shared by all readers, so not queued behind any of them
+        if (parsed.arg1 == "RESET")
         {
-            Response::sendVerboseError("WRITE_FAIL", "Failed to write data to RFID tag", "WRITE operation - check tag presence and key validity");
+            Stats::reset();
         }
+        Response::sendOK("STATS " + Stats::report());
+        return;
     }
-    break;
 
-    case CommandCode::ENROLL:
+    if (parsed.code == CommandCode::TRACE)
     {
-        bool success = rfid.enrollKey(parsed.arg1);
-        if (success)
-        {
-            Response::sendOK("ENROLL_DONE");
-        }
-        else
-        {
-            Response::sendVerboseError("ENROLL_FAIL", "Failed to enroll keys to RFID tag", "ENROLL operation - check tag presence and authentication");
-        }
+        handleTrace(parsed.arg1);
+        return;
     }
-    break;
 
-    case CommandCode::VERSION:
+    if (parsed.code == CommandCode::CAPTURE)
     {
-        String version = rfid.getVersion();
-        Response::sendOK("VERSION " + version);
+        Capture::setEnabled(parsed.arg1 == "ON");
+        Response::sendOK(String("CAPTURE ") + (Capture::isEnabled() ? "ON" : "OFF"));
+        return;
     }
-    break;
 
-    case CommandCode::HELP:
+    if (parsed.code == CommandCode::HELP)
     {
         if (parsed.arg1.length() > 0)
         {
@@ -139,12 +256,38 @@ void App::handleCommand(const String &cmd)
             String helpText = CommandParser::getAllCommandsHelp();
             Response::sendOK("HELP " + helpText);
         }
+        return;
+    }
+
+    // Everything else runs on the addressed reader, @0 when no prefix was given
+    uint8_t reader = parsed.reader >= 0 ? parsed.reader : 0;
+    if (reader >= RFID_READER_COUNT)
+    {
+        Response::sendVerboseError("INVALID_READER", "No reader with that index", "Command: '" + parsed.originalCommand + "', readers @0-@" + String(RFID_READER_COUNT - 1));
+        return;
     }
-    break;
 
-    default:
-        // This should not happen with the new parser, but keep as fallback
-        Response::sendVerboseError("UNKNOWN_CMD", "Unrecognized command received", "Valid commands: SCAN_UID, READ, WRITE, VERSION, HELP");
-        break;
+    if (!readers[reader].submit(parsed))
+    {
+        Response::sendVerboseError("BUSY", "Reader command queue is full", "Command: '" + parsed.originalCommand + "', wait for pending replies");
+    }
+}
+
+void App::handleTrace(const String &action)
+{
+    if (action == "DUMP")
+    {
+        // Copied out first, so readers keep recording while the lines go out
+        FrameTrace::Entry entries[FRAME_TRACE_DEPTH];
+        uint8_t count = FrameTrace::snapshot(entries);
+        for (uint8_t i = 0; i < count; i++)
+        {
+            Response::sendOK("TRACE " + FrameTrace::format(entries[i]));
+        }
+        Response::sendOK("TRACE_DUMP COUNT " + String(count));
+        return;
     }
+
+    FrameTrace::setEnabled(action == "ON");
+    Response::sendOK(String("TRACE ") + (FrameTrace::isEnabled() ? "ON" : "OFF"));
 }
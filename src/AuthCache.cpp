@@ -0,0 +1,119 @@
+#include "AuthCache.h"
+
+AuthCache::AuthCache()
+{
+    clear();
+}
+
+void AuthCache::clear()
+{
+    used = 0;
+    useCounter = 0;
+    hitCount = 0;
+    missCount = 0;
+    failedCount = 0;
+    avoidedCount = 0;
+}
+
+AuthCache::Entry *AuthCache::find(const uint8_t *uid, uint8_t uidLength)
+{
+    for (uint8_t i = 0; i < used; i++)
+    {
+        if (entries[i].uidLength == uidLength && memcmp(entries[i].uid, uid, uidLength) == 0)
+        {
+            entries[i].lastUsed = ++useCounter;
+            return &entries[i];
+        }
+    }
+    return nullptr;
+}
+
+AuthSlot AuthCache::lookup(const uint8_t *uid, uint8_t uidLength, uint8_t sector)
+{
+    Entry *entry = find(uid, uidLength);
+    AuthSlot slot = entry && sector < MAX_SECTORS ? entry->slots[sector] : AuthSlot::UNKNOWN;
+
+    if (slot == AuthSlot::UNKNOWN)
+    {
+        missCount++;
+    }
+    else
+    {
+        hitCount++;
+    }
+    return slot;
+}
+
+void AuthCache::remember(const uint8_t *uid, uint8_t uidLength, uint8_t sector, AuthSlot slot)
+{
+    if (sector >= MAX_SECTORS || uidLength > sizeof(entries[0].uid))
+    {
+        return;
+    }
+
+    Entry *entry = find(uid, uidLength);
+    if (!entry)
+    {
+        // Take a free entry, or evict the least recently used tag
+        if (used < MAX_ENTRIES)
+        {
+            entry = &entries[used++];
+        }
+        else
+        {
+            entry = &entries[0];
+            for (uint8_t i = 1; i < MAX_ENTRIES; i++)
+            {
+                if (entries[i].lastUsed < entry->lastUsed)
+                {
+                    entry = &entries[i];
+                }
+            }
+        }
+
+        memcpy(entry->uid, uid, uidLength);
+        entry->uidLength = uidLength;
+        entry->lastUsed = ++useCounter;
+        for (uint8_t i = 0; i < MAX_SECTORS; i++)
+        {
+            entry->slots[i] = AuthSlot::UNKNOWN;
+        }
+    }
+
+    entry->slots[sector] = slot;
+}
+
+void AuthCache::recordFailedAttempt()
+{
+    failedCount++;
+}
+
+void AuthCache::recordAvoidedAttempts(uint8_t count)
+{
+    avoidedCount += count;
+}
+
+uint8_t AuthCache::entryCount() const
+{
+    return used;
+}
+
+uint32_t AuthCache::hits() const
+{
+    return hitCount;
+}
+
+uint32_t AuthCache::misses() const
+{
+    return missCount;
+}
+
+uint32_t AuthCache::failedAttempts() const
+{
+    return failedCount;
+}
+
+uint32_t AuthCache::avoidedAttempts() const
+{
+    return avoidedCount;
+}
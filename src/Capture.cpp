@@ -0,0 +1,181 @@
+#include "Capture.h"
+#include "Response.h"
+
+volatile bool Capture::enabled = false;
+
+// State of the command each reader is running, only touched by that reader's task
+struct CaptureState
+{
+    uint8_t reader;
+    uint32_t start;
+    uint32_t replyCrc;
+    bool truncated;
+    String lines;
+};
+
+static CaptureState states[RFID_READER_COUNT];
+// Reader whose command the calling task is capturing, -1 outside a captured command
+static thread_local int8_t activeReader = -1;
+
+void Capture::setEnabled(bool on)
+{
+    enabled = on;
+}
+
+uint32_t Capture::crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// The command line with its key zeroed: the argument after the command name (after ARM <op>
+// and ARM_TAG <op>), past any @n and #uid prefixes, if it has the length of a 1K or 4K key
+static String redactKey(const String &line)
+{
+    bool named = false;
+    int from = 0;
+    while (from < (int)line.length())
+    {
+        int end = line.indexOf(' ', from);
+        if (end < 0)
+        {
+            end = line.length();
+        }
+        if (end > from)
+        {
+            if (named)
+            {
+                int length = end - from;
+                if (length != 192 && length != 480)
+                {
+                    return line;
+                }
+                String zeros;
+                zeros.reserve(length);
+                for (int i = 0; i < length; i++)
+                {
+                    zeros += '0';
+                }
+                return line.substring(0, from) + zeros + line.substring(end);
+            }
+            String word = line.substring(from, end);
+            named = line[from] != '@' && line[from] != '#' && word != "ARM" && word != "ARM_TAG";
+        }
+        from = end + 1;
+    }
+    return line;
+}
+
+void Capture::beginCommand(uint8_t reader, const String &line)
+{
+    if (!enabled || reader >= RFID_READER_COUNT)
+    {
+        return;
+    }
+
+    CaptureState &state = states[reader];
+    state.reader = reader;
+    state.replyCrc = 0;
+    state.truncated = false;
+    state.lines = "";
+    state.lines.reserve(1024);
+    state.lines += "CAPTURE @" + String(reader) + " CMD " + redactKey(line) + "\n";
+    activeReader = reader;
+    state.start = micros();
+}
+
+static void appendHex(String &text, const uint8_t *data, uint8_t length)
+{
+    if (length == 0)
+    {
+        text += '-';
+        return;
+    }
+    for (uint8_t i = 0; i < length; i++)
+    {
+        text += "0123456789ABCDEF"[data[i] >> 4];
+        text += "0123456789ABCDEF"[data[i] & 0x0F];
+    }
+}
+
+void Capture::exchange(uint32_t durationUs, TraceResult result, const uint8_t *command, uint8_t commandLength,
+                       const uint8_t *response, uint8_t responseLength)
+{
+    if (activeReader < 0)
+    {
+        // Exchanges outside a command, e.g. an armed reader polling for tags
+        return;
+    }
+
+    CaptureState &state = states[activeReader];
+    if (state.lines.length() + 40 + (commandLength + responseLength) * 2 > CAPTURE_BUFFER_SIZE)
+    {
+        state.truncated = true;
+        return;
+    }
+    uint8_t masked[256];
+    memcpy(masked, command, commandLength);
+    FrameTrace::maskKeys(masked, commandLength);
+    state.lines += "CAPTURE @" + String(state.reader) + " X " + String(durationUs) + " " + FrameTrace::resultName(result) + " ";
+    appendHex(state.lines, masked, commandLength);
+    state.lines += ' ';
+    appendHex(state.lines, response, responseLength);
+    state.lines += '\n';
+}
+
+void Capture::replyLine(const String &line)
+{
+    if (activeReader < 0)
+    {
+        return;
+    }
+
+    // Over the line as the host receives it, without the reader prefix
+    CaptureState &state = states[activeReader];
+    state.replyCrc = crc32(state.replyCrc, (const uint8_t *)line.c_str(), line.length());
+    state.replyCrc = crc32(state.replyCrc, (const uint8_t *)"\n", 1);
+}
+
+void Capture::cancelCommand()
+{
+    if (activeReader < 0)
+    {
+        return;
+    }
+    states[activeReader].lines = "";
+    activeReader = -1;
+}
+
+void Capture::endCommand()
+{
+    if (activeReader < 0)
+    {
+        return;
+    }
+
+    CaptureState &state = states[activeReader];
+    uint32_t elapsed = micros() - state.start;
+    activeReader = -1;
+
+    char end[64];
+    snprintf(end, sizeof(end), "CAPTURE @%u END %lu %08lX%s", state.reader, (unsigned long)elapsed,
+             (unsigned long)state.replyCrc, state.truncated ? " TRUNCATED" : "");
+
+    int from = 0;
+    int newline;
+    while ((newline = state.lines.indexOf('\n', from)) >= 0)
+    {
+        Response::sendRaw(state.lines.substring(from, newline));
+        from = newline + 1;
+    }
+    Response::sendRaw(end);
+    state.lines = "";
+}
@@ -0,0 +1,238 @@
+#include "CardLayout.h"
+
+CardLayout::CardLayout()
+{
+    cardType = CardType::UNKNOWN;
+}
+
+CardLayout::CardLayout(CardType type)
+{
+    cardType = type;
+}
+
+CardType CardLayout::detect(uint16_t atqa, uint8_t sak)
+{
+    switch (sak)
+    {
+    case 0x09:
+        return CardType::MIFARE_MINI;
+    case 0x08:
+    case 0x28: // SmartMX with MIFARE Classic 1K emulation
+    case 0x88: // Infineon MIFARE Classic 1K
+        return CardType::MIFARE_CLASSIC_1K;
+    case 0x18:
+    case 0x38: // SmartMX with MIFARE Classic 4K emulation
+    case 0x98:
+        return CardType::MIFARE_CLASSIC_4K;
+    default:
+        break;
+    }
+
+    // Ultralight family (including NTAG21x) answers with SAK 0x00, GET_VERSION tells them apart
+    if (sak == 0x00 && atqa == 0x0044)
+    {
+        return CardType::MIFARE_ULTRALIGHT;
+    }
+
+    // Unlisted SAK with the MIFARE Classic bit set: ATQA 0x0002/0x0042 marks the 4K variant
+    if (sak & 0x08)
+    {
+        return (atqa & 0x0002) ? CardType::MIFARE_CLASSIC_4K : CardType::MIFARE_CLASSIC_1K;
+    }
+
+    return CardType::UNKNOWN;
+}
+
+CardType CardLayout::detectFromVersion(const uint8_t *version)
+{
+    // Vendor NXP, product type NTAG, storage size byte identifies the variant
+    if (version[1] == 0x04 && version[2] == 0x04)
+    {
+        switch (version[6])
+        {
+        case 0x0F:
+            return CardType::NTAG213;
+        case 0x11:
+            return CardType::NTAG215;
+        case 0x13:
+            return CardType::NTAG216;
+        default:
+            break;
+        }
+    }
+
+    // Ultralight EV1 and unknown variants fall back to the 48-byte Ultralight user area
+    return CardType::MIFARE_ULTRALIGHT;
+}
+
+CardType CardLayout::type() const
+{
+    return cardType;
+}
+
+String CardLayout::typeName() const
+{
+    switch (cardType)
+    {
+    case CardType::MIFARE_MINI:
+        return "MIFARE_MINI";
+    case CardType::MIFARE_CLASSIC_1K:
+        return "MIFARE_CLASSIC_1K";
+    case CardType::MIFARE_CLASSIC_4K:
+        return "MIFARE_CLASSIC_4K";
+    case CardType::MIFARE_ULTRALIGHT:
+        return "MIFARE_ULTRALIGHT";
+    case CardType::NTAG213:
+        return "NTAG213";
+    case CardType::NTAG215:
+        return "NTAG215";
+    case CardType::NTAG216:
+        return "NTAG216";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+uint8_t CardLayout::sectorCount() const
+{
+    switch (cardType)
+    {
+    case CardType::MIFARE_MINI:
+        return 5;
+    case CardType::MIFARE_CLASSIC_1K:
+        return 16;
+    case CardType::MIFARE_CLASSIC_4K:
+        return 40;
+    default:
+        return 0;
+    }
+}
+
+uint8_t CardLayout::blocksInSector(uint8_t sector) const
+{
+    // The upper 8 sectors of a 4K card are 16 blocks long
+    return sector < 32 ? 4 : 16;
+}
+
+uint8_t CardLayout::firstBlock(uint8_t sector) const
+{
+    return sector < 32 ? sector * 4 : 128 + (sector - 32) * 16;
+}
+
+uint8_t CardLayout::trailerBlock(uint8_t sector) const
+{
+    return firstBlock(sector) + blocksInSector(sector) - 1;
+}
+
+uint8_t CardLayout::sectorOf(uint8_t block) const
+{
+    return block < 128 ? block / 4 : 32 + (block - 128) / 16;
+}
+
+uint16_t CardLayout::dataBlockCount() const
+{
+    uint16_t count = 0;
+    for (uint8_t sector = 0; sector < sectorCount(); sector++)
+    {
+        for (uint8_t i = 0; i < blocksInSector(sector) - 1; i++)
+        {
+            if (payloadIndex(sector, i) >= 0)
+            {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+uint16_t CardLayout::capacity() const
+{
+    if (isPageBased())
+    {
+        // The first user page holds the metadata
+        return (userPageCount() - 1) * 4;
+    }
+    return dataBlockCount() * 16;
+}
+
+bool CardLayout::isPageBased() const
+{
+    return cardType == CardType::MIFARE_ULTRALIGHT || cardType == CardType::NTAG213 ||
+           cardType == CardType::NTAG215 || cardType == CardType::NTAG216;
+}
+
+bool CardLayout::supportsFastRead() const
+{
+    return cardType == CardType::NTAG213 || cardType == CardType::NTAG215 || cardType == CardType::NTAG216;
+}
+
+uint8_t CardLayout::userPageCount() const
+{
+    switch (cardType)
+    {
+    case CardType::MIFARE_ULTRALIGHT:
+        return 12;
+    case CardType::NTAG213:
+        return 36;
+    case CardType::NTAG215:
+        return 126;
+    case CardType::NTAG216:
+        return 222;
+    default:
+        return 0;
+    }
+}
+
+int CardLayout::payloadIndex(uint8_t sector, uint8_t blockInSector) const
+{
+    uint8_t sectors = sectorCount();
+    if (sector >= sectors || blockInSector >= blocksInSector(sector) - 1)
+    {
+        return -1;
+    }
+
+    // Sectors sharing the original 1K layout
+    uint8_t lowSectors = sectors < 16 ? sectors : 16;
+
+    if (sector < 16)
+    {
+        if (blockInSector > 0)
+        {
+            return sector * 2 + (blockInSector - 1);
+        }
+        if (sector < 2)
+        {
+            return -1; // Manufacturer block and metadata block
+        }
+        return lowSectors * 2 + (sector - 2);
+    }
+
+    int base = lowSectors * 2 + (lowSectors - 2);
+    if (sector < 32)
+    {
+        return base + (sector - 16) * 3 + blockInSector;
+    }
+    return base + 16 * 3 + (sector - 32) * 15 + blockInSector;
+}
+
+uint16_t CardLayout::plan(uint16_t payloadLength, BlockSlot *slots) const
+{
+    int blocksNeeded = (payloadLength + 15) / 16;
+    uint16_t count = 0;
+
+    for (uint8_t sector = 0; sector < sectorCount(); sector++)
+    {
+        for (uint8_t i = 0; i < blocksInSector(sector) - 1; i++)
+        {
+            int index = payloadIndex(sector, i);
+            if (index >= 0 && index < blocksNeeded)
+            {
+                slots[count].block = firstBlock(sector) + i;
+                slots[count].offset = index * 16;
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
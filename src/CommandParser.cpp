@@ -1,28 +1,92 @@
 #include "CommandParser.h"
 
 ParsedCommand CommandParser::parse(const String &cmd)
+{
+    String line = cmd;
+    int8_t reader = -1;
+    String tag = "";
+
+    // Optional "@n " prefix addressing one of several readers
+    if (line.startsWith("@"))
+    {
+        int prefixEnd = line.indexOf(' ');
+        String index = line.substring(1, prefixEnd == -1 ? line.length() : prefixEnd);
+        if (!isValidDecimalString(index) || index.length() > 2 || prefixEnd == -1)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "Reader prefix must be @ followed by the reader number and a command. Usage: @1 SCAN_UID");
+        }
+        reader = index.toInt();
+        line = line.substring(prefixEnd + 1);
+        line.trim();
+    }
+
+    // Optional "#<uid> " prefix addressing one tag from INVENTORY
+    if (line.startsWith("#"))
+    {
+        int prefixEnd = line.indexOf(' ');
+        tag = line.substring(1, prefixEnd == -1 ? line.length() : prefixEnd);
+        if (prefixEnd == -1 || (tag.length() != 8 && tag.length() != 14 && tag.length() != 20) || !isValidHexString(tag, tag.length()))
+        {
+            ParsedCommand result = createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
+                                                     "Tag prefix must be # followed by a 4, 7 or 10 byte hex UID and a command. Usage: #04A1B2C3 READ <key>");
+            result.reader = reader;
+            return result;
+        }
+        line = line.substring(prefixEnd + 1);
+        line.trim();
+    }
+
+    // Errors are reported with the reader prefix too, so the reader index is kept either way
+    ParsedCommand result = parseLine(cmd, line);
+    result.reader = reader;
+
+    if (tag.length() > 0 && result.error == ParseError::NONE)
+    {
+        if (result.code != CommandCode::SCAN_UID && result.code != CommandCode::READ && result.code != CommandCode::DIGEST &&
+            result.code != CommandCode::VERIFY && result.code != CommandCode::WRITE && result.code != CommandCode::WRITE_RESUME &&
+            result.code != CommandCode::ENROLL && result.code != CommandCode::PROVISION && result.code != CommandCode::INFO)
+        {
+            result = createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                       "Tag prefix only applies to SCAN_UID, READ, DIGEST, VERIFY, WRITE, WRITE_RESUME, ENROLL, PROVISION and INFO");
+            result.reader = reader;
+        }
+        result.tag = tag;
+    }
+
+    return result;
+}
+
+ParsedCommand CommandParser::parseLine(const String &cmd, const String &line)
 {
     ParsedCommand result;
     result.code = CommandCode::UNKNOWN;
     result.arg1 = "";
     result.arg2 = "";
+    result.uid = "";
+    result.blockOffset = 0;
+    result.verify = false;
+    result.timeoutMs = 0;
+    result.count = 1;
+    result.reader = -1;
+    result.tag = "";
     result.error = ParseError::NONE;
     result.errorDetails = "";
     result.originalCommand = cmd;
 
     // Split command into parts
-    int firstSpace = cmd.indexOf(' ');
+    int firstSpace = line.indexOf(' ');
     String command;
     String args = "";
 
     if (firstSpace == -1)
     {
-        command = cmd;
+        command = line;
     }
     else
     {
-        command = cmd.substring(0, firstSpace);
-        args = cmd.substring(firstSpace + 1);
+        command = line.substring(0, firstSpace);
+        args = line.substring(firstSpace + 1);
         args.trim();
     }
 
@@ -44,13 +108,13 @@ ParsedCommand CommandParser::parse(const String &cmd)
                                      "READ command requires a 192-character hex key. Usage: READ <192-hex-key>");
         }
 
-        if (args.length() != 192)
+        if (!isValidKeyLength(args))
         {
             return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
-                                     "READ key must be exactly 192 hex characters. Provided: " + String(args.length()) + " characters");
+                                     "READ key must be exactly 192 (1K) or 480 (4K) hex characters. Provided: " + String(args.length()) + " characters");
         }
 
-        if (!isValidHexString(args, 192))
+        if (!isValidHexString(args, args.length()))
         {
             return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
                                      "READ key contains invalid hex characters. Only 0-9, A-F, a-f allowed");
@@ -59,6 +123,77 @@ ParsedCommand CommandParser::parse(const String &cmd)
         result.code = CommandCode::READ;
         result.arg1 = args;
     }
+    else if (command == "DIGEST")
+    {
+        if (args.length() == 0)
+        {
+            return createErrorResult(cmd, ParseError::MISSING_ARGUMENTS,
+                                     "DIGEST command requires a 192-character hex key. Usage: DIGEST <192-hex-key>");
+        }
+
+        if (!isValidKeyLength(args))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
+                                     "DIGEST key must be exactly 192 (1K) or 480 (4K) hex characters. Provided: " + String(args.length()) + " characters");
+        }
+
+        if (!isValidHexString(args, args.length()))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
+                                     "DIGEST key contains invalid hex characters. Only 0-9, A-F, a-f allowed");
+        }
+
+        result.code = CommandCode::DIGEST;
+        result.arg1 = args;
+    }
+    else if (command == "VERIFY")
+    {
+        if (args.length() == 0)
+        {
+            return createErrorResult(cmd, ParseError::MISSING_ARGUMENTS,
+                                     "VERIFY command requires key and digest. Usage: VERIFY <192-hex-key> <64-hex-digest>");
+        }
+
+        int spacePos = args.indexOf(' ');
+        if (spacePos == -1)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "VERIFY command requires both key and digest separated by space. Usage: VERIFY <192-hex-key> <64-hex-digest>");
+        }
+
+        String key = args.substring(0, spacePos);
+        String digest = args.substring(spacePos + 1);
+        key.trim();
+        digest.trim();
+
+        if (!isValidKeyLength(key))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
+                                     "VERIFY key must be exactly 192 (1K) or 480 (4K) hex characters. Provided: " + String(key.length()) + " characters");
+        }
+
+        if (!isValidHexString(key, key.length()))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
+                                     "VERIFY key contains invalid hex characters. Only 0-9, A-F, a-f allowed");
+        }
+
+        if (digest.length() != 64)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
+                                     "VERIFY digest must be exactly 64 hex characters (SHA-256). Provided: " + String(digest.length()) + " characters");
+        }
+
+        if (!isValidHexString(digest, digest.length()))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
+                                     "VERIFY digest contains invalid hex characters. Only 0-9, A-F, a-f allowed");
+        }
+
+        result.code = CommandCode::VERIFY;
+        result.arg1 = key;
+        result.arg2 = digest;
+    }
     else if (command == "WRITE")
     {
         if (args.length() == 0)
@@ -79,25 +214,25 @@ ParsedCommand CommandParser::parse(const String &cmd)
         key.trim();
         data.trim();
 
-        if (key.length() != 192)
+        if (!isValidKeyLength(key))
         {
             return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
-                                     "WRITE key must be exactly 192 hex characters. Provided: " + String(key.length()) + " characters");
+                                     "WRITE key must be exactly 192 (1K) or 480 (4K) hex characters. Provided: " + String(key.length()) + " characters");
         }
 
-        if (!isValidHexString(key, 192))
+        if (!isValidHexString(key, key.length()))
         {
             return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
                                      "WRITE key contains invalid hex characters. Only 0-9, A-F, a-f allowed");
         }
 
-        if (data.length() != 1024)
+        if (!isValidDataLength(data))
         {
             return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
-                                     "WRITE data must be exactly 1024 hex characters. Provided: " + String(data.length()) + " characters");
+                                     "WRITE data must be an even number of hex characters, at most 6848 (3424 bytes, MIFARE Classic 4K). Provided: " + String(data.length()) + " characters");
         }
 
-        if (!isValidHexString(data, 1024))
+        if (!isValidHexString(data, data.length()))
         {
             return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
                                      "WRITE data contains invalid hex characters. Only 0-9, A-F, a-f allowed");
@@ -107,6 +242,214 @@ ParsedCommand CommandParser::parse(const String &cmd)
         result.arg1 = key;
         result.arg2 = data;
     }
+    else if (command == "WRITE_RESUME")
+    {
+        if (args.length() == 0)
+        {
+            return createErrorResult(cmd, ParseError::MISSING_ARGUMENTS,
+                                     "WRITE_RESUME command requires key, UID, block offset and data. Usage: WRITE_RESUME <192-hex-key> <hex-uid> <block> <1024-hex-data>");
+        }
+
+        // Split into exactly four space separated fields
+        String fields[4];
+        String rest = args;
+        int fieldCount = 0;
+        while (rest.length() > 0 && fieldCount < 4)
+        {
+            int spacePos = rest.indexOf(' ');
+            if (spacePos == -1 || fieldCount == 3)
+            {
+                fields[fieldCount++] = rest;
+                rest = "";
+            }
+            else
+            {
+                fields[fieldCount++] = rest.substring(0, spacePos);
+                rest = rest.substring(spacePos + 1);
+                rest.trim();
+            }
+        }
+
+        if (fieldCount != 4 || fields[3].indexOf(' ') != -1)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "WRITE_RESUME command requires key, UID, block offset and data separated by spaces. Usage: WRITE_RESUME <192-hex-key> <hex-uid> <block> <1024-hex-data>");
+        }
+
+        String key = fields[0];
+        String uid = fields[1];
+        String offset = fields[2];
+        String data = fields[3];
+
+        if (!isValidKeyLength(key))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
+                                     "WRITE_RESUME key must be exactly 192 (1K) or 480 (4K) hex characters. Provided: " + String(key.length()) + " characters");
+        }
+
+        if (!isValidHexString(key, key.length()))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
+                                     "WRITE_RESUME key contains invalid hex characters. Only 0-9, A-F, a-f allowed");
+        }
+
+        // 4, 7 or 10 byte UIDs, like the #<uid> prefix
+        if (uid.length() != 8 && uid.length() != 14 && uid.length() != 20)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
+                                     "WRITE_RESUME UID must be 8, 14 or 20 hex characters. Provided: " + String(uid.length()) + " characters");
+        }
+
+        if (!isValidHexString(uid, uid.length()))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
+                                     "WRITE_RESUME UID contains invalid hex characters. Only 0-9, A-F, a-f allowed");
+        }
+
+        if (!isValidDecimalString(offset) || offset.toInt() > 255)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "WRITE_RESUME block offset must be a number between 0 and 255. Provided: '" + offset + "'");
+        }
+
+        if (!isValidDataLength(data))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
+                                     "WRITE_RESUME data must be an even number of hex characters, at most 6848 (3424 bytes, MIFARE Classic 4K). Provided: " + String(data.length()) + " characters");
+        }
+
+        if (!isValidHexString(data, data.length()))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
+                                     "WRITE_RESUME data contains invalid hex characters. Only 0-9, A-F, a-f allowed");
+        }
+
+        result.code = CommandCode::WRITE_RESUME;
+        result.arg1 = key;
+        result.arg2 = data;
+        result.uid = uid;
+        result.blockOffset = offset.toInt();
+    }
+    else if (command == "PROVISION")
+    {
+        if (args.length() == 0)
+        {
+            return createErrorResult(cmd, ParseError::MISSING_ARGUMENTS,
+                                     "PROVISION command requires key and data. Usage: PROVISION <192-hex-key> <1024-hex-data> [VERIFY]");
+        }
+
+        int spacePos = args.indexOf(' ');
+        if (spacePos == -1)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "PROVISION command requires both key and data separated by space. Usage: PROVISION <192-hex-key> <1024-hex-data> [VERIFY]");
+        }
+
+        String key = args.substring(0, spacePos);
+        String data = args.substring(spacePos + 1);
+        data.trim();
+
+        // Optional trailing VERIFY flag
+        int flagPos = data.indexOf(' ');
+        if (flagPos != -1)
+        {
+            String flag = data.substring(flagPos + 1);
+            flag.trim();
+            if (flag != "VERIFY")
+            {
+                return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                         "PROVISION accepts only VERIFY after the data. Usage: PROVISION <192-hex-key> <1024-hex-data> [VERIFY]");
+            }
+            data = data.substring(0, flagPos);
+            result.verify = true;
+        }
+
+        if (!isValidKeyLength(key))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
+                                     "PROVISION key must be exactly 192 (1K) or 480 (4K) hex characters. Provided: " + String(key.length()) + " characters");
+        }
+
+        if (!isValidHexString(key, key.length()))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
+                                     "PROVISION key contains invalid hex characters. Only 0-9, A-F, a-f allowed");
+        }
+
+        if (!isValidDataLength(data))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
+                                     "PROVISION data must be an even number of hex characters, at most 6848 (3424 bytes, MIFARE Classic 4K). Provided: " + String(data.length()) + " characters");
+        }
+
+        if (!isValidHexString(data, data.length()))
+        {
+            return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
+                                     "PROVISION data contains invalid hex characters. Only 0-9, A-F, a-f allowed");
+        }
+
+        result.code = CommandCode::PROVISION;
+        result.arg1 = key;
+        result.arg2 = data;
+    }
+    else if (command == "INFO")
+    {
+        if (args.length() > 0)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "INFO command takes no arguments. Usage: INFO");
+        }
+        result.code = CommandCode::INFO;
+    }
+    else if (command == "INVENTORY")
+    {
+        if (args.length() > 0)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "INVENTORY command takes no arguments. Usage: INVENTORY");
+        }
+        result.code = CommandCode::INVENTORY;
+    }
+    else if (command == "AUTH_CACHE")
+    {
+        if (args.length() > 0 && args != "CLEAR")
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "AUTH_CACHE command takes no argument or CLEAR. Usage: AUTH_CACHE [CLEAR]");
+        }
+        result.code = CommandCode::AUTH_CACHE;
+        result.arg1 = args;
+    }
+    else if (command == "STATS")
+    {
+        if (args.length() > 0 && args != "RESET")
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "STATS command takes no argument or RESET. Usage: STATS [RESET]");
+        }
+        result.code = CommandCode::STATS;
+        result.arg1 = args;
+    }
+    else if (command == "TRACE")
+    {
+        if (args != "ON" && args != "OFF" && args != "DUMP")
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "TRACE command takes ON, OFF or DUMP. Usage: TRACE ON|OFF|DUMP");
+        }
+        result.code = CommandCode::TRACE;
+        result.arg1 = args;
+    }
+    else if (command == "CAPTURE")
+    {
+        if (args != "ON" && args != "OFF")
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "CAPTURE command takes ON or OFF. Usage: CAPTURE ON|OFF");
+        }
+        result.code = CommandCode::CAPTURE;
+        result.arg1 = args;
+    }
     else if (command == "VERSION")
     {
         if (args.length() > 0)
@@ -124,13 +467,13 @@ ParsedCommand CommandParser::parse(const String &cmd)
                                      "ENROLL command requires a 96-byte hex key. Usage: ENROLL <96-hex-key>");
         }
 
-        if (args.length() != 192)
+        if (!isValidKeyLength(args))
         {
             return createErrorResult(cmd, ParseError::INVALID_HEX_LENGTH,
-                                     "ENROLL key must be exactly 192 hex characters (96 bytes). Provided: " + String(args.length()) + " characters");
+                                     "ENROLL key must be exactly 192 (96 bytes, 1K) or 480 (240 bytes, 4K) hex characters. Provided: " + String(args.length()) + " characters");
         }
 
-        if (!isValidHexString(args, 192))
+        if (!isValidHexString(args, args.length()))
         {
             return createErrorResult(cmd, ParseError::INVALID_HEX_FORMAT,
                                      "ENROLL key contains invalid hex characters. Only 0-9, A-F, a-f allowed");
@@ -139,6 +482,79 @@ ParsedCommand CommandParser::parse(const String &cmd)
         result.code = CommandCode::ENROLL;
         result.arg1 = args;
     }
+    else if (command == "ARM")
+    {
+        if (args.length() == 0)
+        {
+            return createErrorResult(cmd, ParseError::MISSING_ARGUMENTS,
+                                     "ARM command requires an operation. Usage: ARM <op> <args> [TIMEOUT <seconds>] [COUNT <n>]");
+        }
+
+        // Peel TIMEOUT / COUNT options off the end, neither word can appear in hex arguments
+        String operation = args;
+        for (int option = 0; option < 2; option++)
+        {
+            int valuePos = operation.lastIndexOf(' ');
+            int namePos = valuePos > 0 ? operation.lastIndexOf(' ', valuePos - 1) : -1;
+            if (namePos == -1)
+            {
+                break;
+            }
+
+            String name = operation.substring(namePos + 1, valuePos);
+            String value = operation.substring(valuePos + 1);
+            if (name != "TIMEOUT" && name != "COUNT")
+            {
+                break;
+            }
+
+            if (!isValidDecimalString(value) || value.toInt() == 0 || value.toInt() > 65535)
+            {
+                return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                         "ARM " + name + " must be a number between 1 and 65535. Provided: '" + value + "'");
+            }
+
+            if (name == "TIMEOUT")
+            {
+                result.timeoutMs = (uint32_t)value.toInt() * 1000;
+            }
+            else
+            {
+                result.count = value.toInt();
+            }
+            operation = operation.substring(0, namePos);
+            operation.trim();
+        }
+
+        // The armed operation goes through the normal validation now, so a bad line fails before any card arrives
+        ParsedCommand inner = parseLine(operation, operation);
+        if (inner.error != ParseError::NONE)
+        {
+            return createErrorResult(cmd, inner.error, "ARM operation: " + inner.errorDetails);
+        }
+
+        if (inner.code != CommandCode::SCAN_UID && inner.code != CommandCode::READ && inner.code != CommandCode::DIGEST &&
+            inner.code != CommandCode::VERIFY && inner.code != CommandCode::WRITE && inner.code != CommandCode::ENROLL &&
+            inner.code != CommandCode::PROVISION && inner.code != CommandCode::INFO)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "ARM operation must be SCAN_UID, READ, DIGEST, VERIFY, WRITE, ENROLL, PROVISION or INFO");
+        }
+
+        int opEnd = operation.indexOf(' ');
+        result.code = CommandCode::ARM;
+        result.arg1 = operation;
+        result.arg2 = opEnd == -1 ? operation : operation.substring(0, opEnd);
+    }
+    else if (command == "DISARM")
+    {
+        if (args.length() > 0)
+        {
+            return createErrorResult(cmd, ParseError::INVALID_ARGUMENT_COUNT,
+                                     "DISARM command takes no arguments. Usage: DISARM");
+        }
+        result.code = CommandCode::DISARM;
+    }
     else if (command == "HELP")
     {
         result.code = CommandCode::HELP;
@@ -162,6 +578,13 @@ ParsedCommand CommandParser::createErrorResult(const String &originalCmd, ParseE
     result.code = CommandCode::UNKNOWN;
     result.arg1 = "";
     result.arg2 = "";
+    result.uid = "";
+    result.blockOffset = 0;
+    result.verify = false;
+    result.timeoutMs = 0;
+    result.count = 1;
+    result.reader = -1;
+    result.tag = "";
     result.error = error;
     result.errorDetails = details;
     result.originalCommand = originalCmd;
@@ -176,11 +599,47 @@ String CommandParser::getCommandHelp(const String &command)
     }
     else if (command == "READ")
     {
-        return "READ <192-hex-key> - Reads data from RFID tag using authentication key. Key must be exactly 192 hex characters (0-9, A-F). Example: READ A1B2C3D4E5F6...";
+        return "READ <192-hex-key> - Reads data from RFID tag using authentication key. Key must be exactly 192 hex characters (0-9, A-F), or 480 for a 4K card. Returns 512 bytes, or the stored length if larger. Example: READ A1B2C3D4E5F6...";
+    }
+    else if (command == "DIGEST")
+    {
+        return "DIGEST <192-hex-key> - Reads the tag like READ and returns the SHA-256 of the bytes READ would return, 64 hex characters instead of the payload. Example: DIGEST A1B2C3D4E5F6...";
+    }
+    else if (command == "VERIFY")
+    {
+        return "VERIFY <192-hex-key> <64-hex-digest> - Reads the tag like READ and compares the SHA-256 of the bytes READ would return with the digest, replying VERIFY MATCH or VERIFY MISMATCH. Example: VERIFY A1B2C3D4E5F6... 9F86D081884C7D65...";
     }
     else if (command == "WRITE")
     {
-        return "WRITE <192-hex-key> <1024-hex-data> - Writes data to RFID tag. Key: 192 hex chars, Data: 1024 hex chars. Example: WRITE A1B2C3... 1234ABCD...";
+        return "WRITE <192-hex-key> <1024-hex-data> - Writes data to RFID tag. Key: 192 hex chars (480 for 4K), Data: up to the card capacity reported by INFO, trailing bytes are zero. Example: WRITE A1B2C3... 1234ABCD...";
+    }
+    else if (command == "WRITE_RESUME")
+    {
+        return "WRITE_RESUME <192-hex-key> <hex-uid> <block> <1024-hex-data> - Continues an interrupted WRITE on the same tag from the block offset reported by WRITE_FAIL. Example: WRITE_RESUME A1B2C3... 04A1B2C3 12 1234ABCD...";
+    }
+    else if (command == "PROVISION")
+    {
+        return "PROVISION <192-hex-key> <1024-hex-data> [VERIFY] - Enrolls the key and writes the data in one pass over a blank card: each sector gets its data blocks and then its new trailer under the factory key. VERIFY reads every block back before the trailer is written. Example: PROVISION A1B2C3... 1234ABCD... VERIFY";
+    }
+    else if (command == "INFO")
+    {
+        return "INFO - Detects the tag and reports its type, UID, ATQA/SAK, sector count, key length and payload capacity in bytes. Takes no arguments. Example: INFO";
+    }
+    else if (command == "INVENTORY")
+    {
+        return "INVENTORY - Lists every tag in the field with UID, ATQA, SAK and type, resolving stacked tags. Follow-up commands can address one of them with a #<uid> prefix. Example: INVENTORY, then #04A1B2C3 READ A1B2C3...";
+    }
+    else if (command == "AUTH_CACHE")
+    {
+        return "AUTH_CACHE [CLEAR] - Reports the per-tag authentication cache: cached tags, hits, misses, failed authentications and authentications avoided by trying the cached key first. CLEAR empties it. Example: AUTH_CACHE";
+    }
+    else if (command == "STATS")
+    {
+        return "STATS [RESET] - Reports operation counters, error codes and per-phase latency histograms (N, AVG and MAX in microseconds, H bucket counts from <64us doubling up to >=1s) across all readers. RESET clears them. Example: STATS";
+    }
+    else if (command == "TRACE")
+    {
+        return "TRACE ON|OFF|DUMP - Records the last PN532 command/response frames of all readers. ON starts an empty trace, OFF stops recording, DUMP prints one TRACE line per frame exchange, oldest first, followed by TRACE_DUMP COUNT n. Example: TRACE DUMP";
     }
     else if (command == "VERSION")
     {
@@ -188,7 +647,19 @@ String CommandParser::getCommandHelp(const String &command)
     }
     else if (command == "ENROLL")
     {
-        return "ENROLL <96-hex-key> - Changes the fourth block (sector trailer) in each sector with new authentication keys. Key must be exactly 192 hex characters (96 bytes). Example: ENROLL A1B2C3D4E5F6...";
+        return "ENROLL <96-hex-key> - Changes the sector trailer (last block) in each sector with new authentication keys. Key must be exactly 192 hex characters (96 bytes), or 480 (240 bytes) to enroll all 40 sectors of a 4K card. Sectors already opening with the new Key B are skipped and the reply lists ENROLLED and SKIPPED sector bitmaps, so a retry only redoes failed sectors. Example: ENROLL A1B2C3D4E5F6...";
+    }
+    else if (command == "CAPTURE")
+    {
+        return "CAPTURE ON|OFF - Logs every command the readers run with each PN532 exchange in full and its timing, for offline replay with rfid_replay. After each reply come CAPTURE CMD, CAPTURE X (one per exchange) and CAPTURE END lines. Example: CAPTURE ON";
+    }
+    else if (command == "ARM")
+    {
+        return "ARM <op> <args> [TIMEOUT <seconds>] [COUNT <n>] - Keeps the reader powered and runs SCAN_UID, READ, DIGEST, VERIFY, WRITE, ENROLL, PROVISION or INFO on each new tag that enters the field, up to COUNT tags (default 1). A tag is served once; TIMEOUT bounds the wait for each tag. Example: ARM WRITE A1B2C3... 1234ABCD... COUNT 50";
+    }
+    else if (command == "DISARM")
+    {
+        return "DISARM - Cancels the armed operation and reports how many tags it served. Example: DISARM";
     }
     else if (command == "HELP")
     {
@@ -202,7 +673,7 @@ String CommandParser::getCommandHelp(const String &command)
 
 String CommandParser::getAllCommandsHelp()
 {
-    return "Available commands: SCAN_UID, READ <key>, WRITE <key> <data>, ENROLL <key>, VERSION, HELP [command]. Use 'HELP <command>' for detailed help on specific commands.";
+    return "Available commands: SCAN_UID, READ <key>, DIGEST <key>, VERIFY <key> <digest>, WRITE <key> <data>, WRITE_RESUME <key> <uid> <block> <data>, ENROLL <key>, PROVISION <key> <data> [VERIFY], INFO, INVENTORY, AUTH_CACHE [CLEAR], STATS [RESET], TRACE ON|OFF|DUMP, CAPTURE ON|OFF, ARM <op> <args> [TIMEOUT <s>] [COUNT <n>], DISARM, VERSION, HELP [command]. Use 'HELP <command>' for detailed help on specific commands.";
 }
 
 bool CommandParser::isValidHexString(const String &str, int expectedLength)
@@ -220,3 +691,31 @@ bool CommandParser::isValidHexString(const String &str, int expectedLength)
     }
     return true;
 }
+
+bool CommandParser::isValidDecimalString(const String &str)
+{
+    if (str.length() == 0 || str.length() > 5)
+        return false;
+
+    for (unsigned int i = 0; i < str.length(); i++)
+    {
+        char c = str.charAt(i);
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CommandParser::isValidKeyLength(const String &key)
+{
+    // 6 bytes per sector: 16 sectors (Mini/1K) or 40 sectors (4K)
+    return key.length() == 192 || key.length() == 480;
+}
+
+bool CommandParser::isValidDataLength(const String &data)
+{
+    // Whole bytes, up to the payload capacity of a MIFARE Classic 4K
+    return data.length() > 0 && data.length() % 2 == 0 && data.length() <= 6848;
+}
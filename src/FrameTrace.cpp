@@ -0,0 +1,124 @@
+#include "FrameTrace.h"
+
+static const char *RESULT_NAMES[] = {"OK", "NO_ACK", "TIMEOUT", "BAD_FRAME"};
+
+volatile bool FrameTrace::enabled = false;
+
+// Reader tasks record concurrently, the ring is only touched under this lock
+static portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;
+static FrameTrace::Entry ring[FRAME_TRACE_DEPTH];
+static uint32_t recorded = 0;
+
+void FrameTrace::setEnabled(bool on)
+{
+    portENTER_CRITICAL(&traceLock);
+    if (on && !enabled)
+    {
+        recorded = 0;
+    }
+    enabled = on;
+    portEXIT_CRITICAL(&traceLock);
+}
+
+void FrameTrace::record(uint8_t reader, uint32_t timeUs, uint32_t durationUs, TraceResult result,
+                        const uint8_t *command, uint8_t commandLength, const uint8_t *response, uint8_t responseLength)
+{
+    portENTER_CRITICAL(&traceLock);
+    Entry &entry = ring[recorded % FRAME_TRACE_DEPTH];
+    entry.timeUs = timeUs;
+    entry.durationUs = durationUs;
+    entry.reader = reader;
+    entry.result = result;
+    entry.commandLength = commandLength;
+    entry.responseLength = responseLength;
+    uint8_t kept = commandLength < FRAME_TRACE_BYTES ? commandLength : FRAME_TRACE_BYTES;
+    memcpy(entry.command, command, kept);
+    maskKeys(entry.command, kept);
+    memcpy(entry.response, response, responseLength < FRAME_TRACE_BYTES ? responseLength : FRAME_TRACE_BYTES);
+    recorded++;
+    portEXIT_CRITICAL(&traceLock);
+}
+
+// Clears the bytes [from, from + count) that lie within length
+static void clearRange(uint8_t *data, uint8_t length, uint8_t from, uint8_t count)
+{
+    for (uint8_t i = from; i < from + count && i < length; i++)
+    {
+        data[i] = 0;
+    }
+}
+
+void FrameTrace::maskKeys(uint8_t *command, uint8_t length)
+{
+    // Tag commands go through InDataExchange: 40 <tg> <tag command> <arguments>
+    if (length < 4 || command[0] != 0x40)
+    {
+        return;
+    }
+
+    uint8_t block = command[3];
+    switch (command[2])
+    {
+    case 0x60: // Authenticate: 60/61 <block> <key> <uid>; NTAG GET_VERSION is a lone 60
+    case 0x61:
+        clearRange(command, length, 4, 6);
+        break;
+    case 0x1B: // NTAG PWD_AUTH: 1B <password>
+        clearRange(command, length, 3, 4);
+        break;
+    case 0xA0: // MIFARE Classic write: A0 <block> <data>, trailers are <Key A> <access bits> <Key B>
+        if (block < 128 ? (block & 0x03) == 0x03 : (block & 0x0F) == 0x0F)
+        {
+            clearRange(command, length, 4, 6);
+            clearRange(command, length, 14, 6);
+        }
+        break;
+    }
+}
+
+uint8_t FrameTrace::snapshot(Entry *entries)
+{
+    portENTER_CRITICAL(&traceLock);
+    uint8_t count = recorded < FRAME_TRACE_DEPTH ? recorded : FRAME_TRACE_DEPTH;
+    uint32_t first = recorded - count;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        entries[i] = ring[(first + i) % FRAME_TRACE_DEPTH];
+    }
+    portEXIT_CRITICAL(&traceLock);
+    return count;
+}
+
+static String frameHex(const uint8_t *data, uint8_t length)
+{
+    if (length == 0)
+    {
+        return "-";
+    }
+
+    uint8_t kept = length < FRAME_TRACE_BYTES ? length : FRAME_TRACE_BYTES;
+    String hex = "";
+    hex.reserve(kept * 2 + 2);
+    for (uint8_t i = 0; i < kept; i++)
+    {
+        hex += "0123456789ABCDEF"[data[i] >> 4];
+        hex += "0123456789ABCDEF"[data[i] & 0x0F];
+    }
+    if (kept < length)
+    {
+        hex += "..";
+    }
+    return hex;
+}
+
+const char *FrameTrace::resultName(TraceResult result)
+{
+    return RESULT_NAMES[(uint8_t)result];
+}
+
+String FrameTrace::format(const Entry &entry)
+{
+    return String(entry.timeUs) + " @" + String(entry.reader) + " " + resultName(entry.result) + " " +
+           String(entry.durationUs) + "us TX " + frameHex(entry.command, entry.commandLength) +
+           " RX " + frameHex(entry.response, entry.responseLength);
+}
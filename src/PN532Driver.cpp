@@ -0,0 +1,327 @@
+#include "PN532Driver.h"
+#include "Stats.h"
+
+#define PN532_COMMAND_GETFIRMWAREVERSION 0x02
+#define PN532_COMMAND_SAMCONFIGURATION 0x14
+#define PN532_COMMAND_RFCONFIGURATION 0x32
+#define PN532_COMMAND_INDATAEXCHANGE 0x40
+#define PN532_COMMAND_INLISTPASSIVETARGET 0x4A
+#define PN532_COMMAND_INRELEASE 0x52
+
+#define PN532_BRTY_ISO14443A 0x00
+
+// InDataExchange status: MIFARE authentication error
+#define PN532_ERROR_AUTH 0x14
+
+#define MIFARE_CMD_AUTH_A 0x60
+#define MIFARE_CMD_AUTH_B 0x61
+#define MIFARE_CMD_READ 0x30
+#define MIFARE_CMD_WRITE 0xA0
+
+#define NTAG_CMD_GET_VERSION 0x60
+#define NTAG_CMD_READ 0x30
+#define NTAG_CMD_FAST_READ 0x3A
+#define NTAG_CMD_WRITE 0xA2
+#define NTAG_CMD_PWD_AUTH 0x1B
+
+// Default time allowed for the PN532 to answer a command
+#define PN532_DEFAULT_TIMEOUT_MS 1000
+// Target detection keeps retrying in the PN532 for up to MxRtyPassiveActivation attempts
+#define PN532_DETECT_TIMEOUT_MS 2000
+
+PN532Driver::PN532Driver(PN532Transport *transport)
+{
+    this->transport = transport;
+    exchangeStatus = 0;
+}
+
+bool PN532Driver::begin()
+{
+    transport->wakeup();
+
+    // The first command after a power up only gets the PN532 in sync, its response is ignored
+    uint32_t ignored = getFirmwareVersion();
+    (void)ignored;
+
+    // Normal mode, no SAM, IRQ pin enabled
+    uint8_t cmd[] = {PN532_COMMAND_SAMCONFIGURATION, 0x01, 0x14, 0x01};
+    uint8_t length;
+    return command(cmd, sizeof(cmd), &length, PN532_DEFAULT_TIMEOUT_MS);
+}
+
+bool PN532Driver::command(const uint8_t *cmd, uint8_t cmdLength, uint8_t *length, uint16_t timeoutMs)
+{
+    uint8_t received = sizeof(frame);
+    if (!transport->exchange(cmd, cmdLength, frame, &received, timeoutMs))
+    {
+        return false;
+    }
+
+    // Responses echo the command code + 1 ahead of their parameters
+    if (received == 0 || frame[0] != (uint8_t)(cmd[0] + 1))
+    {
+        return false;
+    }
+
+    *length = received - 1;
+    memmove(frame, frame + 1, *length);
+    return true;
+}
+
+uint32_t PN532Driver::getFirmwareVersion()
+{
+    uint8_t cmd[] = {PN532_COMMAND_GETFIRMWAREVERSION};
+    uint8_t length;
+    if (!command(cmd, sizeof(cmd), &length, PN532_DEFAULT_TIMEOUT_MS) || length < 4)
+    {
+        return 0;
+    }
+
+    // IC, Ver, Rev, Support
+    return ((uint32_t)frame[0] << 24) | ((uint32_t)frame[1] << 16) | ((uint32_t)frame[2] << 8) | frame[3];
+}
+
+bool PN532Driver::setPassiveActivationRetries(uint8_t maxRetries)
+{
+    // CfgItem 5: MxRtyATR, MxRtyPSL, MxRtyPassiveActivation
+    uint8_t cmd[] = {PN532_COMMAND_RFCONFIGURATION, 0x05, 0xFF, 0x01, maxRetries};
+    uint8_t length;
+    return command(cmd, sizeof(cmd), &length, PN532_DEFAULT_TIMEOUT_MS);
+}
+
+bool PN532Driver::setRfField(bool on)
+{
+    // CfgItem 1: bit 0 RF field on, bit 1 auto RFCA (off)
+    uint8_t cmd[] = {PN532_COMMAND_RFCONFIGURATION, 0x01, (uint8_t)(on ? 0x01 : 0x00)};
+    uint8_t length;
+    return command(cmd, sizeof(cmd), &length, PN532_DEFAULT_TIMEOUT_MS);
+}
+
+uint8_t PN532Driver::listPassiveTargets(TargetInfo *targets, uint8_t maxTargets)
+{
+    uint8_t cmd[] = {PN532_COMMAND_INLISTPASSIVETARGET, maxTargets, PN532_BRTY_ISO14443A};
+    return listTargets(cmd, sizeof(cmd), targets, maxTargets);
+}
+
+bool PN532Driver::selectTarget(const uint8_t *uid, uint8_t uidLength, TargetInfo *target)
+{
+    // InitiatorData carries the UID to select, cascade tag 0x88 ahead of every level but the last
+    uint8_t cmd[16] = {PN532_COMMAND_INLISTPASSIVETARGET, 1, PN532_BRTY_ISO14443A};
+    uint8_t cmdLength = 3;
+    uint8_t pos = 0;
+    while (uidLength - pos > 4)
+    {
+        cmd[cmdLength++] = 0x88;
+        memcpy(cmd + cmdLength, uid + pos, 3);
+        cmdLength += 3;
+        pos += 3;
+    }
+    memcpy(cmd + cmdLength, uid + pos, uidLength - pos);
+    cmdLength += uidLength - pos;
+
+    return listTargets(cmd, cmdLength, target, 1) == 1 && target->uidLength == uidLength &&
+           memcmp(target->uid, uid, uidLength) == 0;
+}
+
+uint8_t PN532Driver::listTargets(const uint8_t *cmd, uint8_t cmdLength, TargetInfo *targets, uint8_t maxTargets)
+{
+    uint8_t length;
+    if (!command(cmd, cmdLength, &length, PN532_DETECT_TIMEOUT_MS) || length < 1)
+    {
+        return 0;
+    }
+
+    uint8_t found = 0;
+    uint8_t pos = 1;
+    uint8_t count = frame[0];
+
+    // Each target: Tg, SENS_RES (2), SEL_RES, NFCIDLength, NFCID1, optional ATS
+    for (uint8_t t = 0; t < count && found < maxTargets; t++)
+    {
+        if (pos + 5 > length)
+        {
+            break;
+        }
+
+        TargetInfo &target = targets[found];
+        target.tg = frame[pos];
+        target.atqa = ((uint16_t)frame[pos + 1] << 8) | frame[pos + 2];
+        target.sak = frame[pos + 3];
+        target.uidLength = frame[pos + 4];
+        pos += 5;
+
+        if (target.uidLength > sizeof(target.uid) || pos + target.uidLength > length)
+        {
+            break;
+        }
+        memcpy(target.uid, frame + pos, target.uidLength);
+        pos += target.uidLength;
+
+        // ISO14443-4 compliant targets append their ATS, whose first byte is its own length
+        if ((target.sak & 0x20) && pos < length)
+        {
+            pos += frame[pos];
+        }
+
+        found++;
+    }
+
+    return found;
+}
+
+bool PN532Driver::releaseTarget(uint8_t tg)
+{
+    uint8_t cmd[] = {PN532_COMMAND_INRELEASE, tg};
+    uint8_t length;
+    return command(cmd, sizeof(cmd), &length, PN532_DEFAULT_TIMEOUT_MS) && length >= 1 && (frame[0] & 0x3F) == 0;
+}
+
+bool PN532Driver::dataExchange(uint8_t tg, const uint8_t *data, uint8_t dataLength, uint8_t *length)
+{
+    uint8_t cmd[PN532_FRAME_SIZE];
+    if (dataLength > sizeof(cmd) - 3)
+    {
+        return false;
+    }
+
+    cmd[0] = PN532_COMMAND_INDATAEXCHANGE;
+    cmd[1] = tg;
+    memcpy(cmd + 2, data, dataLength);
+
+    exchangeStatus = 0xFF;
+    if (!command(cmd, dataLength + 2, length, PN532_DEFAULT_TIMEOUT_MS) || *length < 1)
+    {
+        return false;
+    }
+
+    // Lower six bits of the status byte carry the error code
+    exchangeStatus = frame[0] & 0x3F;
+    return exchangeStatus == 0;
+}
+
+bool PN532Driver::authRejected() const
+{
+    return exchangeStatus == PN532_ERROR_AUTH;
+}
+
+bool PN532Driver::mifareAuthenticate(const TargetInfo &target, uint8_t block, uint8_t keyType, const uint8_t *key)
+{
+    uint8_t data[12];
+    data[0] = keyType == MIFARE_KEY_B ? MIFARE_CMD_AUTH_B : MIFARE_CMD_AUTH_A;
+    data[1] = block;
+    memcpy(data + 2, key, 6);
+
+    // Authentication uses the last four bytes of the UID (the cascade level 2 part of 7-byte UIDs)
+    uint8_t uidOffset = target.uidLength > 4 ? target.uidLength - 4 : 0;
+    memcpy(data + 8, target.uid + uidOffset, 4);
+
+    uint8_t length;
+    return dataExchange(target.tg, data, sizeof(data), &length);
+}
+
+bool PN532Driver::mifareReadBlock(const TargetInfo &target, uint8_t block, uint8_t *data)
+{
+    uint8_t request[] = {MIFARE_CMD_READ, block};
+    uint8_t length;
+    uint32_t start = micros();
+    bool ok = dataExchange(target.tg, request, sizeof(request), &length) && length >= 17;
+    Stats::record(Phase::BLOCK_READ, micros() - start);
+    if (!ok)
+    {
+        return false;
+    }
+
+    memcpy(data, frame + 1, 16);
+    return true;
+}
+
+bool PN532Driver::mifareWriteBlock(const TargetInfo &target, uint8_t block, const uint8_t *data)
+{
+    uint8_t request[18];
+    request[0] = MIFARE_CMD_WRITE;
+    request[1] = block;
+    memcpy(request + 2, data, 16);
+
+    uint8_t length;
+    uint32_t start = micros();
+    bool ok = dataExchange(target.tg, request, sizeof(request), &length);
+    Stats::record(Phase::BLOCK_WRITE, micros() - start);
+    return ok;
+}
+
+bool PN532Driver::ntagGetVersion(const TargetInfo &target, uint8_t *version)
+{
+    uint8_t request[] = {NTAG_CMD_GET_VERSION};
+    uint8_t length;
+    if (!dataExchange(target.tg, request, sizeof(request), &length) || length < 9)
+    {
+        return false;
+    }
+
+    memcpy(version, frame + 1, 8);
+    return true;
+}
+
+bool PN532Driver::ntagReadPages(const TargetInfo &target, uint8_t page, uint8_t *data)
+{
+    // READ returns four consecutive pages
+    uint8_t request[] = {NTAG_CMD_READ, page};
+    uint8_t length;
+    uint32_t start = micros();
+    bool ok = dataExchange(target.tg, request, sizeof(request), &length) && length >= 17;
+    Stats::record(Phase::BLOCK_READ, micros() - start);
+    if (!ok)
+    {
+        return false;
+    }
+
+    memcpy(data, frame + 1, 16);
+    return true;
+}
+
+bool PN532Driver::ntagFastRead(const TargetInfo &target, uint8_t startPage, uint8_t endPage, uint8_t *data)
+{
+    uint8_t request[] = {NTAG_CMD_FAST_READ, startPage, endPage};
+    uint16_t expected = (endPage - startPage + 1) * 4;
+    if (endPage < startPage)
+    {
+        return false;
+    }
+
+    uint8_t length;
+    uint32_t start = micros();
+    bool ok = dataExchange(target.tg, request, sizeof(request), &length) && length >= expected + 1;
+    Stats::record(Phase::BLOCK_READ, micros() - start);
+    if (!ok)
+    {
+        return false;
+    }
+
+    memcpy(data, frame + 1, expected);
+    return true;
+}
+
+bool PN532Driver::ntagWritePage(const TargetInfo &target, uint8_t page, const uint8_t *data)
+{
+    uint8_t request[6];
+    request[0] = NTAG_CMD_WRITE;
+    request[1] = page;
+    memcpy(request + 2, data, 4);
+
+    uint8_t length;
+    uint32_t start = micros();
+    bool ok = dataExchange(target.tg, request, sizeof(request), &length);
+    Stats::record(Phase::BLOCK_WRITE, micros() - start);
+    return ok;
+}
+
+bool PN532Driver::ntagPasswordAuth(const TargetInfo &target, const uint8_t *password)
+{
+    uint8_t request[5];
+    request[0] = NTAG_CMD_PWD_AUTH;
+    memcpy(request + 1, password, 4);
+
+    // A valid password is answered with the 2-byte PACK
+    uint8_t length;
+    return dataExchange(target.tg, request, sizeof(request), &length) && length >= 3;
+}
@@ -0,0 +1,179 @@
+#include "PN532SpiTransport.h"
+
+// SPI operation codes sent before every transfer
+#define PN532_SPI_DATAWRITE 0x01
+#define PN532_SPI_STATREAD 0x02
+#define PN532_SPI_DATAREAD 0x03
+#define PN532_SPI_READY 0x01
+
+#define PN532_PREAMBLE 0x00
+#define PN532_STARTCODE1 0x00
+#define PN532_STARTCODE2 0xFF
+#define PN532_POSTAMBLE 0x00
+#define PN532_HOSTTOPN532 0xD4
+#define PN532_PN532TOHOST 0xD5
+
+// The PN532 acknowledges a valid command frame within a couple of milliseconds
+#define PN532_ACK_TIMEOUT_MS 10
+
+static const uint8_t ACK_FRAME[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+
+PN532SpiTransport::PN532SpiTransport(uint8_t ssPin, SPIClass *spi)
+{
+    this->ssPin = ssPin;
+    this->spi = spi;
+}
+
+void PN532SpiTransport::begin()
+{
+    pinMode(ssPin, OUTPUT);
+    digitalWrite(ssPin, HIGH);
+    spi->begin();
+}
+
+void PN532SpiTransport::wakeup()
+{
+    // Holding chip-select low wakes the PN532 from power down
+    digitalWrite(ssPin, LOW);
+    delay(2);
+    digitalWrite(ssPin, HIGH);
+}
+
+void PN532SpiTransport::select()
+{
+    // The PN532 clocks bytes LSB first in SPI mode 0. The transaction also holds the bus lock,
+    // so readers sharing the bus each get whole frames in, never interleaved bytes
+    spi->beginTransaction(SPISettings(1000000, LSBFIRST, SPI_MODE0));
+    digitalWrite(ssPin, LOW);
+}
+
+void PN532SpiTransport::deselect()
+{
+    digitalWrite(ssPin, HIGH);
+    spi->endTransaction();
+}
+
+bool PN532SpiTransport::sendCommand(const uint8_t *command, uint8_t commandLength)
+{
+    // LEN covers the TFI byte plus the command
+    uint8_t length = commandLength + 1;
+    uint8_t checksum = PN532_HOSTTOPN532;
+
+    select();
+    spi->transfer(PN532_SPI_DATAWRITE);
+    spi->transfer(PN532_PREAMBLE);
+    spi->transfer(PN532_STARTCODE1);
+    spi->transfer(PN532_STARTCODE2);
+    spi->transfer(length);
+    spi->transfer(~length + 1);
+    spi->transfer(PN532_HOSTTOPN532);
+    for (uint8_t i = 0; i < commandLength; i++)
+    {
+        spi->transfer(command[i]);
+        checksum += command[i];
+    }
+    spi->transfer(~checksum + 1);
+    spi->transfer(PN532_POSTAMBLE);
+    deselect();
+
+    if (!waitReady(PN532_ACK_TIMEOUT_MS))
+    {
+        return false;
+    }
+
+    return readAck();
+}
+
+bool PN532SpiTransport::isReady()
+{
+    select();
+    spi->transfer(PN532_SPI_STATREAD);
+    uint8_t status = spi->transfer(0x00);
+    deselect();
+
+    return (status & PN532_SPI_READY) != 0;
+}
+
+bool PN532SpiTransport::readAck()
+{
+    uint8_t ack[sizeof(ACK_FRAME)];
+
+    select();
+    spi->transfer(PN532_SPI_DATAREAD);
+    for (uint8_t i = 0; i < sizeof(ACK_FRAME); i++)
+    {
+        ack[i] = spi->transfer(0x00);
+    }
+    deselect();
+
+    return memcmp(ack, ACK_FRAME, sizeof(ACK_FRAME)) == 0;
+}
+
+bool PN532SpiTransport::readResponse(uint8_t *response, uint8_t *responseLength)
+{
+    bool valid = false;
+    uint8_t received = 0;
+
+    // The whole frame has to be clocked out while chip-select stays low
+    select();
+    spi->transfer(PN532_SPI_DATAREAD);
+
+    // Skip the preamble and find the 0x00 0xFF start code
+    uint8_t previous = 0xAA;
+    bool started = false;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        uint8_t value = spi->transfer(0x00);
+        if (previous == PN532_STARTCODE1 && value == PN532_STARTCODE2)
+        {
+            started = true;
+            break;
+        }
+        previous = value;
+    }
+
+    if (started)
+    {
+        uint8_t length = spi->transfer(0x00);
+        uint8_t lengthChecksum = spi->transfer(0x00);
+
+        if (length > 0 && (uint8_t)(length + lengthChecksum) == 0)
+        {
+            uint8_t tfi = spi->transfer(0x00);
+            uint8_t checksum = tfi;
+            bool fits = (uint8_t)(length - 1) <= *responseLength;
+
+            for (uint8_t i = 0; i < length - 1; i++)
+            {
+                uint8_t value = spi->transfer(0x00);
+                checksum += value;
+                if (fits)
+                {
+                    response[received++] = value;
+                }
+            }
+
+            checksum += spi->transfer(0x00); // DCS
+            spi->transfer(0x00);             // Postamble
+
+            valid = fits && tfi == PN532_PN532TOHOST && checksum == 0;
+        }
+    }
+
+    deselect();
+
+    *responseLength = valid ? received : 0;
+    return valid;
+}
+
+void PN532SpiTransport::abort()
+{
+    // An ACK frame from the host makes the PN532 drop the command it is processing
+    select();
+    spi->transfer(PN532_SPI_DATAWRITE);
+    for (uint8_t i = 0; i < sizeof(ACK_FRAME); i++)
+    {
+        spi->transfer(ACK_FRAME[i]);
+    }
+    deselect();
+}
@@ -0,0 +1,54 @@
+#include "PN532Transport.h"
+
+bool PN532Transport::exchange(const uint8_t *command, uint8_t commandLength, uint8_t *response, uint8_t *responseLength, uint16_t timeoutMs)
+{
+    if (!FrameTrace::isEnabled() && !Capture::isEnabled())
+    {
+        return exchangeFrames(command, commandLength, response, responseLength, timeoutMs) == TraceResult::OK;
+    }
+
+    uint32_t start = micros();
+    TraceResult result = exchangeFrames(command, commandLength, response, responseLength, timeoutMs);
+    uint32_t duration = micros() - start;
+    uint8_t received = result == TraceResult::OK ? *responseLength : 0;
+    if (FrameTrace::isEnabled())
+    {
+        FrameTrace::record(traceId, start, duration, result, command, commandLength, response, received);
+    }
+    if (Capture::isEnabled())
+    {
+        Capture::exchange(duration, result, command, commandLength, response, received);
+    }
+    return result == TraceResult::OK;
+}
+
+TraceResult PN532Transport::exchangeFrames(const uint8_t *command, uint8_t commandLength, uint8_t *response, uint8_t *responseLength, uint16_t timeoutMs)
+{
+    if (!sendCommand(command, commandLength))
+    {
+        return TraceResult::NO_ACK;
+    }
+
+    if (!waitReady(timeoutMs))
+    {
+        // Stop the PN532 so the next command is not rejected while this one is still running
+        abort();
+        return TraceResult::TIMEOUT;
+    }
+
+    return readResponse(response, responseLength) ? TraceResult::OK : TraceResult::BAD_FRAME;
+}
+
+bool PN532Transport::waitReady(uint16_t timeoutMs)
+{
+    unsigned long start = millis();
+    while (!isReady())
+    {
+        if (millis() - start >= timeoutMs)
+        {
+            return false;
+        }
+        delay(1);
+    }
+    return true;
+}
@@ -0,0 +1,195 @@
+#include "PayloadCodec.h"
+
+// LZ4 block format: sequences of a token (literal count << 4 | match length - 4), extra
+// length bytes for counts of 15 and more, the literals, and a 2-byte little-endian offset
+// back to the match. The last sequence has literals only.
+static const uint8_t MIN_MATCH = 4;
+// The last 5 bytes are always literals and no match starts in the last 12
+static const uint8_t LAST_LITERALS = 5;
+static const uint8_t MATCH_LIMIT = 12;
+// 512 entries, 1 KB of reader task stack
+static const uint8_t HASH_BITS = 9;
+
+static uint32_t read32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, 4);
+    return value;
+}
+
+static uint16_t hashOf(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static bool putLength(uint8_t *out, uint16_t &pos, uint16_t capacity, uint16_t value)
+{
+    while (value >= 255)
+    {
+        if (pos >= capacity)
+        {
+            return false;
+        }
+        out[pos++] = 255;
+        value -= 255;
+    }
+    if (pos >= capacity)
+    {
+        return false;
+    }
+    out[pos++] = value;
+    return true;
+}
+
+// One sequence, matchLength 0 for the closing literals-only one
+static bool putSequence(uint8_t *out, uint16_t &pos, uint16_t capacity, const uint8_t *literals, uint16_t literalCount,
+                        uint16_t offset, uint16_t matchLength)
+{
+    if (pos >= capacity)
+    {
+        return false;
+    }
+    uint16_t tokenPos = pos++;
+    uint8_t token = (literalCount >= 15 ? 15 : literalCount) << 4;
+    if (literalCount >= 15 && !putLength(out, pos, capacity, literalCount - 15))
+    {
+        return false;
+    }
+    if (pos + literalCount > capacity)
+    {
+        return false;
+    }
+    memcpy(out + pos, literals, literalCount);
+    pos += literalCount;
+
+    if (matchLength > 0)
+    {
+        if (pos + 2 > capacity)
+        {
+            return false;
+        }
+        out[pos++] = offset & 0xFF;
+        out[pos++] = offset >> 8;
+        uint16_t extra = matchLength - MIN_MATCH;
+        token |= extra >= 15 ? 15 : extra;
+        if (extra >= 15 && !putLength(out, pos, capacity, extra - 15))
+        {
+            return false;
+        }
+    }
+
+    out[tokenPos] = token;
+    return true;
+}
+
+uint16_t PayloadCodec::compress(const uint8_t *in, uint16_t length, uint8_t *out, uint16_t capacity)
+{
+    // Position + 1 of the last 4 bytes seen with each hash, 0 for none
+    uint16_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    uint16_t pos = 0;
+    uint16_t anchor = 0;
+    uint16_t i = 0;
+    while (length > MATCH_LIMIT && i <= length - MATCH_LIMIT)
+    {
+        uint32_t value = read32(in + i);
+        uint16_t hash = hashOf(value);
+        uint16_t candidate = table[hash];
+        table[hash] = i + 1;
+        if (candidate == 0 || read32(in + candidate - 1) != value)
+        {
+            i++;
+            continue;
+        }
+
+        uint16_t ref = candidate - 1;
+        uint16_t matchLength = MIN_MATCH;
+        while (i + matchLength < length - LAST_LITERALS && in[ref + matchLength] == in[i + matchLength])
+        {
+            matchLength++;
+        }
+        if (!putSequence(out, pos, capacity, in + anchor, i - anchor, i - ref, matchLength))
+        {
+            return 0;
+        }
+        i += matchLength;
+        anchor = i;
+    }
+
+    if (!putSequence(out, pos, capacity, in + anchor, length - anchor, 0, 0))
+    {
+        return 0;
+    }
+    return pos;
+}
+
+static bool getLength(const uint8_t *in, uint16_t &pos, uint16_t length, uint32_t &value)
+{
+    uint8_t b;
+    do
+    {
+        if (pos >= length)
+        {
+            return false;
+        }
+        b = in[pos++];
+        value += b;
+    } while (b == 255);
+    return true;
+}
+
+bool PayloadCodec::decompress(const uint8_t *in, uint16_t length, uint8_t *out, uint16_t outLength)
+{
+    uint16_t ip = 0;
+    uint16_t op = 0;
+    while (ip < length)
+    {
+        uint8_t token = in[ip++];
+
+        uint32_t literals = token >> 4;
+        if (literals == 15 && !getLength(in, ip, length, literals))
+        {
+            return false;
+        }
+        if (ip + literals > length || op + literals > outLength)
+        {
+            return false;
+        }
+        memcpy(out + op, in + ip, literals);
+        ip += literals;
+        op += literals;
+
+        // The last sequence ends with its literals
+        if (ip == length)
+        {
+            break;
+        }
+
+        if (ip + 2 > length)
+        {
+            return false;
+        }
+        uint16_t offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        uint32_t matchLength = token & 0x0F;
+        if (matchLength == 15 && !getLength(in, ip, length, matchLength))
+        {
+            return false;
+        }
+        matchLength += MIN_MATCH;
+        if (offset == 0 || offset > op || op + matchLength > outLength)
+        {
+            return false;
+        }
+
+        // Byte by byte, a match may overlap the bytes it produces
+        for (uint32_t k = 0; k < matchLength; k++)
+        {
+            out[op + k] = out[op - offset + k];
+        }
+        op += matchLength;
+    }
+
+    return op == outLength;
+}
@@ -1,38 +1,141 @@
 #include "RFIDController.h"
+#include "PN532SpiTransport.h"
+#include "PayloadCodec.h"
+#include "Stats.h"
+#include <mbedtls/sha256.h>
 
-RFIDController::RFIDController()
+// Pages fetched per NTAG FAST_READ, keeps the response well inside one PN532 frame
+#define NTAG_FAST_READ_PAGES 32
+
+// Key slots tried on payload blocks: Key B is what ENROLL sets, Key A covers stock keyed the other way
+static const AuthSlot DATA_SLOTS[] = {AuthSlot::USER_KEY_B, AuthSlot::USER_KEY_A};
+// Key slots tried on a blank sector trailer: Key A has trailer write access with transport access bits
+static const AuthSlot FACTORY_SLOTS[] = {AuthSlot::FACTORY_KEY_A, AuthSlot::FACTORY_KEY_B};
+
+// Moves slot to the front of the probe order, so the next sector tries it first
+static void promoteSlot(AuthSlot *slots, uint8_t count, AuthSlot slot)
 {
-#ifdef ESP32C3_BOARD
-    ssPin = 7;
-    resetPin = 0;
-#endif
+    for (uint8_t i = 1; i < count && slot != AuthSlot::UNKNOWN; i++)
+    {
+        if (slots[i] == slot)
+        {
+            slots[i] = slots[0];
+            slots[0] = slot;
+        }
+    }
+}
 
-#ifdef ESP32_BOARD
-    ssPin = 5;
-    resetPin = 4;
-#endif
+static const uint8_t FACTORY_KEY[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// Metadata block flags (byte 0). Cards written by earlier firmware have none set.
+#define METADATA_SECTOR_MAP 0x01 // Bytes 3-7 list the sectors holding non-zero payload bytes
+#define METADATA_COMPRESSED 0x02 // The payload is LZ4 compressed, bytes 8-9 hold its original length
+#define METADATA_CHECKSUMS 0x04  // A sector checksum table follows the payload, bytes 10-13 hold its CRC and the metadata CRC
+
+// CRC-16/CCITT-FALSE, start from 0xFFFF
+static uint16_t crc16(uint16_t crc, const uint8_t *data, uint16_t length)
+{
+    for (uint16_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
 
+// CRC-16 of the payload blocks below dataEnd, one per sector in plan order.
+// Returns the number of sectors, the checksum table holds two bytes for each.
+static uint8_t sectorChecksums(const CardLayout &layout, const uint8_t *data, const BlockSlot *slots, uint16_t slotCount,
+                               uint16_t dataEnd, uint8_t *sectors, uint16_t *checksums)
+{
+    uint8_t count = 0;
+    for (uint16_t i = 0; i < slotCount; i++)
+    {
+        // Blocks of the table itself share sectors with payload blocks, they are left out
+        if (slots[i].offset >= dataEnd)
+        {
+            continue;
+        }
+        uint8_t sector = layout.sectorOf(slots[i].block);
+        if (count == 0 || sectors[count - 1] != sector)
+        {
+            sectors[count] = sector;
+            checksums[count] = 0xFFFF;
+            count++;
+        }
+        checksums[count - 1] = crc16(checksums[count - 1], &data[slots[i].offset], 16);
+    }
+    return count;
+}
+
+// Authentications and block exchanges writing these slots takes, all-zero sectors left out
+static uint16_t exchangeCost(const CardLayout &layout, const BlockSlot *slots, uint16_t slotCount, uint64_t sectorMap)
+{
+    uint16_t cost = 0;
+    int lastSector = -1;
+    for (uint16_t i = 0; i < slotCount; i++)
+    {
+        int sector = layout.sectorOf(slots[i].block);
+        if (!(sectorMap & ((uint64_t)1 << sector)))
+        {
+            continue;
+        }
+        if (sector != lastSector)
+        {
+            cost++;
+            lastSector = sector;
+        }
+        cost++;
+    }
+    return cost;
+}
+
+RFIDController::RFIDController()
+{
+    ssPin = 0;
+    resetPin = 0;
+    transport = nullptr;
     nfc = nullptr;
     isNFCPowered = false;
+    pagesUnlocked = false;
+    tagSelected = false;
+    retryBudget = BLOCK_RETRY_BUDGET;
+    holdPower = false;
+    inventoryCount = 0;
+    addressedUidLength = 0;
 }
 
-void RFIDController::begin()
+void RFIDController::begin(uint8_t ssPin, uint8_t resetPin, uint8_t readerIndex)
 {
+    this->ssPin = ssPin;
+    this->resetPin = resetPin;
     pinMode(resetPin, OUTPUT);
 
     // Start with NFC powered down for power optimization
     powerDownNFC();
 
-    nfc = new Adafruit_PN532(ssPin);
+    transport = new PN532SpiTransport(ssPin);
+    transport->begin();
+    transport->setTraceId(readerIndex);
+    nfc = new PN532Driver(transport);
 }
 
 bool RFIDController::powerUpNFC()
 {
     if (isNFCPowered)
     {
-        return true;
+        // Held powered by ARM with the field parked off, switching it on is all that is needed
+        uint32_t start = micros();
+        bool fieldOn = nfc->setRfField(true) || initializeNFC();
+        Stats::record(Phase::POWER_UP, micros() - start);
+        return fieldOn;
     }
 
+    uint32_t start = micros();
+
     // Bring RSTPDN pin HIGH to power up the PN532
     digitalWrite(resetPin, HIGH);
 
@@ -42,12 +145,20 @@ bool RFIDController::powerUpNFC()
 
     // Initialize the NFC module
     bool initResult = initializeNFC();
+    Stats::record(Phase::POWER_UP, micros() - start);
 
     return initResult;
 }
 
 void RFIDController::powerDownNFC()
 {
+    if (holdPower)
+    {
+        // Stay initialized for the next card, dropping the field resets the tag that was just served
+        nfc->setRfField(false);
+        return;
+    }
+
     // Set RSTPDN pin LOW to power down the PN532
     digitalWrite(resetPin, LOW);
 
@@ -61,7 +172,10 @@ bool RFIDController::initializeNFC()
         return false;
     }
 
-    nfc->begin();
+    if (!nfc->begin())
+    {
+        return false;
+    }
 
     uint32_t versiondata = nfc->getFirmwareVersion();
     if (!versiondata)
@@ -69,8 +183,9 @@ bool RFIDController::initializeNFC()
         return false;
     }
 
-    // Set the max number of retry attempts to read from a card
-    nfc->setPassiveActivationRetries(0xFE);
+    // Set the max number of retry attempts to read from a card. A re-initialization while armed
+    // keeps the short poll count, the long one would hold up DISARM
+    nfc->setPassiveActivationRetries(holdPower ? ARM_POLL_RETRIES : 0xFE);
 
     return true;
 }
@@ -88,15 +203,485 @@ String RFIDController::scanUID()
         return "";
     }
 
-    uint8_t uid[] = {0, 0, 0, 0, 0, 0, 0};
-    uint8_t uidLength;
+    String result = "";
+    if (detectTag())
+    {
+        result = bytesToHex(target.uid, target.uidLength);
+    }
+
+    // Power down NFC module to save power
+    powerDownNFC();
+
+    return result;
+}
+
+String RFIDController::inventory()
+{
+    if (!nfc)
+    {
+        return "";
+    }
+
+    // Power up NFC module for operation
+    if (!powerUpNFC())
+    {
+        return "";
+    }
+
+    inventoryCount = 0;
+
+    // InListPassiveTarget resolves at most two tags. Releasing them halts them, so the next
+    // round only sees the tags that lost anticollision, until one comes back short or with nothing new
+    while (inventoryCount < MAX_INVENTORY_TAGS)
+    {
+        TargetInfo found[2];
+        uint8_t count = nfc->listPassiveTargets(found, 2);
+        uint8_t added = 0;
+
+        for (uint8_t i = 0; i < count && inventoryCount < MAX_INVENTORY_TAGS; i++)
+        {
+            if (inventoryType(found[i]) == CardType::UNKNOWN)
+            {
+                inventoryTags[inventoryCount] = found[i];
+                inventoryTypes[inventoryCount] = identifyTag(found[i]);
+                inventoryCount++;
+                added++;
+            }
+        }
+
+        nfc->releaseTarget(0);
+
+        if (count < 2 || added == 0)
+        {
+            break;
+        }
+    }
+
+    String result = "COUNT " + String(inventoryCount);
+    for (uint8_t i = 0; i < inventoryCount; i++)
+    {
+        const TargetInfo &tag = inventoryTags[i];
+        uint8_t atqa[2] = {(uint8_t)(tag.atqa >> 8), (uint8_t)(tag.atqa & 0xFF)};
+        result += " TAG " + bytesToHex(tag.uid, tag.uidLength) + " " + bytesToHex(atqa, 2) + " " +
+                  bytesToHex(&tag.sak, 1) + " " + CardLayout(inventoryTypes[i]).typeName();
+    }
+
+    // Power down NFC module to save power
+    powerDownNFC();
+
+    return result;
+}
+
+bool RFIDController::addressTag(const String &uid)
+{
+    // An empty UID goes back to whichever tag answers first
+    addressedUidLength = uid.length() / 2;
+    if (addressedUidLength > sizeof(addressedUid))
+    {
+        addressedUidLength = 0;
+        return false;
+    }
+    hexToBytes(uid, addressedUid);
+    return true;
+}
+
+void RFIDController::setArmed(bool armed)
+{
+    if (!nfc)
+    {
+        return;
+    }
+
+    holdPower = armed;
+    if (armed)
+    {
+        // Short detection attempts so polling for the next card does not hold up the serial loop
+        if (powerUpNFC())
+        {
+            nfc->setPassiveActivationRetries(ARM_POLL_RETRIES);
+        }
+    }
+    else if (isNFCPowered)
+    {
+        nfc->setPassiveActivationRetries(0xFE);
+        powerDownNFC();
+    }
+}
+
+String RFIDController::pollTag()
+{
+    // Same as SCAN_UID, but with the short retry count set up by setArmed
+    return scanUID();
+}
 
-    bool success = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, &uid[0], &uidLength);
+String RFIDController::cardInfo()
+{
+    if (!nfc)
+    {
+        return "";
+    }
+
+    // Power up NFC module for operation
+    if (!powerUpNFC())
+    {
+        return "";
+    }
 
     String result = "";
-    if (success)
+    if (detectTag())
+    {
+        char codes[16];
+        snprintf(codes, sizeof(codes), "%04X SAK %02X", target.atqa, target.sak);
+
+        result = "TYPE " + layout.typeName() +
+                 " UID " + bytesToHex(target.uid, target.uidLength) +
+                 " ATQA " + String(codes) +
+                 " SECTORS " + String(layout.sectorCount()) +
+                 " KEY_LENGTH " + String(layout.sectorCount() > 16 ? 480 : 192) +
+                 " CAPACITY " + String(layout.capacity());
+    }
+
+    // Power down NFC module to save power
+    powerDownNFC();
+
+    return result;
+}
+
+ReadResult RFIDController::readData(const String &key)
+{
+    uint16_t replyLength = 0;
+    ReadResult result = readPayload(key, &replyLength);
+    if (result.status == ReadStatus::DONE)
+    {
+        result.data = bytesToHex(payload, replyLength);
+    }
+    return result;
+}
+
+ReadResult RFIDController::readDigest(const String &key)
+{
+    uint16_t replyLength = 0;
+    ReadResult result = readPayload(key, &replyLength);
+    if (result.status == ReadStatus::DONE)
+    {
+        // Hashed where READ would hex-encode, on the SHA accelerator through mbedtls
+        uint8_t digest[32];
+        mbedtls_sha256(payload, replyLength, digest, 0);
+        result.data = bytesToHex(digest, sizeof(digest));
+    }
+    return result;
+}
+
+ReadResult RFIDController::readPayload(const String &key, uint16_t *replyLength)
+{
+    ReadResult result;
+    result.status = ReadStatus::FAILED;
+    result.uid = "";
+    result.data = "";
+    result.verified = false;
+    result.sectors = 0;
+    result.corrupted = 0;
+
+    if (!nfc)
+    {
+        return result;
+    }
+
+    // Power up NFC module for operation
+    if (!powerUpNFC())
+    {
+        return result;
+    }
+
+    // First, find a card and work out its layout
+    if (!detectTag() || layout.type() == CardType::UNKNOWN)
+    {
+        powerDownNFC();
+        return result;
+    }
+
+    result.uid = bytesToHex(target.uid, target.uidLength);
+
+    // Convert keys from hex string to bytes (6 bytes per sector, 16 or 40 sectors)
+    uint8_t keyBytes[CardLayout::MAX_SECTORS * 6];
+    uint8_t keySectors = hexToBytes(key, keyBytes) / 6;
+
+    bool allSuccess;
+
+    if (layout.isPageBased())
+    {
+        allSuccess = readPages(keyBytes, replyLength);
+    }
+    else
+    {
+        result.sectors = layout.sectorCount();
+        allSuccess = readBlocks(keyBytes, keySectors, replyLength, result);
+    }
+
+    if (allSuccess)
+    {
+        result.status = ReadStatus::DONE;
+    }
+
+    // Power down NFC module to save power
+    powerDownNFC();
+
+    return result;
+}
+
+bool RFIDController::readBlocks(const uint8_t *keyBytes, uint8_t keySectors, uint16_t *replyLength, ReadResult &result)
+{
+    // Read payload length to determine how many blocks to read
+    PayloadMetadata metadata;
+    ReadStatus metadataStatus = readMetadata(keyBytes, metadata);
+    if (metadataStatus != ReadStatus::DONE)
+    {
+        result.status = metadataStatus;
+        if (metadataStatus == ReadStatus::CORRUPT)
+        {
+            result.corrupted = (uint64_t)1 << layout.sectorOf(CardLayout::METADATA_BLOCK);
+        }
+        return false;
+    }
+    uint16_t payloadLength = metadata.length;
+
+    // Records up to the legacy 512-byte area are always reported at that fixed size
+    *replyLength = layout.capacity() < 512 ? layout.capacity() : 512;
+    if (metadata.originalLength > *replyLength)
+    {
+        *replyLength = metadata.originalLength;
+    }
+
+    // Work out which blocks hold the payload and its checksum table, one authentication per sector
+    BlockSlot slots[CardLayout::MAX_DATA_BLOCKS];
+    uint16_t slotCount = layout.plan(storedLength(metadata), slots);
+
+    memset(payload, 0, sizeof(payload));
+
+    if (!readSectors(keyBytes, keySectors, slots, slotCount, metadata.sectorMap))
+    {
+        return false;
+    }
+
+    // Sectors that fail their checksum are read again, a tag moving away mid-read corrupts
+    // single blocks; whatever still fails was left behind by an interrupted write
+    if (metadata.checksummed)
+    {
+        uint64_t corrupted = corruptedSectors(metadata, slots, slotCount);
+        for (uint8_t attempt = 0; corrupted && attempt < SECTOR_REREAD_LIMIT; attempt++)
+        {
+            if (!readSectors(keyBytes, keySectors, slots, slotCount, corrupted & metadata.sectorMap))
+            {
+                return false;
+            }
+            corrupted = corruptedSectors(metadata, slots, slotCount);
+        }
+        if (corrupted)
+        {
+            result.status = ReadStatus::CORRUPT;
+            result.corrupted = corrupted;
+            return false;
+        }
+        result.verified = true;
+    }
+
+    // The reply only holds the payload, the checksum table past it is cleared again
+    memset(&payload[payloadLength], 0, sizeof(payload) - payloadLength);
+
+    // Expanded through the staging buffer; the compressed stream is shorter than the
+    // original, so everything past the original length is still zero
+    if (metadata.compressed)
+    {
+        if (!PayloadCodec::decompress(payload, payloadLength, staging, metadata.originalLength))
+        {
+            return false;
+        }
+        memcpy(payload, staging, metadata.originalLength);
+    }
+
+    return true;
+}
+
+bool RFIDController::readSectors(const uint8_t *keyBytes, uint8_t keySectors, const BlockSlot *slots, uint16_t slotCount, uint64_t sectorMap)
+{
+    int authenticatedSector = -1;
+
+    for (uint16_t i = 0; i < slotCount; i++)
+    {
+        int sector = layout.sectorOf(slots[i].block);
+
+        // Sectors left out of the map hold only zeros, already in the payload buffer
+        if (!(sectorMap & ((uint64_t)1 << sector)))
+        {
+            continue;
+        }
+
+        if (sector != authenticatedSector)
+        {
+            if (sector >= keySectors ||
+                authenticateSector(slots[i].block, &keyBytes[sector * 6], DATA_SLOTS, 2) == AuthSlot::UNKNOWN)
+            {
+                return false;
+            }
+            authenticatedSector = sector;
+        }
+
+        // Copy block data straight into its payload position
+        uint8_t retries = 0;
+        bool success = nfc->mifareReadBlock(target, slots[i].block, &payload[slots[i].offset]);
+        while (!success && recoverBlock(slots[i].block, &keyBytes[sector * 6], retries))
+        {
+            success = nfc->mifareReadBlock(target, slots[i].block, &payload[slots[i].offset]);
+        }
+        if (!success)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint64_t RFIDController::corruptedSectors(const PayloadMetadata &metadata, const BlockSlot *slots, uint16_t slotCount)
+{
+    uint16_t tableOffset = (metadata.length + 15) / 16 * 16;
+    uint8_t sectors[CardLayout::MAX_SECTORS];
+    uint16_t checksums[CardLayout::MAX_SECTORS];
+    uint8_t count = sectorChecksums(layout, payload, slots, slotCount, tableOffset, sectors, checksums);
+
+    // A damaged table says nothing about the payload, only its own sectors are suspect
+    uint64_t corrupted = 0;
+    if (crc16(0xFFFF, &payload[tableOffset], count * 2) != metadata.tableCrc)
+    {
+        for (uint16_t i = 0; i < slotCount; i++)
+        {
+            if (slots[i].offset >= tableOffset)
+            {
+                corrupted |= (uint64_t)1 << layout.sectorOf(slots[i].block);
+            }
+        }
+        return corrupted;
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint16_t stored = (payload[tableOffset + i * 2] << 8) | payload[tableOffset + i * 2 + 1];
+        if (checksums[i] != stored)
+        {
+            corrupted |= (uint64_t)1 << sectors[i];
+        }
+    }
+    return corrupted;
+}
+
+bool RFIDController::readPages(const uint8_t *keyBytes, uint16_t *replyLength)
+{
+    // Metadata page followed by the payload pages, staged at the start of the payload buffer
+    uint8_t userPages = layout.userPageCount();
+    uint8_t firstBurst = userPages < NTAG_FAST_READ_PAGES ? userPages : NTAG_FAST_READ_PAGES;
+
+    // The first burst returns the metadata together with the start of the payload
+    if (!readPageRange(keyBytes, CardLayout::METADATA_PAGE, firstBurst, payload))
+    {
+        return false;
+    }
+
+    // Payload length is stored in bytes 1-2 (big-endian), as in the MIFARE Classic metadata block
+    uint16_t payloadLength = (payload[1] << 8) | payload[2];
+    if (payloadLength > layout.capacity())
+    {
+        payloadLength = layout.capacity();
+    }
+
+    uint8_t pagesNeeded = 1 + (payloadLength + 3) / 4;
+    if (pagesNeeded > firstBurst)
+    {
+        if (!readPageRange(keyBytes, CardLayout::METADATA_PAGE + firstBurst, pagesNeeded - firstBurst, &payload[firstBurst * 4]))
+        {
+            return false;
+        }
+    }
+
+    // Drop the metadata page and clear anything past the stored length
+    memmove(payload, payload + 4, payloadLength);
+
+    *replyLength = layout.capacity() < 512 ? layout.capacity() : 512;
+    if (payloadLength > *replyLength)
+    {
+        *replyLength = payloadLength;
+    }
+    memset(payload + payloadLength, 0, *replyLength - payloadLength);
+
+    return true;
+}
+
+WriteResult RFIDController::writeData(const String &key, const String &data)
+{
+    return writeDataFrom(key, data, 0, "");
+}
+
+WriteResult RFIDController::resumeWrite(const String &key, const String &uid, uint16_t fromBlock, const String &data)
+{
+    return writeDataFrom(key, data, fromBlock, uid);
+}
+
+WriteResult RFIDController::writeDataFrom(const String &key, const String &data, uint16_t fromBlock, const String &expectedUid)
+{
+    WriteResult result;
+    result.status = WriteStatus::NO_TAG;
+    result.uid = "";
+    result.blocksWritten = fromBlock;
+    result.blocksTotal = 0;
+
+    if (!nfc)
+    {
+        return result;
+    }
+
+    // Power up NFC module for operation
+    if (!powerUpNFC())
+    {
+        return result;
+    }
+
+    // First, find a card
+    if (!detectTag())
+    {
+        powerDownNFC();
+        return result;
+    }
+
+    result.uid = bytesToHex(target.uid, target.uidLength);
+
+    // A resumed write must land on the same tag the interrupted write started on
+    if (expectedUid.length() > 0 && result.uid != expectedUid)
+    {
+        result.status = WriteStatus::UID_MISMATCH;
+        powerDownNFC();
+        return result;
+    }
+
+    // Convert keys from hex string to bytes (6 bytes per sector, 16 or 40 sectors)
+    uint8_t keyBytes[CardLayout::MAX_SECTORS * 6];
+    uint8_t keySectors = hexToBytes(key, keyBytes) / 6;
+
+    // Convert data from hex string to bytes, anything past the given data is zero
+    uint16_t payloadLength = calculatePayloadLength(data);
+    memset(payload, 0, sizeof(payload));
+    hexToBytes(data, payload);
+
+    if (layout.type() == CardType::UNKNOWN || payloadLength > layout.capacity())
     {
-        result = bytesToHex(uid, uidLength);
+        result.status = WriteStatus::TOO_LARGE;
+        result.blocksWritten = 0;
+    }
+    else if (layout.isPageBased())
+    {
+        writePages(keyBytes, payloadLength, fromBlock, result);
+    }
+    else
+    {
+        writeBlocks(keyBytes, keySectors, payloadLength, fromBlock, result);
     }
 
     // Power down NFC module to save power
@@ -105,393 +690,711 @@ String RFIDController::scanUID()
     return result;
 }
 
-String RFIDController::readData(const String &key)
+void RFIDController::writeBlocks(const uint8_t *keyBytes, uint8_t keySectors, uint16_t payloadLength, uint16_t fromBlock, WriteResult &result)
 {
+    // Work out which blocks the payload occupies on this card
+    BlockSlot slots[CardLayout::MAX_DATA_BLOCKS];
+    uint16_t slotCount = layout.plan(payloadLength, slots);
+
+    PayloadMetadata metadata;
+    metadata.length = payloadLength;
+    metadata.originalLength = payloadLength;
+    metadata.compressed = false;
+    metadata.sectorMap = usedSectors(payload, slots, slotCount);
+    metadata.checksummed = false;
+    metadata.tableCrc = 0;
+#if PAYLOAD_COMPRESSION
+    compressPayload(metadata, slots, slotCount);
+#endif
+    appendChecksums(metadata, slots, slotCount);
+
+    // Every sector the payload touches must have a key
+    if (slotCount > 0 && layout.sectorOf(slots[slotCount - 1].block) >= keySectors)
+    {
+        result.status = WriteStatus::TOO_LARGE;
+        result.blocksWritten = 0;
+        return;
+    }
+
+    result.status = WriteStatus::FAILED;
+    result.blocksTotal = slotCount;
+
+    if (fromBlock > result.blocksTotal)
+    {
+        // Offset does not belong to this payload, nothing sensible to resume
+        result.blocksWritten = 0;
+        return;
+    }
+
+    // The metadata is written before any data block, so a resumed write already has it
+    if (fromBlock == 0)
+    {
+        if (!writeMetadata(keyBytes, metadata))
+        {
+            return;
+        }
+    }
+
+    int authenticatedSector = -1;
+
+    // Write the planned blocks in order, starting at the resume offset.
+    // blocksWritten only advances once the tag has acknowledged the block.
+    for (uint16_t index = fromBlock; index < result.blocksTotal; index++)
+    {
+        int sector = layout.sectorOf(slots[index].block);
+
+        // All-zero sectors are neither authenticated nor written, READ fills them in from the map
+        if (!(metadata.sectorMap & ((uint64_t)1 << sector)))
+        {
+            result.blocksWritten = index + 1;
+            continue;
+        }
+
+        // One authentication covers every block of the sector
+        if (sector != authenticatedSector)
+        {
+            if (authenticateSector(slots[index].block, &keyBytes[sector * 6], DATA_SLOTS, 2) == AuthSlot::UNKNOWN)
+            {
+                return;
+            }
+            authenticatedSector = sector;
+        }
+
+        // Rewriting a block the tag took without acknowledging it stores the same data again
+        uint8_t retries = 0;
+        bool success = nfc->mifareWriteBlock(target, slots[index].block, &payload[slots[index].offset]);
+        while (!success && recoverBlock(slots[index].block, &keyBytes[sector * 6], retries))
+        {
+            success = nfc->mifareWriteBlock(target, slots[index].block, &payload[slots[index].offset]);
+        }
+        if (!success)
+        {
+            return;
+        }
+
+        result.blocksWritten = index + 1;
+    }
+
+    result.status = WriteStatus::DONE;
+}
+
+void RFIDController::writePages(const uint8_t *keyBytes, uint16_t payloadLength, uint16_t fromBlock, WriteResult &result)
+{
+    result.status = WriteStatus::FAILED;
+    result.blocksTotal = (payloadLength + 3) / 4;
+
+    if (fromBlock > result.blocksTotal)
+    {
+        // Offset does not belong to this payload, nothing sensible to resume
+        result.blocksWritten = 0;
+        return;
+    }
+
+    // NTAG writes are one page per command, so fetch the current contents in a few FAST_READ
+    // bursts and only write the pages that actually change
+    uint8_t current[CardLayout::MAX_USER_PAGES * 4];
+    uint8_t pages = 1 + result.blocksTotal;
+    if (!readPageRange(keyBytes, CardLayout::METADATA_PAGE, pages, current))
+    {
+        return;
+    }
+
+    // The length metadata is written before any data page, so a resumed write already has it
+    if (fromBlock == 0)
+    {
+        uint8_t metadata[4] = {0x00, (uint8_t)((payloadLength >> 8) & 0xFF), (uint8_t)(payloadLength & 0xFF), 0x00};
+        if (memcmp(current, metadata, 4) != 0 && !writePage(keyBytes, CardLayout::METADATA_PAGE, metadata))
+        {
+            return;
+        }
+    }
+
+    // blocksWritten counts data pages in order and only advances once the tag has acknowledged them
+    for (uint16_t index = fromBlock; index < result.blocksTotal; index++)
+    {
+        uint8_t *pageData = &payload[index * 4];
+        if (memcmp(&current[(index + 1) * 4], pageData, 4) != 0 &&
+            !writePage(keyBytes, CardLayout::METADATA_PAGE + 1 + index, pageData))
+        {
+            return;
+        }
+
+        result.blocksWritten = index + 1;
+    }
+
+    result.status = WriteStatus::DONE;
+}
+
+bool RFIDController::readPageRange(const uint8_t *keyBytes, uint8_t firstPage, uint8_t count, uint8_t *data)
+{
+    uint8_t done = 0;
+    while (done < count)
+    {
+        uint8_t page = firstPage + done;
+        uint8_t chunk;
+        bool success;
+
+        if (layout.supportsFastRead())
+        {
+            // FAST_READ returns a whole page range in one exchange
+            chunk = count - done < NTAG_FAST_READ_PAGES ? count - done : NTAG_FAST_READ_PAGES;
+            success = nfc->ntagFastRead(target, page, page + chunk - 1, &data[done * 4]);
+        }
+        else
+        {
+            // READ always returns four pages
+            uint8_t pageData[16];
+            chunk = count - done < 4 ? count - done : 4;
+            success = nfc->ntagReadPages(target, page, pageData);
+            if (success)
+            {
+                memcpy(&data[done * 4], pageData, chunk * 4);
+            }
+        }
+
+        if (!success)
+        {
+            // A protected page NAKs until PWD_AUTH, unlock once and retry
+            if (!unlockPages(keyBytes))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        done += chunk;
+    }
+
+    return true;
+}
+
+bool RFIDController::writePage(const uint8_t *keyBytes, uint8_t page, const uint8_t *data)
+{
+    if (nfc->ntagWritePage(target, page, data))
+    {
+        return true;
+    }
+
+    // A write protected page NAKs until PWD_AUTH, unlock once and retry
+    return unlockPages(keyBytes) && nfc->ntagWritePage(target, page, data);
+}
+
+bool RFIDController::unlockPages(const uint8_t *keyBytes)
+{
+    if (pagesUnlocked)
+    {
+        return false;
+    }
+    pagesUnlocked = true;
+
+    // The NAK sent the tag back to idle, select it again before authenticating.
+    // The password is the first 4 bytes of the sector 0 key.
+    return nfc->listPassiveTargets(&target, 1) > 0 && nfc->ntagPasswordAuth(target, keyBytes);
+}
+
+EnrollResult RFIDController::enrollKey(const String &key)
+{
+    EnrollResult result = {EnrollStatus::NO_TAG, "", 0, 0, 0, 0};
+
     if (!nfc)
     {
-        return "";
+        return result;
     }
 
     // Power up NFC module for operation
     if (!powerUpNFC())
     {
-        return "";
+        return result;
     }
 
-    uint8_t uid[] = {0, 0, 0, 0, 0, 0, 0};
-    uint8_t uidLength;
-
-    // First, find a card
-    bool success = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, &uid[0], &uidLength);
-    if (!success)
+    // First, find a card. Only MIFARE Classic tags have sector trailers to enroll
+    if (!detectTag())
     {
         powerDownNFC();
-        return "";
+        return result;
     }
 
-    // Read payload length to determine how many blocks to read
-    uint16_t payloadLength = readPayloadLength(key, uid, uidLength);
-
-    // If payload length is 0, return all zeros
-    if (payloadLength == 0)
+    result.uid = bytesToHex(target.uid, target.uidLength);
+    if (layout.type() == CardType::UNKNOWN || layout.isPageBased())
     {
+        result.status = EnrollStatus::UNSUPPORTED;
         powerDownNFC();
-        // Return 512 bytes of zeros (1024 hex characters)
-        String zeroData = "";
-        for (int i = 0; i < 1024; i++)
-        {
-            zeroData += "0";
-        }
-        return zeroData;
+        return result;
     }
 
-    // Calculate number of sectors needed (each sector has 2 blocks x 16 bytes = 32 bytes)
-    int sectorsNeeded = (payloadLength + 31) / 32; // Round up
-    if (sectorsNeeded > 16) sectorsNeeded = 16; // Cap at maximum
-    if (sectorsNeeded == 0) sectorsNeeded = 1; // Read at least 1 sector
+    // Convert key from hex string to bytes (6 bytes per sector, 16 or 40 sectors)
+    uint8_t keyBytes[CardLayout::MAX_SECTORS * 6];
+    uint8_t keySectors = hexToBytes(key, keyBytes) / 6;
 
-    // Convert keys from hex string to bytes (96 bytes = 16 sectors x 6 bytes each)
-    uint8_t keyBytes[96];
-    hexToBytes(key, keyBytes);
+    // Enroll every sector of the card the key covers
+    result.sectors = layout.sectorCount() < keySectors ? layout.sectorCount() : keySectors;
 
-    String result = "";
-    uint8_t allData[512]; // 16 sectors x 2 blocks x 16 bytes = 512 bytes
-    int dataIndex = 0;
-    bool allSuccess = true;
+    // Probe with the target Key B first so sectors enrolled by an earlier, interrupted ENROLL are
+    // left alone. Whichever slot opened the previous sector leads for the next one: a blank card
+    // then costs one factory authentication per sector instead of a failed Key B probe each time
+    AuthSlot probe[] = {AuthSlot::USER_KEY_B, AuthSlot::FACTORY_KEY_A, AuthSlot::FACTORY_KEY_B};
 
-    // Read only the necessary sectors based on payload length
-    for (int sector = 0; sector < sectorsNeeded; sector++)
+    for (uint8_t sector = 0; sector < result.sectors; sector++)
     {
-        // Get the key for this sector (6 bytes per sector)
-        uint8_t sectorKey[6];
-        for (int i = 0; i < 6; i++)
+        uint8_t trailer = layout.trailerBlock(sector);
+        uint64_t bit = (uint64_t)1 << sector;
+
+        AuthSlot slot = authenticateSector(trailer, &keyBytes[sector * 6], probe, 3);
+        if (slot == AuthSlot::USER_KEY_B)
         {
-            sectorKey[i] = keyBytes[sector * 6 + i];
+            result.skipped |= bit;
         }
-
-        // Calculate block numbers for this sector
-        int block1 = sector * 4 + 1; // Block 1 of sector
-        int block2 = sector * 4 + 2; // Block 2 of sector
-
-        // Authenticate and read block 1
-        if (nfc->mifareclassic_AuthenticateBlock(uid, uidLength, block1, 1, sectorKey))
+        else if (slot != AuthSlot::UNKNOWN)
         {
-            uint8_t blockData[16];
-            success = nfc->mifareclassic_ReadDataBlock(block1, blockData);
-            if (success)
+            uint8_t sectorTrailerData[16];
+            buildSectorTrailer(sector, &keyBytes[sector * 6], sectorTrailerData);
+
+            if (nfc->mifareWriteBlock(target, trailer, sectorTrailerData))
             {
-                // Copy block data to result array
-                for (int i = 0; i < 16; i++)
+                // From now on the sector opens with the enrolled Key B
+                authCache.remember(target.uid, target.uidLength, sector, AuthSlot::USER_KEY_B);
+                result.enrolled |= bit;
+
+                // Re-select the card after writing sector trailer to reset authentication state
+                // This is necessary for genuine Mifare cards
+                if (sector + 1 < result.sectors && !reselectTag())
                 {
-                    allData[dataIndex++] = blockData[i];
+                    break;
                 }
             }
             else
             {
-                allSuccess = false;
-                break;
+                result.failed |= bit;
+                // A rejected write halts the tag like a rejected authentication
+                if (!reselectTag())
+                {
+                    break;
+                }
             }
         }
         else
         {
-            allSuccess = false;
-            break;
-        }
-
-        // Authenticate and read block 2
-        if (nfc->mifareclassic_AuthenticateBlock(uid, uidLength, block2, 1, sectorKey))
-        {
-            uint8_t blockData[16];
-            success = nfc->mifareclassic_ReadDataBlock(block2, blockData);
-            if (success)
-            {
-                // Copy block data to result array
-                for (int i = 0; i < 16; i++)
-                {
-                    allData[dataIndex++] = blockData[i];
-                }
-            }
-            else
+            // authenticateSector already re-selected the tag, the next sector can still be tried
+            result.failed |= bit;
+            if (!tagSelected)
             {
-                allSuccess = false;
                 break;
             }
         }
-        else
-        {
-            allSuccess = false;
-            break;
-        }
-    }
 
-    if (allSuccess)
-    {
-        // Fill any unread bytes with zeros
-        for (int i = dataIndex; i < 512; i++)
-        {
-            allData[i] = 0x00;
-        }
-        result = bytesToHex(allData, 512);
+        promoteSlot(probe, 3, slot);
     }
 
+    // Sectors never reached because the tag left the field count as failed
+    uint64_t covered = ((uint64_t)1 << result.sectors) - 1;
+    result.failed |= covered & ~(result.enrolled | result.skipped);
+    result.status = result.failed ? EnrollStatus::FAILED : EnrollStatus::DONE;
+
     // Power down NFC module to save power
     powerDownNFC();
 
     return result;
 }
 
-bool RFIDController::writeData(const String &key, const String &data)
+ProvisionResult RFIDController::provision(const String &key, const String &data, bool verify)
 {
+    ProvisionResult result;
+    result.enroll = {EnrollStatus::NO_TAG, "", 0, 0, 0, 0};
+    result.write = {WriteStatus::NO_TAG, "", 0, 0};
+    result.verified = false;
+
     if (!nfc)
     {
-        return false;
+        return result;
     }
 
     // Power up NFC module for operation
     if (!powerUpNFC())
     {
-        return false;
+        return result;
     }
 
-    uint8_t uid[] = {0, 0, 0, 0, 0, 0, 0};
-    uint8_t uidLength;
+    // One detection for the whole card, every sector is then keyed and filled in the same session
+    if (!detectTag())
+    {
+        powerDownNFC();
+        return result;
+    }
 
-    // First, find a card
-    bool success = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, &uid[0], &uidLength);
-    if (!success)
+    result.enroll.uid = result.write.uid = bytesToHex(target.uid, target.uidLength);
+    if (layout.type() == CardType::UNKNOWN || layout.isPageBased())
     {
+        result.enroll.status = EnrollStatus::UNSUPPORTED;
         powerDownNFC();
-        return false;
+        return result;
     }
 
-    // Calculate and store payload length
+    // Convert keys from hex string to bytes (6 bytes per sector, 16 or 40 sectors)
+    uint8_t keyBytes[CardLayout::MAX_SECTORS * 6];
+    uint8_t keySectors = hexToBytes(key, keyBytes) / 6;
+    result.enroll.sectors = layout.sectorCount() < keySectors ? layout.sectorCount() : keySectors;
+
+    // Convert data from hex string to bytes, anything past the given data is zero
     uint16_t payloadLength = calculatePayloadLength(data);
-    writePayloadLength(key, payloadLength, uid, uidLength);
+    memset(payload, 0, sizeof(payload));
+    hexToBytes(data, payload);
+
+    BlockSlot slots[CardLayout::MAX_DATA_BLOCKS];
+    uint16_t slotCount = layout.plan(payloadLength, slots);
+
+    PayloadMetadata metadata;
+    metadata.length = payloadLength;
+    metadata.originalLength = payloadLength;
+    metadata.compressed = false;
+    metadata.sectorMap = usedSectors(payload, slots, slotCount);
+    metadata.checksummed = false;
+    metadata.tableCrc = 0;
+    if (payloadLength <= layout.capacity())
+    {
+        appendChecksums(metadata, slots, slotCount);
+    }
+    result.write.blocksTotal = slotCount;
 
-    // If payload length is 0 (all zeros), skip actual write
-    if (payloadLength == 0)
+    // The metadata block has to be in a sector the key covers as well
+    uint8_t metadataSector = layout.sectorOf(CardLayout::METADATA_BLOCK);
+    if (payloadLength > layout.capacity() || metadataSector >= result.enroll.sectors ||
+        (slotCount > 0 && layout.sectorOf(slots[slotCount - 1].block) >= result.enroll.sectors))
     {
+        result.enroll.status = EnrollStatus::DONE;
+        result.write.status = WriteStatus::TOO_LARGE;
         powerDownNFC();
-        return true;
+        return result;
     }
 
-    // Calculate number of sectors needed (each sector has 2 blocks x 16 bytes = 32 bytes)
-    int sectorsNeeded = (payloadLength + 31) / 32; // Round up
-    if (sectorsNeeded > 16) sectorsNeeded = 16; // Cap at maximum
-    if (sectorsNeeded == 0) sectorsNeeded = 1; // Write at least 1 sector
-
-    // Convert keys from hex string to bytes (96 bytes = 16 sectors x 6 bytes each)
-    uint8_t keyBytes[96];
-    hexToBytes(key, keyBytes);
-
-    // Convert data from hex string to bytes (512 bytes = 16 sectors x 2 blocks x 16 bytes)
-    uint8_t dataBytes[512];
-    hexToBytes(data, dataBytes);
+    result.enroll.status = EnrollStatus::FAILED;
+    result.write.status = WriteStatus::FAILED;
 
-    bool allSuccess = true;
-    int dataIndex = 0;
+    // Blank cards open with the factory key, a card from an earlier interrupted PROVISION
+    // already opens with the target Key B in the sectors it got through
+    AuthSlot probe[] = {AuthSlot::FACTORY_KEY_A, AuthSlot::FACTORY_KEY_B, AuthSlot::USER_KEY_B};
+    uint16_t index = 0;
 
-    // Write only the necessary sectors based on payload length
-    for (int sector = 0; sector < sectorsNeeded; sector++)
+    for (uint8_t sector = 0; sector < result.enroll.sectors; sector++)
     {
-        // Get the key for this sector (6 bytes per sector)
-        uint8_t sectorKey[6];
-        for (int i = 0; i < 6; i++)
-        {
-            sectorKey[i] = keyBytes[sector * 6 + i];
-        }
+        uint8_t trailer = layout.trailerBlock(sector);
+        const uint8_t *sectorKey = &keyBytes[sector * 6];
 
-        // Calculate block numbers for this sector
-        int block1 = sector * 4 + 1; // Block 1 of sector
-        int block2 = sector * 4 + 2; // Block 2 of sector
-
-        // Prepare data for block 1 (16 bytes)
-        uint8_t block1Data[16];
-        for (int i = 0; i < 16; i++)
+        AuthSlot slot = authenticateSector(trailer, sectorKey, probe, 3);
+        if (slot == AuthSlot::UNKNOWN)
         {
-            block1Data[i] = dataBytes[dataIndex++];
+            powerDownNFC();
+            return result;
         }
+        promoteSlot(probe, 3, slot);
 
-        // Authenticate and write block 1
-        if (nfc->mifareclassic_AuthenticateBlock(uid, uidLength, block1, 1, sectorKey))
+        // Data first while the sector still has its old access bits, then the trailer closes it
+        if (sector == metadataSector)
         {
-            success = nfc->mifareclassic_WriteDataBlock(block1, block1Data);
-            if (!success)
+            uint8_t blockData[16];
+            buildMetadataBlock(metadata, blockData);
+            if (!writeVerifiedBlock(CardLayout::METADATA_BLOCK, blockData, verify))
             {
-                allSuccess = false;
-                break;
+                if (verify && tagSelected)
+                {
+                    result.write.status = WriteStatus::VERIFY_FAILED;
+                }
+                powerDownNFC();
+                return result;
             }
         }
-        else
+
+        for (; index < slotCount && layout.sectorOf(slots[index].block) == sector; index++)
         {
-            allSuccess = false;
-            break;
+            if (!(metadata.sectorMap & ((uint64_t)1 << sector)))
+            {
+                result.write.blocksWritten = index + 1;
+                continue;
+            }
+            if (!writeVerifiedBlock(slots[index].block, &payload[slots[index].offset], verify))
+            {
+                if (verify && tagSelected)
+                {
+                    result.write.status = WriteStatus::VERIFY_FAILED;
+                }
+                powerDownNFC();
+                return result;
+            }
+            result.write.blocksWritten = index + 1;
         }
 
-        // Prepare data for block 2 (16 bytes)
-        uint8_t block2Data[16];
-        for (int i = 0; i < 16; i++)
+        if (slot == AuthSlot::USER_KEY_B)
         {
-            block2Data[i] = dataBytes[dataIndex++];
+            result.enroll.skipped |= (uint64_t)1 << sector;
+            continue;
         }
 
-        // Authenticate and write block 2
-        if (nfc->mifareclassic_AuthenticateBlock(uid, uidLength, block2, 1, sectorKey))
+        uint8_t sectorTrailerData[16];
+        buildSectorTrailer(sector, sectorKey, sectorTrailerData);
+        if (!nfc->mifareWriteBlock(target, trailer, sectorTrailerData))
         {
-            success = nfc->mifareclassic_WriteDataBlock(block2, block2Data);
-            if (!success)
-            {
-                allSuccess = false;
-                break;
-            }
+            powerDownNFC();
+            return result;
         }
-        else
+
+        authCache.remember(target.uid, target.uidLength, sector, AuthSlot::USER_KEY_B);
+        result.enroll.enrolled |= (uint64_t)1 << sector;
+
+        // Re-select after the trailer write like ENROLL, genuine MIFARE cards need it
+        if (sector + 1 < result.enroll.sectors && !reselectTag())
         {
-            allSuccess = false;
-            break;
+            powerDownNFC();
+            return result;
         }
     }
 
+    result.enroll.status = EnrollStatus::DONE;
+    result.write.status = WriteStatus::DONE;
+    result.verified = verify;
+
     // Power down NFC module to save power
     powerDownNFC();
 
-    return allSuccess;
+    return result;
 }
 
-bool RFIDController::enrollKey(const String &key)
+bool RFIDController::writeVerifiedBlock(uint8_t block, const uint8_t *data, bool verify)
 {
-    if (!nfc)
+    if (!nfc->mifareWriteBlock(target, block, data))
     {
+        tagSelected = false;
         return false;
     }
+    if (!verify)
+    {
+        return true;
+    }
 
-    // Power up NFC module for operation
-    if (!powerUpNFC())
+    // Read back under the same authentication, before the trailer changes the keys
+    uint8_t readBack[16];
+    if (!nfc->mifareReadBlock(target, block, readBack))
     {
+        tagSelected = false;
         return false;
     }
+    return memcmp(readBack, data, 16) == 0;
+}
 
-    uint8_t uid[] = {0, 0, 0, 0, 0, 0, 0};
-    uint8_t uidLength;
+void RFIDController::buildSectorTrailer(uint8_t sector, const uint8_t *sectorKey, uint8_t *trailerData)
+{
+    // Key A: "A0A1A2A3A4A5" for sector 0 (MAD key), "D3F7D3F7D3F7" for all others
+    static const uint8_t madKeyA[6] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5};
+    static const uint8_t nfcKeyA[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+    memcpy(trailerData, sector == 0 ? madKeyA : nfcKeyA, 6);
+
+    // Access bits 1F01EE00: data blocks 1-2 and the trailer are only read/written with Key B
+    trailerData[6] = 0x1F;
+    trailerData[7] = 0x01;
+    trailerData[8] = 0xEE;
+    trailerData[9] = 0x00;
+
+    // Key B: the 6-byte key for this sector
+    memcpy(trailerData + 10, sectorKey, 6);
+}
 
-    // First, find a card
-    bool success = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, &uid[0], &uidLength);
-    if (!success)
+String RFIDController::getVersion()
+{
+    return "1.4.0";
+}
+
+bool RFIDController::detectTag()
+{
+    layout = CardLayout();
+    pagesUnlocked = false;
+    tagSelected = false;
+    retryBudget = BLOCK_RETRY_BUDGET;
+
+    uint32_t start = micros();
+    bool found = selectOrListTag();
+    Stats::record(Phase::DETECT, micros() - start);
+    if (!found)
     {
-        powerDownNFC();
         return false;
     }
 
-    // Convert key from hex string to bytes (96 bytes = 16 sectors x 6 bytes each)
-    uint8_t keyBytes[96];
-    hexToBytes(key, keyBytes);
-
-    bool allSuccess = true;
-
-    // Write to block 3 (4th block) of each sector (0-15)
-    for (int sector = 0; sector < 16; sector++)
+    // Tags seen by the last INVENTORY already have their type
+    CardType type = inventoryType(target);
+    if (type == CardType::UNKNOWN)
     {
-        // Get the current key for this sector (6 bytes per sector)
-        uint8_t currentKey[6];
-        for (int i = 0; i < 6; i++)
+        type = identifyTag(target);
+
+        // Original Ultralight NAKs GET_VERSION and has to be selected again
+        if (type == CardType::MIFARE_ULTRALIGHT && !reselectTag())
         {
-            currentKey[i] = keyBytes[sector * 6 + i];
+            return false;
         }
+    }
+
+    layout = CardLayout(type);
+    tagSelected = true;
+    return true;
+}
 
-        // Calculate block 3 (sector trailer) for this sector
-        int block3 = sector * 4 + 3;
+bool RFIDController::selectOrListTag()
+{
+    // A tag addressed with #<uid> is selected directly, even with other tags in the field
+    if (addressedUidLength > 0)
+    {
+        return nfc->selectTarget(addressedUid, addressedUidLength, &target);
+    }
+    return nfc->listPassiveTargets(&target, 1) > 0;
+}
 
-        // Try authenticating with factory default key using both Key A and Key B
-        // Try Key A first as it typically has write access to sector trailer with default access bits
-        uint8_t factoryKey[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-        bool authenticated = nfc->mifareclassic_AuthenticateBlock(uid, uidLength, block3, 0, factoryKey);
+CardType RFIDController::identifyTag(const TargetInfo &tag)
+{
+    CardType type = CardLayout::detect(tag.atqa, tag.sak);
 
-        if (!authenticated)
+    // SAK/ATQA cannot tell NTAG21x variants apart, GET_VERSION can
+    if (type == CardType::MIFARE_ULTRALIGHT)
+    {
+        uint8_t version[8];
+        if (nfc->ntagGetVersion(tag, version))
         {
-            // Try Key B if Key A fails
-            authenticated = nfc->mifareclassic_AuthenticateBlock(uid, uidLength, block3, 1, factoryKey);
+            type = CardLayout::detectFromVersion(version);
         }
+    }
 
-        if (authenticated)
+    return type;
+}
+
+CardType RFIDController::inventoryType(const TargetInfo &tag)
+{
+    for (uint8_t i = 0; i < inventoryCount; i++)
+    {
+        if (inventoryTags[i].uidLength == tag.uidLength && memcmp(inventoryTags[i].uid, tag.uid, tag.uidLength) == 0)
         {
-            // Prepare the sector trailer data with the specified format
-            uint8_t sectorTrailerData[16];
+            return inventoryTypes[i];
+        }
+    }
+    return CardType::UNKNOWN;
+}
 
-            // Set Key A based on sector: "A0A1A2A3A4A5" for sector 0, "D3F7D3F7D3F7" for others
-            if (sector == 0)
-            {
-                // Set Key A: A0A1A2A3A4A5 for sector 0
-                sectorTrailerData[0] = 0xA0;
-                sectorTrailerData[1] = 0xA1;
-                sectorTrailerData[2] = 0xA2;
-                sectorTrailerData[3] = 0xA3;
-                sectorTrailerData[4] = 0xA4;
-                sectorTrailerData[5] = 0xA5;
-            }
-            else
-            {
-                // Set Key A: D3F7D3F7D3F7 for all other sectors
-                sectorTrailerData[0] = 0xD3;
-                sectorTrailerData[1] = 0xF7;
-                sectorTrailerData[2] = 0xD3;
-                sectorTrailerData[3] = 0xF7;
-                sectorTrailerData[4] = 0xD3;
-                sectorTrailerData[5] = 0xF7;
-            }
+bool RFIDController::reselectTag()
+{
+    uint8_t uid[10];
+    uint8_t uidLength = target.uidLength;
+    memcpy(uid, target.uid, uidLength);
 
-            // Set access bits: 1F01EE00 (default access bits)
-            sectorTrailerData[6] = 0x1F;
-            sectorTrailerData[7] = 0x01;
-            sectorTrailerData[8] = 0xEE;
-            sectorTrailerData[9] = 0x00;
+    // The same tag has to come back, anything else would get another tag's keys
+    tagSelected = nfc->selectTarget(uid, uidLength, &target);
+    return tagSelected;
+}
 
-            // Set the 6-byte key for this sector (Key B)
-            for (int i = 0; i < 6; i++)
-            {
-                sectorTrailerData[10 + i] = keyBytes[sector * 6 + i];
-            }
+AuthSlot RFIDController::authenticateSector(uint8_t block, const uint8_t *sectorKey, const AuthSlot *slots, uint8_t slotCount)
+{
+    uint8_t sector = layout.sectorOf(block);
+    AuthSlot cached = authCache.lookup(target.uid, target.uidLength, sector);
+
+    // Try the slot that last worked on this sector first, then the rest in their default order
+    AuthSlot order[4];
+    uint8_t count = 0;
+    int cachedIndex = -1;
+    for (uint8_t i = 0; i < slotCount; i++)
+    {
+        if (slots[i] == cached)
+        {
+            cachedIndex = i;
+            order[count++] = cached;
+        }
+    }
+    for (uint8_t i = 0; i < slotCount; i++)
+    {
+        if (slots[i] != cached)
+        {
+            order[count++] = slots[i];
+        }
+    }
 
-            // Write the sector trailer
-            success = nfc->mifareclassic_WriteDataBlock(block3, sectorTrailerData);
-            if (!success)
+    uint8_t retries = 0;
+    uint8_t i = 0;
+    while (i < count)
+    {
+        bool factory = order[i] == AuthSlot::FACTORY_KEY_A || order[i] == AuthSlot::FACTORY_KEY_B;
+        uint8_t keyType = (order[i] == AuthSlot::USER_KEY_B || order[i] == AuthSlot::FACTORY_KEY_B) ? MIFARE_KEY_B : MIFARE_KEY_A;
+
+        uint32_t start = micros();
+        bool authenticated = nfc->mifareAuthenticate(target, block, keyType, factory ? FACTORY_KEY : sectorKey);
+        Stats::record(Phase::AUTH, micros() - start);
+        if (authenticated)
+        {
+            // Starting from the cached slot skipped the attempts ahead of it in the default order
+            if (i == 0 && cachedIndex > 0)
             {
-                allSuccess = false;
-                break;
+                authCache.recordAvoidedAttempts(cachedIndex);
             }
+            authCache.remember(target.uid, target.uidLength, sector, order[i]);
+            return order[i];
+        }
 
-            // Re-select the card after writing sector trailer to reset authentication state
-            // This is necessary for genuine Mifare cards
-            if (sector < 15)
+        // The key was never judged if the radio failed, try the same slot again on the re-selected tag
+        if (!nfc->authRejected())
+        {
+            if (!retryExchange(retries))
             {
-                success = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, &uid[0], &uidLength);
-                if (!success)
-                {
-                    allSuccess = false;
-                    break;
-                }
+                break;
             }
+            continue;
         }
-        else
+
+        // A failed authentication halts the tag, select it again before doing anything else
+        authCache.recordFailedAttempt();
+        Stats::recordAuthRetry();
+        if (!reselectTag())
         {
-            allSuccess = false;
             break;
         }
+        i++;
     }
 
-    // Power down NFC module to save power
-    powerDownNFC();
+    return AuthSlot::UNKNOWN;
+}
 
-    return allSuccess;
+bool RFIDController::retryExchange(uint8_t &retries)
+{
+    // Bounded per exchange and per command, a tag that has left the field fails in good time
+    if (retries >= BLOCK_RETRY_LIMIT || retryBudget == 0)
+    {
+        tagSelected = false;
+        return false;
+    }
+    retries++;
+    retryBudget--;
+    Stats::recordBlockRetry();
+
+    // The tag dropped back to idle, only the same UID is selected again
+    return reselectTag();
 }
 
-String RFIDController::getVersion()
+bool RFIDController::recoverBlock(uint8_t block, const uint8_t *sectorKey, uint8_t &retries)
+{
+    // A rejected exchange would be rejected again, only radio errors are retried
+    return !nfc->authRejected() && retryExchange(retries) &&
+           authenticateSector(block, sectorKey, DATA_SLOTS, 2) != AuthSlot::UNKNOWN;
+}
+
+String RFIDController::authCacheStats()
+{
+    return "ENTRIES " + String(authCache.entryCount()) +
+           " HITS " + String(authCache.hits()) +
+           " MISSES " + String(authCache.misses()) +
+           " FAILED_AUTHS " + String(authCache.failedAttempts()) +
+           " AVOIDED_AUTHS " + String(authCache.avoidedAttempts());
+}
+
+void RFIDController::clearAuthCache()
 {
-    return "1.3.1";
+    authCache.clear();
 }
 
-String RFIDController::bytesToHex(uint8_t *data, uint16_t length)
+String RFIDController::bytesToHex(const uint8_t *data, uint16_t length)
 {
+    uint32_t start = micros();
     String result = "";
+    result.reserve(length * 2);
     for (uint16_t i = 0; i < length; i++)
     {
         if (data[i] < 0x10)
@@ -499,114 +1402,272 @@ String RFIDController::bytesToHex(uint8_t *data, uint16_t length)
         result += String(data[i], HEX);
     }
     result.toUpperCase();
+    Stats::record(Phase::HEX_CODEC, micros() - start);
     return result;
 }
 
-void RFIDController::hexToBytes(const String &hex, uint8_t *bytes)
+uint16_t RFIDController::hexToBytes(const String &hex, uint8_t *bytes)
 {
-    for (int i = 0; i < hex.length(); i += 2)
+    uint32_t start = micros();
+    for (unsigned int i = 0; i < hex.length(); i += 2)
     {
         String byteString = hex.substring(i, i + 2);
         bytes[i / 2] = (uint8_t)strtol(byteString.c_str(), NULL, 16);
     }
+    Stats::record(Phase::HEX_CODEC, micros() - start);
+    return hex.length() / 2;
 }
 
-bool RFIDController::isDataAllZeros(const String &data)
+ReadStatus RFIDController::readMetadata(const uint8_t *keyBytes, PayloadMetadata &metadata)
 {
-    for (int i = 0; i < data.length(); i++)
+    // Legacy 512-byte area, kept for a metadata block without flags from earlier firmware
+    metadata.length = layout.capacity() < 512 ? layout.capacity() : 512;
+    metadata.originalLength = metadata.length;
+    metadata.compressed = false;
+    metadata.sectorMap = ~(uint64_t)0;
+    metadata.checksummed = false;
+    metadata.tableCrc = 0;
+
+    if (!nfc)
     {
-        if (data.charAt(i) != '0')
+        return ReadStatus::DONE;
+    }
+
+    // Sector 1, block 0 = block number 4, authenticated with the sector 1 key
+    int metadataBlock = CardLayout::METADATA_BLOCK;
+
+    // Authenticate and read metadata block
+    if (authenticateSector(metadataBlock, &keyBytes[6], DATA_SLOTS, 2) == AuthSlot::UNKNOWN)
+    {
+        return ReadStatus::FAILED;
+    }
+
+    uint8_t blockData[16];
+    uint8_t retries = 0;
+    bool success = nfc->mifareReadBlock(target, metadataBlock, blockData);
+    while (!success && recoverBlock(metadataBlock, &keyBytes[6], retries))
+    {
+        success = nfc->mifareReadBlock(target, metadataBlock, blockData);
+    }
+    if (!success)
+    {
+        return ReadStatus::UNREADABLE;
+    }
+
+    // Metadata carrying its own CRC is read once more before it is declared damaged
+    bool intact = !(blockData[0] & METADATA_CHECKSUMS) || metadataIntact(blockData);
+    for (uint8_t attempt = 0; !intact && attempt < SECTOR_REREAD_LIMIT; attempt++)
+    {
+        success = nfc->mifareReadBlock(target, metadataBlock, blockData);
+        while (!success && recoverBlock(metadataBlock, &keyBytes[6], retries))
         {
-            return false;
+            success = nfc->mifareReadBlock(target, metadataBlock, blockData);
+        }
+        if (!success)
+        {
+            return ReadStatus::UNREADABLE;
         }
+        intact = metadataIntact(blockData);
+    }
+    if (!intact)
+    {
+        return ReadStatus::CORRUPT;
     }
-    return true;
-}
 
+    // Payload length is stored in bytes 1-2 (big-endian)
+    uint16_t length = (blockData[1] << 8) | blockData[2];
+    bool compressed = blockData[0] & METADATA_COMPRESSED;
+    uint16_t originalLength = compressed ? (blockData[8] << 8) | blockData[9] : length;
+    // Ensure length fits the data area of this card; only earlier firmware's unflagged metadata falls back to the legacy size
+    if (length > layout.capacity() || originalLength > layout.capacity() || length > originalLength)
+    {
+        return blockData[0] ? ReadStatus::CORRUPT : ReadStatus::DONE;
+    }
 
-uint16_t RFIDController::readPayloadLength(const String &key, uint8_t *uid, uint8_t uidLength)
-{
-    if (!nfc)
+    metadata.length = length;
+    metadata.originalLength = originalLength;
+    metadata.compressed = compressed;
+    metadata.checksummed = blockData[0] & METADATA_CHECKSUMS;
+    metadata.tableCrc = (blockData[10] << 8) | blockData[11];
+    // Length-only metadata from earlier firmware: every sector up to the length is read
+    if (blockData[0] & METADATA_SECTOR_MAP)
     {
-        return 512; // Default to full size if read fails
+        metadata.sectorMap = 0;
+        for (uint8_t i = 0; i < 5; i++)
+        {
+            metadata.sectorMap |= (uint64_t)blockData[3 + i] << (i * 8);
+        }
     }
 
-    // Convert keys from hex string to bytes
-    uint8_t keyBytes[96];
-    hexToBytes(key, keyBytes);
+    return ReadStatus::DONE;
+}
+
+bool RFIDController::metadataIntact(const uint8_t *blockData)
+{
+    return crc16(0xFFFF, blockData, 12) == ((blockData[12] << 8) | blockData[13]);
+}
 
-    // Get the key for sector 1 (6 bytes per sector, so sector 1 starts at index 6)
-    uint8_t sectorKey[6];
-    for (int i = 0; i < 6; i++)
+bool RFIDController::writeMetadata(const uint8_t *keyBytes, const PayloadMetadata &metadata)
+{
+    if (!nfc)
     {
-        sectorKey[i] = keyBytes[6 + i]; // sector 1 key
+        return false;
     }
 
-    // Sector 1, block 0 = block number 4
-    int metadataBlock = 4;
+    // Sector 1, block 0 = block number 4, authenticated with the sector 1 key
+    int metadataBlock = CardLayout::METADATA_BLOCK;
 
-    // Authenticate and read metadata block
-    if (nfc->mifareclassic_AuthenticateBlock(uid, uidLength, metadataBlock, 1, sectorKey))
+    // Authenticate and write metadata block
+    if (authenticateSector(metadataBlock, &keyBytes[6], DATA_SLOTS, 2) != AuthSlot::UNKNOWN)
     {
         uint8_t blockData[16];
-        bool success = nfc->mifareclassic_ReadDataBlock(metadataBlock, blockData);
-        if (success)
+        buildMetadataBlock(metadata, blockData);
+
+        uint8_t retries = 0;
+        bool success = nfc->mifareWriteBlock(target, metadataBlock, blockData);
+        while (!success && recoverBlock(metadataBlock, &keyBytes[6], retries))
         {
-            // Payload length is stored in bytes 1-2 (big-endian)
-            uint16_t length = (blockData[1] << 8) | blockData[2];
-            // Ensure length is within valid range (0-512 bytes)
-            if (length > 512)
-            {
-                return 512; // Default to full size for invalid values
-            }
-            return length;
+            success = nfc->mifareWriteBlock(target, metadataBlock, blockData);
         }
+        return success;
     }
 
-    return 512; // Default to full size if read fails
+    return false;
 }
 
-bool RFIDController::writePayloadLength(const String &key, uint16_t length, uint8_t *uid, uint8_t uidLength)
+void RFIDController::buildMetadataBlock(const PayloadMetadata &metadata, uint8_t *blockData)
 {
-    if (!nfc)
+    // Initialize with zeros
+    memset(blockData, 0, 16);
+
+    // Store payload length in bytes 1-2 (big-endian)
+    blockData[1] = (metadata.length >> 8) & 0xFF; // High byte
+    blockData[2] = metadata.length & 0xFF;        // Low byte
+
+    // Sector map in bytes 3-7, bit 0 of byte 3 for sector 0
+    blockData[0] |= METADATA_SECTOR_MAP;
+    for (uint8_t i = 0; i < 5; i++)
     {
-        return false;
+        blockData[3 + i] = (metadata.sectorMap >> (i * 8)) & 0xFF;
+    }
+
+    // Original length of a compressed payload in bytes 8-9 (big-endian)
+    if (metadata.compressed)
+    {
+        blockData[0] |= METADATA_COMPRESSED;
+        blockData[8] = (metadata.originalLength >> 8) & 0xFF;
+        blockData[9] = metadata.originalLength & 0xFF;
+    }
+
+    // CRC of the checksum table in bytes 10-11, CRC of bytes 0-11 in bytes 12-13 (big-endian)
+    if (metadata.checksummed)
+    {
+        blockData[0] |= METADATA_CHECKSUMS;
+        blockData[10] = (metadata.tableCrc >> 8) & 0xFF;
+        blockData[11] = metadata.tableCrc & 0xFF;
+        uint16_t crc = crc16(0xFFFF, blockData, 12);
+        blockData[12] = (crc >> 8) & 0xFF;
+        blockData[13] = crc & 0xFF;
     }
+}
 
-    // Convert keys from hex string to bytes
-    uint8_t keyBytes[96];
-    hexToBytes(key, keyBytes);
+void RFIDController::appendChecksums(PayloadMetadata &metadata, BlockSlot *slots, uint16_t &slotCount)
+{
+    // The table starts on the block after the payload, one CRC-16 per sector holding payload blocks
+    uint16_t tableOffset = (metadata.length + 15) / 16 * 16;
+    uint8_t sectors[CardLayout::MAX_SECTORS];
+    uint16_t checksums[CardLayout::MAX_SECTORS];
+    uint8_t count = sectorChecksums(layout, payload, slots, slotCount, tableOffset, sectors, checksums);
+
+    // A payload filling the card is stored without checksums
+    if (tableOffset + count * 2 > layout.capacity())
+    {
+        return;
+    }
 
-    // Get the key for sector 1 (6 bytes per sector, so sector 1 starts at index 6)
-    uint8_t sectorKey[6];
-    for (int i = 0; i < 6; i++)
+    for (uint8_t i = 0; i < count; i++)
     {
-        sectorKey[i] = keyBytes[6 + i]; // sector 1 key
+        payload[tableOffset + i * 2] = (checksums[i] >> 8) & 0xFF;
+        payload[tableOffset + i * 2 + 1] = checksums[i] & 0xFF;
     }
+    metadata.checksummed = true;
+    metadata.tableCrc = crc16(0xFFFF, &payload[tableOffset], count * 2);
 
-    // Sector 1, block 0 = block number 4
-    int metadataBlock = 4;
+    slotCount = layout.plan(tableOffset + count * 2, slots);
+    metadata.sectorMap = usedSectors(payload, slots, slotCount);
+}
 
-    // Authenticate and write metadata block
-    if (nfc->mifareclassic_AuthenticateBlock(uid, uidLength, metadataBlock, 1, sectorKey))
+uint16_t RFIDController::storedLength(const PayloadMetadata &metadata)
+{
+    if (!metadata.checksummed)
     {
-        uint8_t blockData[16];
+        return metadata.length;
+    }
 
-        // Initialize with zeros
-        for (int i = 0; i < 16; i++)
+    // Table entries are counted the way appendChecksums made them, from the payload blocks alone
+    uint16_t tableOffset = (metadata.length + 15) / 16 * 16;
+    BlockSlot slots[CardLayout::MAX_DATA_BLOCKS];
+    uint16_t slotCount = layout.plan(tableOffset, slots);
+    uint8_t count = 0;
+    int lastSector = -1;
+    for (uint16_t i = 0; i < slotCount; i++)
+    {
+        int sector = layout.sectorOf(slots[i].block);
+        if (sector != lastSector)
         {
-            blockData[i] = 0x00;
+            count++;
+            lastSector = sector;
         }
+    }
+    return tableOffset + count * 2;
+}
 
-        // Store payload length in bytes 1-2 (big-endian)
-        blockData[1] = (length >> 8) & 0xFF; // High byte
-        blockData[2] = length & 0xFF;        // Low byte
+void RFIDController::compressPayload(PayloadMetadata &metadata, BlockSlot *slots, uint16_t &slotCount)
+{
+    // Only a stream shorter than the payload can save blocks
+    if (metadata.length < 2)
+    {
+        return;
+    }
+    memset(staging, 0, sizeof(staging));
+    uint16_t packedLength = PayloadCodec::compress(payload, metadata.length, staging, metadata.length - 1);
+    if (packedLength == 0)
+    {
+        return;
+    }
 
-        bool success = nfc->mifareclassic_WriteDataBlock(metadataBlock, blockData);
-        return success;
+    BlockSlot packedSlots[CardLayout::MAX_DATA_BLOCKS];
+    uint16_t packedCount = layout.plan(packedLength, packedSlots);
+    uint64_t packedMap = usedSectors(staging, packedSlots, packedCount);
+    if (exchangeCost(layout, packedSlots, packedCount, packedMap) >= exchangeCost(layout, slots, slotCount, metadata.sectorMap))
+    {
+        return;
     }
 
-    return false;
+    memcpy(payload, staging, sizeof(payload));
+    memcpy(slots, packedSlots, packedCount * sizeof(BlockSlot));
+    slotCount = packedCount;
+    metadata.compressed = true;
+    metadata.length = packedLength;
+    metadata.sectorMap = packedMap;
+}
+
+uint64_t RFIDController::usedSectors(const uint8_t *data, const BlockSlot *slots, uint16_t slotCount)
+{
+    uint64_t sectorMap = 0;
+    for (uint16_t i = 0; i < slotCount; i++)
+    {
+        const uint8_t *block = &data[slots[i].offset];
+        for (uint8_t b = 0; b < 16; b++)
+        {
+            if (block[b] != 0)
+            {
+                sectorMap |= (uint64_t)1 << layout.sectorOf(slots[i].block);
+                break;
+            }
+        }
+    }
+    return sectorMap;
 }
 
 uint16_t RFIDController::calculatePayloadLength(const String &data)
@@ -0,0 +1,480 @@
+#include "ReaderWorker.h"
+
+ReaderWorker::ReaderWorker()
+{
+    index = 0;
+    queue = nullptr;
+    prefix[0] = '\0';
+    armed = false;
+    armAddressed = false;
+    armTimeoutMs = 0;
+    armRemaining = 0;
+    armServed = 0;
+    armWaitStart = 0;
+    servedCount = 0;
+    failedCount = 0;
+}
+
+void ReaderWorker::begin(uint8_t index, uint8_t ssPin, uint8_t resetPin)
+{
+    this->index = index;
+    snprintf(prefix, sizeof(prefix), "@%u ", index);
+
+    rfid.begin(ssPin, resetPin, index);
+
+    queue = xQueueCreate(READER_QUEUE_DEPTH, sizeof(ParsedCommand *));
+
+    // Each reader blocks in its own task, so one PN532 waiting on the radio leaves the
+    // SPI bus and the CPU to the others
+    char name[12];
+    snprintf(name, sizeof(name), "reader%u", index);
+    xTaskCreate(taskEntry, name, READER_TASK_STACK, this, 1, nullptr);
+}
+
+bool ReaderWorker::submit(const ParsedCommand &parsed)
+{
+    ParsedCommand *command = new ParsedCommand(parsed);
+    if (xQueueSend(queue, &command, 0) != pdTRUE)
+    {
+        delete command;
+        return false;
+    }
+    return true;
+}
+
+void ReaderWorker::taskEntry(void *worker)
+{
+    static_cast<ReaderWorker *>(worker)->run();
+}
+
+void ReaderWorker::run()
+{
+    for (;;)
+    {
+        // Sleep until a command arrives, unless an armed operation has to keep polling
+        ParsedCommand *command = nullptr;
+        if (xQueueReceive(queue, &command, armed ? 0 : portMAX_DELAY) == pdTRUE)
+        {
+            // Replies carry the reader prefix only if the command was addressed with one
+            Response::setLinePrefix(command->reader >= 0 ? prefix : "");
+            rfid.addressTag(command->tag);
+            Capture::beginCommand(index, command->originalCommand);
+            executeCommand(*command);
+            Capture::endCommand();
+            rfid.addressTag("");
+            delete command;
+        }
+
+        if (armed)
+        {
+            serviceArmed();
+        }
+    }
+}
+
+bool ReaderWorker::executeCommand(const ParsedCommand &parsed)
+{
+    uint32_t start = micros();
+    bool success = true;
+
+    switch (parsed.code)
+    {
+    case CommandCode::SCAN_UID:
+    {
+        String uid = rfid.scanUID();
+        success = uid.length() > 0;
+        if (success)
+        {
+            Response::sendOK("UID " + uid);
+        }
+        else
+        {
+            Response::sendVerboseError("NO_TAG", "No RFID tag detected in range", "SCAN_UID operation");
+        }
+    }
+    break;
+
+    case CommandCode::READ:
+    {
+        ReadResult result = rfid.readData(parsed.arg1);
+        success = sendReadResult(result, "READ", "DATA " + result.data);
+    }
+    break;
+
+    case CommandCode::DIGEST:
+    {
+        ReadResult result = rfid.readDigest(parsed.arg1);
+        success = sendReadResult(result, "DIGEST", "DIGEST " + result.data);
+    }
+    break;
+
+    case CommandCode::VERIFY:
+    {
+        // A mismatch is an answer like a match, only reading the tag can fail
+        ReadResult result = rfid.readDigest(parsed.arg1);
+        success = sendReadResult(result, "VERIFY", result.data == parsed.arg2 ? "VERIFY MATCH" : "VERIFY MISMATCH");
+    }
+    break;
+
+    case CommandCode::WRITE:
+    {
+        WriteResult result = rfid.writeData(parsed.arg1, parsed.arg2);
+        success = sendWriteResult(result, "WRITE");
+    }
+    break;
+
+    case CommandCode::WRITE_RESUME:
+    {
+        WriteResult result = rfid.resumeWrite(parsed.arg1, parsed.uid, parsed.blockOffset, parsed.arg2);
+        success = sendWriteResult(result, "WRITE_RESUME");
+    }
+    break;
+
+    case CommandCode::ENROLL:
+    {
+        EnrollResult result = rfid.enrollKey(parsed.arg1);
+        success = sendEnrollResult(result, "ENROLL");
+    }
+    break;
+
+    case CommandCode::PROVISION:
+    {
+        ProvisionResult result = rfid.provision(parsed.arg1, parsed.arg2, parsed.verify);
+        success = sendProvisionResult(result);
+    }
+    break;
+
+    case CommandCode::INFO:
+    {
+        String info = rfid.cardInfo();
+        success = info.length() > 0;
+        if (success)
+        {
+            Response::sendOK("INFO " + info);
+        }
+        else
+        {
+            Response::sendVerboseError("NO_TAG", "No RFID tag detected in range", "INFO operation");
+        }
+    }
+    break;
+
+    case CommandCode::INVENTORY:
+    {
+        String tags = rfid.inventory();
+        success = tags.length() > 0;
+        if (success)
+        {
+            Response::sendOK("INVENTORY " + tags);
+        }
+        else
+        {
+            Response::sendVerboseError("NFC_ERROR", "Reader did not respond", "INVENTORY operation");
+        }
+    }
+    break;
+
+    case CommandCode::AUTH_CACHE:
+    {
+        if (parsed.arg1 == "CLEAR")
+        {
+            rfid.clearAuthCache();
+        }
+        Response::sendOK("AUTH_CACHE " + rfid.authCacheStats());
+    }
+    break;
+
+    case CommandCode::ARM:
+    {
+        arm(parsed);
+    }
+    break;
+
+    case CommandCode::DISARM:
+    {
+        if (armed)
+        {
+            disarm();
+            Response::sendOK("DISARMED SERVED " + String(armServed));
+        }
+        else
+        {
+            Response::sendVerboseError("NOT_ARMED", "No operation is armed", "DISARM operation");
+        }
+    }
+    break;
+
+    default:
+        // This should not happen with the new parser, but keep as fallback
+        Response::sendVerboseError("UNKNOWN_CMD", "Unrecognized command received", "Valid commands: SCAN_UID, READ, WRITE, VERSION, HELP");
+        success = false;
+        break;
+    }
+
+    Stats::record(Phase::COMMAND, micros() - start);
+    Stats::recordCommand(success);
+    return success;
+}
+
+void ReaderWorker::arm(const ParsedCommand &parsed)
+{
+    // The operation is parsed here once, every card then runs the stored command
+    armedCommand = CommandParser::parse(parsed.arg1);
+    armAddressed = parsed.reader >= 0;
+    armTimeoutMs = parsed.timeoutMs;
+    armRemaining = parsed.count;
+    armServed = 0;
+    servedCount = 0;
+    failedCount = 0;
+    armWaitStart = millis();
+    armed = true;
+
+    // Keep the PN532 powered between cards, only the RF field is cycled
+    rfid.setArmed(true);
+
+    Response::sendOK("ARMED " + parsed.arg2 + " COUNT " + String(armRemaining));
+}
+
+void ReaderWorker::disarm()
+{
+    armed = false;
+    rfid.setArmed(false);
+}
+
+void ReaderWorker::serviceArmed()
+{
+    // Tag events carry the reader prefix if ARM itself was addressed with one
+    Response::setLinePrefix(armAddressed ? prefix : "");
+
+    if (armTimeoutMs > 0 && millis() - armWaitStart >= armTimeoutMs)
+    {
+        disarm();
+        Response::sendVerboseError("ARM_TIMEOUT", "No new tag arrived in time", "ARM operation - SERVED " + String(armServed));
+        return;
+    }
+
+    // Captured from the poll on, so replay finds the tag the way the reader did. Polls that
+    // find no new tag are dropped.
+    Capture::beginCommand(index, String(armAddressed ? prefix : "") + "ARM_TAG " + armedCommand.originalCommand);
+    String uid = rfid.pollTag();
+    if (uid.length() == 0)
+    {
+        Capture::cancelCommand();
+        // The field is empty, so failed cards have been taken away and are retried when presented again
+        failedCount = 0;
+        return;
+    }
+    if (isServed(uid) || isFailed(uid))
+    {
+        Capture::cancelCommand();
+        return;
+    }
+
+    Response::sendOK("ARM_TAG " + uid);
+
+    // Serve the tag just reported, not whichever one answers first with several in the field
+    rfid.addressTag(uid);
+    bool served = executeCommand(armedCommand);
+    rfid.addressTag("");
+    Capture::endCommand();
+    if (served)
+    {
+        markServed(uid);
+        armServed++;
+        armRemaining--;
+        armWaitStart = millis();
+    }
+    else
+    {
+        // Not run again while it stays in the field, and the wait for a tag goes on
+        markFailed(uid);
+    }
+
+    if (armRemaining == 0)
+    {
+        disarm();
+        Response::sendOK("ARM_DONE SERVED " + String(armServed));
+    }
+}
+
+bool ReaderWorker::isServed(const String &uid)
+{
+    uint8_t count = servedCount < ARM_SERVED_UIDS ? servedCount : ARM_SERVED_UIDS;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (servedUids[i] == uid)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ReaderWorker::markServed(const String &uid)
+{
+    // Ring of the most recent UIDs, the oldest is overwritten once it is full
+    servedUids[servedCount % ARM_SERVED_UIDS] = uid;
+    servedCount++;
+}
+
+bool ReaderWorker::sendWriteResult(const WriteResult &result, const String &operation)
+{
+    switch (result.status)
+    {
+    case WriteStatus::DONE:
+        Response::sendOK("WRITE_DONE");
+        break;
+
+    case WriteStatus::UID_MISMATCH:
+        Response::sendVerboseError("UID_MISMATCH", "Tag in range is not the tag the interrupted write started on", operation + " operation - found UID " + result.uid);
+        break;
+
+    case WriteStatus::TOO_LARGE:
+        Response::sendVerboseError("WRITE_FAIL", "Payload does not fit the tag or the sectors covered by the key", operation + " operation - UID " + result.uid + ", use INFO for capacity and key length");
+        break;
+
+    case WriteStatus::FAILED:
+        // Report how far the tag got so the host can continue with WRITE_RESUME instead of starting over
+        Response::sendVerboseError("WRITE_FAIL", "Failed to write data to RFID tag",
+                                   operation + " operation - UID " + result.uid + " BLOCKS " + String(result.blocksWritten) + "/" + String(result.blocksTotal) +
+                                       ", continue with WRITE_RESUME <key> " + result.uid + " " + String(result.blocksWritten) + " <data>");
+        break;
+
+    default:
+        Response::sendVerboseError("WRITE_FAIL", "Failed to write data to RFID tag", operation + " operation - check tag presence and key validity");
+        break;
+    }
+
+    return result.status == WriteStatus::DONE;
+}
+
+bool ReaderWorker::sendReadResult(const ReadResult &result, const String &operation, const String &reply)
+{
+    switch (result.status)
+    {
+    case ReadStatus::DONE:
+        Response::sendOK(reply + (result.verified ? " VERIFIED" : ""));
+        break;
+
+    case ReadStatus::UNREADABLE:
+        // Without the metadata the payload length and sector map are unknown
+        Response::sendVerboseError("READ_FAILED", "Payload metadata block could not be read",
+                                   operation + " operation - UID " + result.uid + " BLOCK 4");
+        break;
+
+    case ReadStatus::CORRUPT:
+        // Left by an interrupted write, rewriting the card repairs it
+        Response::sendVerboseError("INTEGRITY_FAIL", "Payload does not match its sector checksums",
+                                   operation + " operation - UID " + result.uid + " SECTORS " + sectorBitmap(result.corrupted, result.sectors));
+        break;
+
+    default:
+        Response::sendVerboseError("AUTH_FAILED", "Authentication failed or no tag present", operation + " operation with provided key");
+        break;
+    }
+
+    return result.status == ReadStatus::DONE;
+}
+
+bool ReaderWorker::sendEnrollResult(const EnrollResult &result, const String &operation)
+{
+    switch (result.status)
+    {
+    case EnrollStatus::DONE:
+        Response::sendOK("ENROLL_DONE ENROLLED " + sectorBitmap(result.enrolled, result.sectors) + " SKIPPED " + sectorBitmap(result.skipped, result.sectors));
+        break;
+
+    case EnrollStatus::NO_TAG:
+        Response::sendVerboseError("NO_TAG", "No RFID tag detected in range", operation + " operation");
+        break;
+
+    case EnrollStatus::UNSUPPORTED:
+        Response::sendVerboseError("ENROLL_FAIL", "Tag has no sector trailers to enroll", operation + " operation - UID " + result.uid + ", only MIFARE Classic tags can be enrolled");
+        break;
+
+    default:
+        // Sectors already enrolled are skipped on the next attempt, so retrying only costs the failed ones
+        Response::sendVerboseError("ENROLL_FAIL", "Failed to enroll keys to RFID tag",
+                                   operation + " operation - UID " + result.uid + " ENROLLED " + sectorBitmap(result.enrolled, result.sectors) +
+                                       " SKIPPED " + sectorBitmap(result.skipped, result.sectors) + " FAILED " + sectorBitmap(result.failed, result.sectors) +
+                                       ", retry ENROLL to finish the failed sectors");
+        break;
+    }
+
+    return result.status == EnrollStatus::DONE;
+}
+
+String ReaderWorker::sectorBitmap(uint64_t bits, uint8_t sectors)
+{
+    // One hex digit per four sectors, most significant first, bit n is sector n
+    String hex = "";
+    for (int digit = (sectors + 3) / 4 - 1; digit >= 0; digit--)
+    {
+        hex += "0123456789ABCDEF"[(bits >> (digit * 4)) & 0x0F];
+    }
+    return hex;
+}
+
+bool ReaderWorker::sendProvisionResult(const ProvisionResult &result)
+{
+    const EnrollResult &enroll = result.enroll;
+    const WriteResult &write = result.write;
+
+    if (enroll.status == EnrollStatus::NO_TAG || enroll.status == EnrollStatus::UNSUPPORTED)
+    {
+        return sendEnrollResult(enroll, "PROVISION");
+    }
+
+    String sectors = "ENROLLED " + sectorBitmap(enroll.enrolled, enroll.sectors) + " SKIPPED " + sectorBitmap(enroll.skipped, enroll.sectors);
+
+    switch (write.status)
+    {
+    case WriteStatus::DONE:
+        Response::sendOK("PROVISION_DONE " + sectors + " BLOCKS " + String(write.blocksTotal) + (result.verified ? " VERIFIED" : ""));
+        break;
+
+    case WriteStatus::TOO_LARGE:
+        Response::sendVerboseError("PROVISION_FAIL", "Payload does not fit the tag or the sectors covered by the key", "PROVISION operation - UID " + write.uid + ", use INFO for capacity and key length");
+        break;
+
+    case WriteStatus::VERIFY_FAILED:
+        Response::sendVerboseError("VERIFY_FAIL", "Block read back from the tag does not match the data written",
+                                   "PROVISION operation - UID " + write.uid + " " + sectors + " BLOCKS " + String(write.blocksWritten) + "/" + String(write.blocksTotal));
+        break;
+
+    default:
+        // Sectors that got their trailer open with the new Key B next time, so PROVISION can simply be repeated
+        Response::sendVerboseError("PROVISION_FAIL", "Failed to provision RFID tag",
+                                   "PROVISION operation - UID " + write.uid + " " + sectors + " BLOCKS " + String(write.blocksWritten) + "/" + String(write.blocksTotal) +
+                                       ", retry PROVISION to finish the card");
+        break;
+    }
+
+    return write.status == WriteStatus::DONE;
+}
+
+bool ReaderWorker::isFailed(const String &uid)
+{
+    for (uint8_t i = 0; i < failedCount; i++)
+    {
+        if (failedUids[i] == uid)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ReaderWorker::markFailed(const String &uid)
+{
+    // With the list full the oldest entry goes, that card is retried once more
+    if (failedCount == ARM_FAILED_UIDS)
+    {
+        for (uint8_t i = 1; i < ARM_FAILED_UIDS; i++)
+        {
+            failedUids[i - 1] = failedUids[i];
+        }
+        failedCount--;
+    }
+    failedUids[failedCount++] = uid;
+}
@@ -1,23 +1,74 @@
 #include "Response.h"
+#include "Stats.h"
+#include "Capture.h"
+
+static SemaphoreHandle_t outputLock = nullptr;
+static thread_local char linePrefix[Response::PREFIX_SIZE] = "";
+
+void Response::begin()
+{
+    if (!outputLock)
+    {
+        outputLock = xSemaphoreCreateMutex();
+    }
+}
+
+void Response::setLinePrefix(const char *prefix)
+{
+    snprintf(linePrefix, sizeof(linePrefix), "%s", prefix);
+}
+
+void Response::writeLine(const String &line)
+{
+    if (Capture::isEnabled())
+    {
+        Capture::replyLine(line);
+    }
+    writeLocked(linePrefix + line);
+}
+
+void Response::sendRaw(const String &line)
+{
+    writeLocked(line);
+}
+
+void Response::writeLocked(const String &output)
+{
+    if (outputLock)
+    {
+        xSemaphoreTake(outputLock, portMAX_DELAY);
+    }
+
+    uint32_t start = micros();
+    Serial.println(output);
+    Stats::record(Phase::UART_TX, micros() - start);
+
+    if (outputLock)
+    {
+        xSemaphoreGive(outputLock);
+    }
+}
 
 void Response::sendOK(const String &message)
 {
-    Serial.println("OK " + message);
+    writeLine("OK " + message);
 }
 
 void Response::sendError(const String &message)
 {
-    Serial.println("ERR " + message);
+    writeLine("ERR " + message);
 }
 
 void Response::sendVerboseError(const String &errorCode, const String &description)
 {
-    Serial.println("ERR " + errorCode + " - " + description);
+    Stats::recordError(errorCode);
+    writeLine("ERR " + errorCode + " - " + description);
 }
 
 void Response::sendVerboseError(const String &errorCode, const String &description, const String &context)
 {
-    Serial.println("ERR " + errorCode + " - " + description + " (" + context + ")");
+    Stats::recordError(errorCode);
+    writeLine("ERR " + errorCode + " - " + description + " (" + context + ")");
 }
 
 void Response::send(const String &message, ResponseStatus status)
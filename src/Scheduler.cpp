@@ -0,0 +1,110 @@
+#include "Scheduler.h"
+
+struct Timer
+{
+    TimerCallback callback; // nullptr when the slot is free
+    void *context;
+    uint32_t periodMs;      // 0 for a one-shot timer
+    uint32_t dueMs;
+};
+
+static Timer timers[SCHEDULER_MAX_TIMERS];
+static TaskHandle_t loopTask = nullptr;
+
+void Scheduler::begin()
+{
+    loopTask = xTaskGetCurrentTaskHandle();
+}
+
+static int8_t addTimer(uint32_t delayMs, uint32_t periodMs, TimerCallback callback, void *context)
+{
+    for (int8_t id = 0; id < SCHEDULER_MAX_TIMERS; id++)
+    {
+        if (timers[id].callback == nullptr)
+        {
+            timers[id].callback = callback;
+            timers[id].context = context;
+            timers[id].periodMs = periodMs;
+            timers[id].dueMs = millis() + delayMs;
+            return id;
+        }
+    }
+    return -1;
+}
+
+int8_t Scheduler::every(uint32_t periodMs, TimerCallback callback, void *context)
+{
+    return addTimer(periodMs, periodMs, callback, context);
+}
+
+int8_t Scheduler::after(uint32_t delayMs, TimerCallback callback, void *context)
+{
+    return addTimer(delayMs, 0, callback, context);
+}
+
+void Scheduler::cancel(int8_t id)
+{
+    if (id >= 0 && id < SCHEDULER_MAX_TIMERS)
+    {
+        timers[id].callback = nullptr;
+    }
+}
+
+void Scheduler::wake()
+{
+    if (loopTask != nullptr)
+    {
+        xTaskNotifyGive(loopTask);
+    }
+}
+
+void Scheduler::waitForEvent()
+{
+    uint32_t now = millis();
+    uint32_t waitMs = SCHEDULER_IDLE_MS;
+    for (uint8_t id = 0; id < SCHEDULER_MAX_TIMERS; id++)
+    {
+        if (timers[id].callback != nullptr)
+        {
+            // Signed difference, millis() wraps after 49 days
+            int32_t untilDue = (int32_t)(timers[id].dueMs - now);
+            if (untilDue <= 0)
+            {
+                return;
+            }
+            if ((uint32_t)untilDue < waitMs)
+            {
+                waitMs = untilDue;
+            }
+        }
+    }
+
+    // A wake() since the last wait is counted, so input that arrived meanwhile is not missed
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+}
+
+void Scheduler::runDue()
+{
+    uint32_t now = millis();
+    for (uint8_t id = 0; id < SCHEDULER_MAX_TIMERS; id++)
+    {
+        Timer &timer = timers[id];
+        if (timer.callback == nullptr || (int32_t)(timer.dueMs - now) > 0)
+        {
+            continue;
+        }
+
+        TimerCallback callback = timer.callback;
+        void *context = timer.context;
+        if (timer.periodMs > 0)
+        {
+            // Next period from now, a late run is not made up with a burst
+            timer.dueMs = now + timer.periodMs;
+        }
+        else
+        {
+            timer.callback = nullptr;
+        }
+        callback(context);
+    }
+}
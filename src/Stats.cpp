@@ -0,0 +1,159 @@
+#include "Stats.h"
+
+static const char *PHASE_NAMES[] = {"COMMAND", "POWER_UP", "DETECT", "AUTH", "BLOCK_READ", "BLOCK_WRITE", "HEX_CODEC", "UART_TX", "LOOP"};
+
+struct PhaseStats
+{
+    uint32_t count;
+    uint64_t total;
+    uint32_t max;
+    uint32_t buckets[Stats::BUCKETS];
+};
+
+struct ErrorCount
+{
+    char code[20];
+    uint32_t count;
+};
+
+// Reader tasks record concurrently, every update happens under this lock
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+static PhaseStats phases[(uint8_t)Phase::COUNT];
+static ErrorCount errors[Stats::MAX_ERROR_CODES];
+static uint8_t errorCodes = 0;
+static uint32_t ops = 0;
+static uint32_t failedOps = 0;
+static uint32_t authRetries = 0;
+static uint32_t blockRetries = 0;
+
+void Stats::record(Phase phase, uint32_t micros)
+{
+    uint8_t bucket = 0;
+    if (micros >= 64)
+    {
+        // Index of the highest set bit, 6 for 64 us
+        bucket = 31 - __builtin_clz(micros) - 5;
+        if (bucket >= BUCKETS)
+        {
+            bucket = BUCKETS - 1;
+        }
+    }
+
+    PhaseStats &stats = phases[(uint8_t)phase];
+    portENTER_CRITICAL(&statsLock);
+    stats.count++;
+    stats.total += micros;
+    if (micros > stats.max)
+    {
+        stats.max = micros;
+    }
+    stats.buckets[bucket]++;
+    portEXIT_CRITICAL(&statsLock);
+}
+
+void Stats::recordCommand(bool success)
+{
+    portENTER_CRITICAL(&statsLock);
+    ops++;
+    if (!success)
+    {
+        failedOps++;
+    }
+    portEXIT_CRITICAL(&statsLock);
+}
+
+void Stats::recordAuthRetry()
+{
+    portENTER_CRITICAL(&statsLock);
+    authRetries++;
+    portEXIT_CRITICAL(&statsLock);
+}
+
+void Stats::recordBlockRetry()
+{
+    portENTER_CRITICAL(&statsLock);
+    blockRetries++;
+    portEXIT_CRITICAL(&statsLock);
+}
+
+void Stats::recordError(const String &errorCode)
+{
+    portENTER_CRITICAL(&statsLock);
+    uint8_t i = 0;
+    while (i < errorCodes && strcmp(errors[i].code, errorCode.c_str()) != 0)
+    {
+        i++;
+    }
+
+    // Codes past the table size are only counted in FAILED
+    if (i == errorCodes && errorCodes < MAX_ERROR_CODES)
+    {
+        strncpy(errors[i].code, errorCode.c_str(), sizeof(errors[i].code) - 1);
+        errors[i].code[sizeof(errors[i].code) - 1] = '\0';
+        errors[i].count = 0;
+        errorCodes++;
+    }
+    if (i < errorCodes)
+    {
+        errors[i].count++;
+    }
+    portEXIT_CRITICAL(&statsLock);
+}
+
+void Stats::reset()
+{
+    portENTER_CRITICAL(&statsLock);
+    memset(phases, 0, sizeof(phases));
+    errorCodes = 0;
+    ops = 0;
+    failedOps = 0;
+    authRetries = 0;
+    blockRetries = 0;
+    portEXIT_CRITICAL(&statsLock);
+}
+
+String Stats::report()
+{
+    // Copy under the lock, format outside of it
+    PhaseStats snapshot[(uint8_t)Phase::COUNT];
+    ErrorCount errorSnapshot[MAX_ERROR_CODES];
+    portENTER_CRITICAL(&statsLock);
+    memcpy(snapshot, phases, sizeof(snapshot));
+    memcpy(errorSnapshot, errors, sizeof(errorSnapshot));
+    uint8_t codes = errorCodes;
+    uint32_t opCount = ops;
+    uint32_t failed = failedOps;
+    uint32_t retries = authRetries;
+    uint32_t radioRetries = blockRetries;
+    portEXIT_CRITICAL(&statsLock);
+
+    String report = "OPS " + String(opCount) + " FAILED " + String(failed) + " AUTH_RETRIES " + String(retries) + " BLOCK_RETRIES " + String(radioRetries) + " ERRORS ";
+    if (codes == 0)
+    {
+        report += "-";
+    }
+    for (uint8_t i = 0; i < codes; i++)
+    {
+        report += String(i > 0 ? "," : "") + errorSnapshot[i].code + "=" + String(errorSnapshot[i].count);
+    }
+
+    for (uint8_t p = 0; p < (uint8_t)Phase::COUNT; p++)
+    {
+        const PhaseStats &stats = snapshot[p];
+        uint32_t average = stats.count > 0 ? (uint32_t)(stats.total / stats.count) : 0;
+        report += String(" ") + PHASE_NAMES[p] + " N=" + String(stats.count) + " AVG=" + String(average) + " MAX=" + String(stats.max) + " H=";
+
+        // Trailing empty buckets are left out
+        uint8_t last = BUCKETS;
+        while (last > 1 && stats.buckets[last - 1] == 0)
+        {
+            last--;
+        }
+        for (uint8_t b = 0; b < last; b++)
+        {
+            report += String(b > 0 ? "," : "") + String(stats.buckets[b]);
+        }
+    }
+
+    return report;
+}